@@ -0,0 +1,59 @@
+//------------------------------------------------------------
+// AudioBackend.h
+// Interface of the file readers registered with FormatManager
+//------------------------------------------------------------
+
+#pragma once
+
+#include <boost/shared_ptr.hpp>
+
+#include <AudioFile.h>
+#include <AudioFormat.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class AudioBackend
+    //
+    // A backend creates AudioFiles for the formats it can read.
+    // When several backends can read a format, FormatManager uses
+    // the one with the highest priority that has the requested features.
+    //------------------------------------------------------------------
+
+    class AudioBackend
+    {
+    public:
+        enum Feature
+        {
+            FeatureSeekable     = 1 << 0,   // seek is supported
+            FeatureStreaming    = 1 << 1,   // read decodes incrementally
+            FeatureMemoryMapped = 1 << 2,   // input can be memory mapped
+            FeatureParallel     = 1 << 3,   // load can use several threads
+            FeatureWrite        = 1 << 4    // files can be written
+        };
+
+        virtual ~AudioBackend() {}
+
+        virtual const char* getName() const = 0;
+        virtual int getPriority() const = 0;
+        virtual unsigned getFeatures() const = 0;
+        bool hasFeatures(unsigned features) const       { return (getFeatures() & features) == features; }
+
+        // Adds the formats and codecs the backend knows.
+        //
+        virtual void initFormatInfos(FormatInfoVector& infos) const = 0;
+        virtual void initCodecInfos(CodecInfoVector& infos) const = 0;
+
+        // FORMAT_UNKNOWN is asked when neither the content nor the extension
+        // of a file is known. A backend that probes the content itself may accept it.
+        //
+        virtual bool canRead(FormatId format) const = 0;
+        virtual bool isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate, int numChannels) const = 0;
+
+        virtual AudioFilePtr createFile() const = 0;
+    };
+
+    typedef boost::shared_ptr<AudioBackend> AudioBackendPtr;
+
+} // namespace e3
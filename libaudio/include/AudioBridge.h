@@ -7,6 +7,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <string>
 #include <vector>
 #include <boost/shared_ptr.hpp>
@@ -55,7 +56,7 @@ namespace e3 {
         virtual ~AudioBridge();
 
         typedef EnumNames<AudioPortId> PortNames;
-        static const PortNames& getPortNames()    { return portNames_s; }
+        static const PortNames& getPortNames();
 
         const AudioDeviceInfoVector& getDevices() const { return devices_; }
         const AudioDeviceInfo& getDeviceInfo(int deviceId) const;
@@ -68,9 +69,8 @@ namespace e3 {
     private:
         AudioDeviceInfoVector devices_;
         static PortNames portNames_s;
-
-        struct Initializer { Initializer(); };
-        static Initializer initializer_s;
+        static std::once_flag initFlag_s;
+        static void initPortNames();
 
         void findSupportedSampleRates(AudioDeviceInfo& deviceInfo) const;
     };
@@ -3,18 +3,37 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
 
 #include <e3_Buffer.h>
 
+#include <MemoryBudget.h>
+
 
 
 namespace e3 {
 
+    //------------------------------------------------------------------
+    // class AudioBuffer
+    //
+    // The sample memory of every AudioBuffer is accounted by the
+    // MemoryBudget. A buffer may be spilled to disk by the budget,
+    // its data is restored transparently by getHead().
+    // Code that reads or writes through the pointer from getHead()
+    // holds a ScopedPin meanwhile, another thread may spill the buffer
+    // otherwise.
+    //------------------------------------------------------------------
+
     class AudioBuffer : public Buffer < float >
     {
+        friend class MemoryBudget;
+
     public:
-        AudioBuffer(int numChannels = 0);
+        AudioBuffer(int numChannels = 0, MemoryCategory category = MemorySamples);
         AudioBuffer(const AudioBuffer& source);
+        ~AudioBuffer();
 
         AudioBuffer& operator= (const AudioBuffer& source);
 
@@ -44,17 +63,71 @@ namespace e3 {
         float* getCurrent();
 
         float* resize(size_t size, bool clearData = true);
+        void clear();
+
+        float* getHead() const;
+        operator float*() const                { return getHead(); }
+        float* operator+ (size_t index) const  { return getHead() + index; }
+
+        MemoryCategory getMemoryCategory() const { return category_; }
+        void setMemoryCategory(MemoryCategory category);
+
+        // A pinned buffer is never spilled to disk, pin() restores a spilled buffer.
+        // Calls must be balanced. Pinning counts as an access for the budget.
+        //
+        void pin() const;
+        void unpin() const                     { ASSERT(numPins_ > 0); lastAccess_ = MemoryBudget::tick(); --numPins_; }
+        bool isPinned() const                  { return numPins_ > 0; }
+        bool isSpilled() const                 { return spilled_; }
 
     protected:
         int sampleRate_;
         int numChannels_;
         int64_t numFrames_;
         int64_t framePos_;
+
+        MemoryCategory category_;
+        mutable std::atomic<int> numPins_;
+        std::atomic<bool> spilled_;
+        mutable std::atomic<uint64> lastAccess_;
+        int64_t numAccountedBytes_;             // owned by MemoryBudget
+        std::string spillPath_;                 // owned by MemoryBudget
+    };
+
+    typedef boost::shared_ptr<AudioBuffer> AudioBufferPtr;
+
+
+
+    //------------------------------------------------------------------
+    // class ScopedPin
+    //
+    // Keeps an AudioBuffer pinned while in scope.
+    //------------------------------------------------------------------
+
+    class ScopedPin
+    {
+    public:
+        explicit ScopedPin(const AudioBuffer* buffer) : buffer_(buffer)  { buffer_->pin(); }
+        ~ScopedPin()                                                     { buffer_->unpin(); }
+
+    private:
+        ScopedPin(const ScopedPin&);
+        ScopedPin& operator= (const ScopedPin&);
+
+        const AudioBuffer* buffer_;
     };
 
 
     // AudioBuffer inlines
 
+    inline float* AudioBuffer::getHead() const
+    {
+        if (spilled_) {
+            MemoryBudget::instance().restore(const_cast<AudioBuffer*>(this));
+        }
+        return data_;
+    }
+
     inline int64_t AudioBuffer::getAvailable(int64_t numFrames) const
     {
         return std::min<int64_t>(numFrames, numFrames_ - framePos_);
@@ -8,7 +8,11 @@
 #include <boost/filesystem.hpp>
 typedef boost::filesystem::path Path;
 
+#include <boost/function.hpp>
 #include <boost/smart_ptr.hpp>
+#include <atomic>
+#include <exception>
+#include <vector>
 
 #include <e3_CommonMacros.h>
 #include <AudioFormat.h>
@@ -17,7 +21,9 @@ typedef boost::filesystem::path Path;
 namespace e3 {
 
     class AudioBuffer;
+    class HalfAudioBuffer;
     class InstrumentChunk;
+    class WaveformOverview;
 
 
 
@@ -31,16 +37,38 @@ namespace e3 {
             OpenRdwr = 2
         };
 
+        // A contiguous range of frames inside the file
+        //
+        struct Section
+        {
+            Section(int64_t start = 0, int64_t numFrames = 0) : start_(start), numFrames_(numFrames) {}
+
+            int64_t start_;
+            int64_t numFrames_;
+        };
+        typedef std::vector<Section> SectionVector;
+
+        // Called while a file is loaded, with the number of frames done so far.
+        // Loading is stopped with an exception when the callback returns false.
+        //
+        typedef boost::function<bool (int64_t numDone, int64_t numTotal)> ProgressCallback;
+
     public:
         AudioFile();
         virtual ~AudioFile();
 
         virtual void open(const Path& filename, FileOpenMode mode);
         virtual void load(AudioBuffer* buffer) = 0;
+        virtual int64_t read(float* data, int64_t numFrames) = 0;
+        virtual void loadHalf(HalfAudioBuffer* buffer, int64_t blockSize = 4096);
         virtual void store(const AudioBuffer* buffer) = 0;
         virtual void close() = 0;
         virtual int64_t seek(int64_t frame)                            { return 0; }
 
+        virtual const SectionVector& getSections();
+        virtual void setSections(const SectionVector& sections)       { sections_ = sections; }
+        virtual void loadSection(size_t index, AudioBuffer* buffer);
+
         virtual void setFormat(const FormatInfo& format)    { format_ = format; }
         virtual void setCodec(const CodecInfo& codec)       { codec_ = codec; }
         virtual const FormatInfo& getFormat() const         { return format_; }
@@ -55,6 +83,13 @@ namespace e3 {
         virtual void setNumChannels(int numChannels)        { numChannels_ = numChannels; }
 
         virtual int64_t getNumFrames() const                { return numFrames_; }
+
+        // Frames at the start and at the end of the frames returned by load and read
+        // that are not part of the signal, like the encoder delay of MP3 files.
+        // They are not removed, gapless playback skips them.
+        //
+        virtual int64_t getNumLeadingFrames() const         { return 0; }
+        virtual int64_t getNumTrailingFrames() const        { return 0; }
         virtual float getDurationSec() const    		    { return (float)numFrames_ / (float)sampleRate_; }
 
         virtual bool isOpened() const                       { return false; }
@@ -65,7 +100,42 @@ namespace e3 {
 
         virtual InstrumentChunk* getInstrumentChunk()       { return instrumentChunk_; }
 
+        void setProgressCallback(const ProgressCallback& callback)  { progressCallback_ = callback; }
+
+        // The overview is built from the samples as they are loaded.
+        //
+        void setWaveformOverview(WaveformOverview* overview)        { overview_ = overview; }
+
+        // Size and modification time of a file, compared by sidecar files
+        // and indices to tell whether the file has changed since.
+        //
+        static bool getFileStamp(const Path& path, int64_t& size, int64_t& time);
+
     protected:
+        // State shared by the threads of a parallel load
+        //
+        struct ParallelLoad
+        {
+            ParallelLoad() : numDone_(0), numFinished_(0), stop_(false) {}
+
+            std::atomic<int64_t> numDone_;      // frames decoded by all ranges
+            std::atomic<size_t> numFinished_;
+            std::atomic<bool> stop_;            // set when loading is cancelled
+        };
+
+        // Decodes one range of a parallel load into output, which holds all
+        // frames of the file. Returns the frame behind the last one decoded.
+        //
+        typedef boost::function<int64_t (size_t range, float* output, ParallelLoad* load)> RangeDecoder;
+
+        virtual void initSections();
+        void reportProgress(int64_t numDone);
+        void beginOverview();
+        void addToOverview(const float* data, int64_t numFrames);
+        void finishOverview();
+        void runParallelLoad(AudioBuffer* buffer, size_t numRanges, const RangeDecoder& decodeRange, const std::vector<int64_t>& rangeEnds);
+        static void decodeParallelRange(const RangeDecoder* decodeRange, size_t range, float* output, ParallelLoad* load, int64_t* decodedEnd, std::exception_ptr* error);
+
         FormatInfo format_;
         CodecInfo codec_;
         int sampleRate_;
@@ -73,8 +143,13 @@ namespace e3 {
         int64_t numFrames_;
         Path filename_;
         FileOpenMode fileOpenMode_;
+        SectionVector sections_;
 
         InstrumentChunk* instrumentChunk_;
+        ProgressCallback progressCallback_;
+        WaveformOverview* overview_;
+
+        static const int64_t progressBlockSize_s = 65536;     // frames loaded between two progress reports
     };
 
     typedef boost::shared_ptr<AudioFile> AudioFilePtr;
@@ -0,0 +1,90 @@
+//------------------------------------------------------------
+// CompressedAudioBuffer.h
+// Lossless in-memory compression of AudioBuffer content
+//------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include <IntegerTypes.h>
+#include <AudioBuffer.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class CompressedAudioBuffer
+    //
+    // Stores the samples of an AudioBuffer in independently decodable blocks.
+    // Samples that are exact fixed point values (16 or 24 bit sources) are
+    // coded with a fixed second order predictor and Rice coded residuals,
+    // all other blocks are stored verbatim, so the compression is always lossless.
+    // Decoded blocks are kept in a small cache for random access in the render path.
+    // The cache is not thread safe, use one CompressedAudioBuffer per reader.
+    //------------------------------------------------------------------
+
+    class CompressedAudioBuffer
+    {
+    public:
+        CompressedAudioBuffer(size_t blockSize = 4096, size_t numCacheBlocks = 8);
+
+        void compress(const AudioBuffer& source);
+        void decompress(AudioBuffer* target) const;
+        void clear();
+
+        // Copies numFrames interleaved frames starting at frame to output.
+        // Returns the number of frames copied, throws if frame is negative.
+        //
+        int64 read(int64 frame, float* output, int64 numFrames);
+
+        // Returns the decoded interleaved frames of a block.
+        // The pointer is valid until the block is evicted from the cache.
+        //
+        const float* getBlock(size_t index);
+
+        int getSampleRate() const           { return sampleRate_; }
+        int getNumChannels() const          { return numChannels_; }
+        int64 getNumFrames() const          { return numFrames_; }
+        size_t getBlockSize() const         { return blockSize_; }
+        size_t getNumBlocks() const         { return blockOffsets_.size(); }
+        size_t getBlockFrames(size_t index) const;
+
+        int64 calcNumBytes() const;
+        double getCompressionRatio() const;     // compressed size / uncompressed size
+
+    protected:
+        enum BlockMode
+        {
+            BlockRaw = 0,
+            BlockPredicted = 1
+        };
+
+        struct CacheSlot
+        {
+            CacheSlot() : block_(-1), lastUse_(0) {}
+
+            int64 block_;
+            uint64 lastUse_;
+            std::vector<float> frames_;
+        };
+
+        void encodeChannel(const float* input, size_t numFrames);
+        void decodeBlock(size_t index, float* output) const;
+
+        size_t blockSize_;
+        int sampleRate_;
+        int numChannels_;
+        int64 numFrames_;
+
+        std::vector<uint8> data_;
+        std::vector<uint64> blockOffsets_;
+
+        std::vector<CacheSlot> cache_;
+        uint64 useCounter_;
+
+        std::vector<int32> ints_;       // encoder scratch
+        std::vector<float> channel_;
+    };
+
+} // namespace e3
@@ -0,0 +1,103 @@
+//------------------------------------------------------------
+// FlacDecoder.h
+// Native decoder for FLAC frames in memory
+//------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class FlacDecoder
+    //
+    // Decodes a native FLAC stream held in memory, usually a mapped file.
+    // FLAC frames are independent of each other, so several decoders may
+    // work on the same data at different offsets.
+    // Supports 4 to 24 bits per sample and up to 8 channels.
+    // Frames are checked with the CRC-8 of the header and the CRC-16 of
+    // the frame, so findFrame can resynchronize at any byte offset.
+    //------------------------------------------------------------------
+
+    class FlacDecoder
+    {
+    public:
+        struct StreamInfo
+        {
+            StreamInfo() : minBlockSize_(0), maxBlockSize_(0), sampleRate_(0), numChannels_(0), bitsPerSample_(0), numSamples_(0) {}
+
+            int minBlockSize_;
+            int maxBlockSize_;
+            int sampleRate_;
+            int numChannels_;
+            int bitsPerSample_;
+            int64 numSamples_;          // 0 if unknown
+        };
+
+        struct SeekPoint
+        {
+            int64 sample_;
+            int64 offset_;              // of the frame in the data
+        };
+        typedef std::vector<SeekPoint> SeekPointVector;
+
+        struct Frame
+        {
+            Frame() : offset_(0), size_(0), sample_(0), numSamples_(0) {}
+
+            size_t offset_;
+            size_t size_;
+            int64 sample_;              // first sample of the frame
+            int numSamples_;
+        };
+
+        FlacDecoder();
+
+        // Reads the metadata blocks, throws if data is no FLAC stream.
+        //
+        void open(const uint8* data, size_t size);
+        void attach(const FlacDecoder& other);
+
+        const StreamInfo& getStreamInfo() const             { return streamInfo_; }
+        const SeekPointVector& getSeekPoints() const        { return seekPoints_; }
+        size_t getFirstFrameOffset() const                  { return firstFrame_; }
+        size_t getSize() const                              { return size_; }
+
+        // Decodes the frame at offset, returns false if there is no valid frame.
+        //
+        bool decodeFrame(size_t offset, Frame* frame);
+
+        // Decodes the first valid frame at or after offset.
+        // Returns false if there is none until the end of the data.
+        //
+        bool findFrame(size_t offset, Frame* frame);
+
+        // Copies samples of the last decoded frame, interleaved and scaled to [-1, 1).
+        //
+        void getSamples(int start, int numSamples, float* output) const;
+
+    protected:
+        class BitReader;
+
+        size_t readFrameHeader(size_t offset, Frame* frame, int* channelMode);
+        bool readSubframe(BitReader& reader, int bitsPerSample, int32* output);
+        bool readResidual(BitReader& reader, int predictorOrder, int32* output);
+        void decorrelate(int channelMode);
+
+        const uint8* data_;
+        size_t size_;
+        size_t firstFrame_;
+        StreamInfo streamInfo_;
+        SeekPointVector seekPoints_;
+
+        std::vector<int32> samples_;        // planar, blockSize_ per channel
+        int blockSize_;
+        int numChannels_;
+        int bitsPerSample_;
+    };
+
+} // namespace e3
@@ -0,0 +1,97 @@
+
+//--------------------------------------------------------
+// FlacFile.h
+//--------------------------------------------------------
+
+#pragma once
+
+#include <exception>
+#include <vector>
+
+#include <boost/smart_ptr.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <e3_Exception.h>
+#include <AudioBackend.h>
+#include <AudioFile.h>
+#include <FlacDecoder.h>
+
+
+namespace e3 {
+
+    // Reads native FLAC files without libsndfile. The file is memory mapped,
+    // load splits it at seek points or synced frame headers and decodes
+    // the ranges in parallel directly into the buffer.
+    //
+    class FlacFile : public AudioFile
+    {
+        friend class FormatManager;
+    public:
+        FlacFile();
+        ~FlacFile();
+
+        void open(const Path& filename, FileOpenMode mode);
+        void load(AudioBuffer* buffer);
+        int64_t read(float* data, int64_t numFrames);
+        int64_t seek(int64_t frame);
+        void store(const AudioBuffer* buffer)               { THROW(std::exception, "Storing not implemented for FLAC"); }
+        void close();
+        bool isOpened() const                               { return mappedFile_.is_open(); }
+
+        // Number of threads used by load. With more than one thread the file
+        // is split into frame ranges that are decoded in parallel.
+        // 0 uses one thread per core, this is the default.
+        //
+        void setNumLoadThreads(int numThreads)              { numLoadThreads_ = numThreads; }
+        int getNumLoadThreads() const                       { return numLoadThreads_; }
+
+        static bool isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate = 0, int numChannels = 1);
+
+    protected:
+        const uint8* getMappedData() const                  { return reinterpret_cast<const uint8*>(mappedFile_.data()); }
+        void loadParallel(AudioBuffer* buffer, size_t numRanges);
+        int64_t decodeRange(const std::vector<size_t>& starts, size_t range, float* output, ParallelLoad* load);
+        size_t findRangeStart(size_t offset);
+        bool decodeNextFrame();
+        int64_t countFrames();
+        void initSections();
+
+        boost::iostreams::mapped_file_source mappedFile_;
+        FlacDecoder decoder_;
+        int numLoadThreads_;
+
+        FlacDecoder::Frame frame_;          // last frame decoded by read
+        size_t nextOffset_;
+        int pendingPos_;                    // samples of frame_ already read
+        int pendingSize_;
+
+        static const size_t minBytesPerRange_s = 16384;
+        friend class FlacBackend;
+        static void initFormatInfos(FormatInfoVector& infos);
+        static void initCodecInfos(CodecInfoVector& infos);
+    };
+
+    typedef boost::shared_ptr<FlacFile> FlacFilePtr;
+
+
+
+    // Preferred over libsndfile for reading FLAC, files are still written by libsndfile.
+    //
+    class FlacBackend : public AudioBackend
+    {
+    public:
+        const char* getName() const                         { return "native FLAC"; }
+        int getPriority() const                             { return 10; }
+        unsigned getFeatures() const                        { return FeatureSeekable | FeatureStreaming | FeatureMemoryMapped | FeatureParallel; }
+
+        void initFormatInfos(FormatInfoVector& infos) const { FlacFile::initFormatInfos(infos); }
+        void initCodecInfos(CodecInfoVector& infos) const   { FlacFile::initCodecInfos(infos); }
+
+        bool canRead(FormatId format) const                 { return format == FORMAT_FLAC; }
+        bool isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate, int numChannels) const
+                                                            { return FlacFile::isFormatSupported(format, codec, sampleRate, numChannels); }
+
+        AudioFilePtr createFile() const                     { return FlacFilePtr(new FlacFile()); }
+    };
+
+} // namespace e3
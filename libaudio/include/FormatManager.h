@@ -1,26 +1,57 @@
-
 //---------------------------------------------------
 // FormatManager.h
 //---------------------------------------------------
 
 #pragma once
 
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <AudioBackend.h>
 #include <AudioFormat.h>
 #include <AudioFile.h>
 
 
 namespace e3 {
 
+    //------------------------------------------------------------------
+    // class FormatManager
+    //
+    // The built-in backends and the format and codec tables are set up
+    // on first use, not at static initialization.
+    //------------------------------------------------------------------
+
     class FormatManager
     {
     public:
-        static AudioFilePtr createFile(const Path& filename);
+        // Creates the file with the backend of highest priority that can read the
+        // format detected by detectFormat and has all of the requested features.
+        // Files to be opened for writing are created by a backend with FeatureWrite,
+        // for OpenWrite the format is taken from the extension.
+        //
+        static AudioFilePtr createFile(const Path& filename, AudioFile::FileOpenMode mode = AudioFile::OpenRead, unsigned features = 0);
+
+        // Adds a backend and its formats and codecs.
+        // Backends should be registered before files are opened.
+        // A removed backend is no longer found, its formats and codecs stay known.
+        //
+        static void registerBackend(const AudioBackendPtr& backend);
+        static void unregisterBackend(const AudioBackendPtr& backend);
+        static AudioBackendPtr findBackend(FormatId format, unsigned features = 0);
+        static const std::vector<AudioBackendPtr>& getBackends()   { init(); return backends_; }
+
+        // Detects the format from the first bytes of the file, behind an
+        // ID3v2 tag if there is one. Falls back to the extension when the
+        // file can not be read or has no known signature.
+        //
+        static FormatId detectFormat(const Path& filename);
+        static FormatId detectFormat(const unsigned char* data, size_t length);
+        static FormatId getFormatFromExtension(const Path& filename);
 
-        static const FormatInfoVector& getFormatInfos() { return formatInfos_; }
-        static const CodecInfoVector& getCodecInfos()   { return codecInfos_; }
+        static const FormatInfoVector& getFormatInfos() { init(); return formatInfos_; }
+        static const CodecInfoVector& getCodecInfos()   { init(); return codecInfos_; }
 
         static const FormatInfo& getFormat(FormatId id);
         static const FormatInfo& getFormat(int idPrivate);
@@ -33,13 +64,29 @@ namespace e3 {
         static bool isSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate = 0, int numChannels = 1);
 
     protected:
+        static void init()                              { std::call_once(initFlag_s, &FormatManager::initialize); }
+        static void initialize();
+        static void addBackend(const AudioBackendPtr& backend);
+        static bool isMpegFrameHeader(const unsigned char* data, size_t length);
+        static void buildIndices();
+
+        static std::vector<AudioBackendPtr> backends_;    // sorted by priority, highest first
         static FormatInfoVector formatInfos_;
         static CodecInfoVector codecInfos_;
 
-        struct Initializer {
-            Initializer();
-        };
-        static Initializer initializer_s;
+        // Lookup tables into formatInfos_ and codecInfos_, -1 if not available
+        typedef std::unordered_map<int, int> IdIndexMap;
+        typedef std::unordered_map<std::string, int> NameIndexMap;
+
+        static std::vector<int> formatIndex_;
+        static std::vector<int> codecIndex_;
+        static IdIndexMap formatPrivateIndex_;
+        static IdIndexMap codecPrivateIndex_;
+        static NameIndexMap formatNameIndex_;
+        static NameIndexMap codecNameIndex_;
+        static std::unordered_map<std::string, FormatId> extensions_;
+
+        static std::once_flag initFlag_s;
     };
 
-} // namespace e3
\ No newline at end of file
+} // namespace e3
@@ -0,0 +1,60 @@
+//------------------------------------------------------------
+// HalfAudioBuffer.h
+// Audio buffer with half precision (float16) sample storage
+//------------------------------------------------------------
+
+#pragma once
+
+#include <e3_Buffer.h>
+
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    class AudioBuffer;
+
+    //------------------------------------------------------------------
+    // class HalfAudioBuffer
+    //
+    // Stores interleaved samples as IEEE 754 half precision floats,
+    // which halves memory and bandwidth compared to AudioBuffer.
+    // Meant for previews, waveform scrubbing and low fidelity voices.
+    // Samples are converted to and from float in blocks.
+    //------------------------------------------------------------------
+
+    class HalfAudioBuffer : public Buffer < uint16 >
+    {
+    public:
+        HalfAudioBuffer(int numChannels = 0);
+
+        int getSampleRate() const               { return sampleRate_; }
+        int getNumChannels() const              { return numChannels_; }
+        int64 getNumFrames() const              { return numFrames_; }
+
+        void setSampleRate(int sampleRate)      { sampleRate_ = sampleRate; }
+        void setNumChannels(int numChannels)    { numChannels_ = numChannels; }
+
+        int64 calcNumBytes() const              { return size_ * sizeof(uint16); }
+
+        uint16* resize(size_t size);
+
+        void fromFloat(const AudioBuffer& source);
+        void toFloat(AudioBuffer* target) const;
+
+        // Converts numFrames frames starting at frame to float.
+        // Returns the number of frames written to output.
+        //
+        int64 read(int64 frame, float* output, int64 numFrames) const;
+
+        // Converts numFrames float frames and stores them at frame.
+        //
+        void write(int64 frame, const float* input, int64 numFrames);
+
+    protected:
+        int sampleRate_;
+        int numChannels_;
+        int64 numFrames_;
+    };
+
+} // namespace e3
@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <vector>
 
 #include <IntegerTypes.h>
@@ -58,7 +59,7 @@ namespace e3 {
         const LoopVector& getLoops() const      { return loops_; }
 
         typedef EnumNames<LoopMode> LoopModeInfo;
-        static LoopModeInfo& getLoopModeInfo()  { return loopModeInfo_s; }
+        static LoopModeInfo& getLoopModeInfo();
 
     protected:
         int gain_;
@@ -73,10 +74,8 @@ namespace e3 {
     protected:
         //! Maps the LoopMode constants to strings. 
         static LoopModeInfo loopModeInfo_s; // TODO: find simpler way
-        struct Initializer {
-            Initializer();
-        };
-        static Initializer initializer_s;
+        static std::once_flag initFlag_s;
+        static void initLoopModeInfo();
     };
 
 }  // namespace e3
\ No newline at end of file
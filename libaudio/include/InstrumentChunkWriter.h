@@ -0,0 +1,38 @@
+//------------------------------------------------------------
+// InstrumentChunkWriter.h
+// Updates the instrument chunks of WAV and AIFF files in place
+//------------------------------------------------------------
+
+#pragma once
+
+#include <AudioFile.h>
+#include <InstrumentChunk.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class InstrumentChunkWriter
+    //
+    // Writes an InstrumentChunk into an existing file without touching
+    // the sample data. WAV files get smpl and inst chunks, AIFF files
+    // INST and MARK chunks.
+    //
+    // A chunk is overwritten where it is if the new one fits, the rest
+    // is filled with a JUNK (WAV) or FLLR (AIFF) chunk. A chunk that does
+    // not fit becomes such a filler and the new one is appended. Only the
+    // size in the RIFF or FORM header changes besides that.
+    //
+    // AIFF has a sustain and a release loop, further loops are dropped.
+    // Markers that are not used by the old loops are kept.
+    //------------------------------------------------------------------
+
+    class InstrumentChunkWriter
+    {
+    public:
+        // Throws if the file is not a WAV or AIFF file or can not be written.
+        //
+        static void write(const Path& filename, const InstrumentChunk& chunk);
+    };
+
+} // namespace e3
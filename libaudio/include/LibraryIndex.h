@@ -0,0 +1,162 @@
+//------------------------------------------------------------
+// LibraryIndex.h
+// Metadata of all audio files below a set of directories
+//------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <AudioFile.h>
+#include <AudioFormat.h>
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class LibraryIndex
+    //
+    // Format, codec, rate, channels, length and the key and velocity
+    // ranges of the instrument chunk of every audio file found by scan().
+    // A rescan probes only files that are new or whose size or
+    // modification time have changed.
+    //
+    // The index file is laid out as the arrays held in memory, load()
+    // maps it and queries run on the mapped data. The first scan after
+    // load() copies the arrays.
+    //
+    // Queries test the compact Filter records only. The entries of each
+    // format, and the entries sorted by duration and by lowest key, narrow
+    // the records to be tested.
+    //------------------------------------------------------------------
+
+    class LibraryIndex
+    {
+    public:
+        enum Flags
+        {
+            FlagInstrument  = 1,        // key and velocity ranges were read from the file
+            FlagProbeFailed = 2,        // the file could not be opened, only format_ is set
+        };
+
+        // Everything a query tests, kept apart from the Entries to be scanned quickly.
+        //
+        struct Filter
+        {
+            uint8 format_;              // FormatId
+            uint8 keyLow_;
+            uint8 keyHigh_;
+            uint8 velocityLow_;
+            uint8 velocityHigh_;
+            uint8 flags_;
+            uint8 reserved_[2];
+            float duration_;            // seconds
+        };
+
+        struct Entry
+        {
+            int64 fileSize_;
+            int64 fileTime_;
+            int64 numFrames_;
+            uint32 pathOffset_;         // into the path pool
+            uint32 pathLength_;
+            int32 sampleRate_;
+            uint16 numChannels_;
+            uint8 codec_;               // CodecId
+            uint8 baseNote_;
+        };
+
+        struct Query
+        {
+            Query() :
+                format_(FORMAT_UNKNOWN),
+                keyLow_(0),
+                keyHigh_(127),
+                velocityLow_(0),
+                velocityHigh_(127),
+                minDuration_(0),
+                maxDuration_(0)
+            {}
+
+            FormatId format_;           // FORMAT_UNKNOWN matches all formats
+            int keyLow_;                // matches files whose key range overlaps
+            int keyHigh_;
+            int velocityLow_;           // matches files whose velocity range overlaps
+            int velocityHigh_;
+            float minDuration_;         // seconds
+            float maxDuration_;         // seconds, 0 for no limit
+        };
+
+        struct ScanResult
+        {
+            ScanResult() : numFiles_(0), numProbed_(0), numRemoved_(0) {}
+
+            size_t numFiles_;           // audio files found
+            size_t numProbed_;          // new or changed files that were opened
+            size_t numRemoved_;         // entries of files that have disappeared
+        };
+
+        LibraryIndex();
+
+        void clear();
+
+        // Walks the directory tree on numThreads threads, 0 uses one thread per core.
+        // Entries of files outside the directory are kept. Paths are stored below
+        // the canonical path of directory.
+        //
+        ScanResult scan(const Path& directory, size_t numThreads = 0);
+
+        // Appends the indices of all matching entries to result.
+        //
+        void find(const Query& query, std::vector<size_t>& result) const;
+        int find(const Path& path) const;
+
+        size_t size() const                             { return numEntries_; }
+        bool empty() const                              { return numEntries_ == 0; }
+        const Filter& getFilter(size_t index) const     { return filters_[index]; }
+        const Entry& getEntry(size_t index) const       { return entries_[index]; }
+        std::string getPath(size_t index) const;
+
+        bool load(const Path& indexPath);
+        bool store(const Path& indexPath) const;
+
+    protected:
+        struct Item;
+        typedef std::vector<Item> ItemVector;
+        struct ScanState;
+
+        void detach();
+        void assign(const ItemVector& items);
+        void scanThread(ScanState* state);
+        void scanDirectory(ScanState* state, const Path& directory, std::vector<Path>& subdirectories, ItemVector& items);
+        void probe(const Path& path, Item& item) const;
+        void buildQueryIndex();
+        void clearQueryIndex();
+
+        // Point either into the mapped file or into the vectors below
+        const Filter* filters_;
+        const Entry* entries_;
+        const char* paths_;
+        size_t numEntries_;
+
+        std::vector<Filter> filterVector_;
+        std::vector<Entry> entryVector_;
+        std::string pathVector_;
+
+        boost::iostreams::mapped_file_source file_;
+
+        // Entry indices, rebuilt by assign() and load()
+        std::vector<std::vector<uint32> > formatEntries_;    // per FormatId, in index order
+        std::vector<uint32> durationOrder_;
+        std::vector<uint32> keyOrder_;                      // by keyLow_
+
+    private:
+        LibraryIndex(const LibraryIndex&);
+        LibraryIndex& operator= (const LibraryIndex&);
+    };
+
+} // namespace e3
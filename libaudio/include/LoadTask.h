@@ -0,0 +1,117 @@
+//------------------------------------------------------------
+// LoadTask.h
+// Asynchronous loading of audio files
+//------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <future>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <AudioBuffer.h>
+#include <AudioFile.h>
+#include <MemoryBudget.h>
+
+
+namespace e3 {
+
+    class LoadTask;
+    typedef boost::shared_ptr<LoadTask> LoadTaskPtr;
+
+
+    struct LoadOptions
+    {
+        typedef boost::function<void (float progress)> ProgressCallback;
+        typedef boost::function<void (LoadTask& task)> CompletionCallback;
+
+        LoadOptions() :
+            category_(MemorySamples),
+            numThreads_(1),
+            numChannels_(0),
+            sampleRate_(0)
+        {}
+
+        MemoryCategory category_;           // memory category of the loaded buffer
+        int numThreads_;                    // decoding threads for MPEG and FLAC files, see MpegFile::setNumLoadThreads
+        int numChannels_;                   // output channels for MPEG files, see MpegFile::setNumOutputChannels
+        int sampleRate_;                    // sample rate of the loaded buffer, 0 keeps the rate of the file
+
+        ProgressCallback onProgress_;       // called on the worker thread with 0..1
+        CompletionCallback onCompletion_;   // called on the worker thread when the task has finished, failed or was cancelled
+    };
+
+
+
+    //------------------------------------------------------------------
+    // class LoadTask
+    //
+    // A file loaded on the WorkerPool, created by loadAsync.
+    // The result is available as future or with the completion callback.
+    // A cancelled task stops decoding at the next progress report,
+    // its result is an exception.
+    //------------------------------------------------------------------
+
+    class LoadTask
+    {
+        friend LoadTaskPtr loadAsync(const Path& filename, const LoadOptions& options);
+
+    public:
+        enum State
+        {
+            Pending = 0,
+            Running,
+            Finished,
+            Failed,
+            Cancelled
+        };
+
+        const Path& getFilename() const     { return filename_; }
+        State getState() const              { return (State)state_.load(); }
+        bool isDone() const                 { return getState() >= Finished; }
+
+        void cancel()                       { cancelled_ = true; }
+        bool isCancelled() const            { return cancelled_; }
+
+        // Returns 0..1, 0 as long as the length of the file is unknown.
+        //
+        float getProgress() const;
+
+        // get() waits for the task and returns the loaded buffer,
+        // or rethrows the exception that stopped loading.
+        //
+        void wait() const                                       { future_.wait(); }
+        AudioBufferPtr get() const                              { return future_.get(); }
+        const std::shared_future<AudioBufferPtr>& getFuture() const  { return future_; }
+
+    protected:
+        LoadTask(const Path& filename, const LoadOptions& options);
+
+        void run();
+        bool onProgress(int64_t numDone, int64_t numTotal);
+        void complete(State state);
+
+        Path filename_;
+        LoadOptions options_;
+
+        std::atomic<int> state_;
+        std::atomic<bool> cancelled_;
+        std::atomic<int64> numDone_;
+        std::atomic<int64> numTotal_;
+
+        std::promise<AudioBufferPtr> promise_;
+        std::shared_future<AudioBufferPtr> future_;
+
+    private:
+        LoadTask(const LoadTask&);
+        LoadTask& operator= (const LoadTask&);
+    };
+
+
+    // Loads a file on the WorkerPool. Returns immediately.
+    //
+    LoadTaskPtr loadAsync(const Path& filename, const LoadOptions& options = LoadOptions());
+
+} // namespace e3
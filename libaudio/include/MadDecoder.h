@@ -14,37 +14,149 @@
 #include <IntegerTypes.h>
 #include <AudioBuffer.h>
 #include <AudioFormat.h>
+#include <MpegFrameIndex.h>
 
 
 namespace e3 {
 
+    //------------------------------------------------------------------
+    // class MadDecoder
+    //
+    // A decoder can be reused for any number of files. finish() keeps
+    // the buffers of the decoder and of libmad for the next start().
+    //------------------------------------------------------------------
+
     class MadDecoder
     {
     public:
         MadDecoder();
+        ~MadDecoder();
 
+        // Starts decoding. Returns the exact number of sample frames when the
+        // file has a Xing, Info or VBRI header, otherwise 0. Use buildIndex()
+        // to get the length of other files.
+        //
         size_t start(FILE* handle);
+
+        // Decodes from memory, usually a memory mapped file.
+        // The data must stay valid until finish() is called.
+        //
+        size_t start(const unsigned char* data, size_t size);
+
+        // Ends decoding of the current input.
+        //
         void finish();
-        size_t decode(size_t len, AudioBuffer* buffer);
+
+        // Prepares decoding of a file whose frame index is already known,
+        // without scanning the file. Decoding has to start with seek().
+        //
+        void attach(FILE* handle);
+        void attach(const unsigned char* data, size_t size);
+        size_t decode(size_t len, float* output);
+        size_t decode(size_t len, AudioBuffer* buffer)  { return decode(len, buffer->getHead()); }
+
+        // Decodes up to numFrames interleaved sample frames.
+        // Returns the number of frames read, less than numFrames at the end of the input.
+        //
+        size_t read(float* output, size_t numFrames);
 
         int getSampleRate() const   { return madSynth_.pcm.samplerate; }
+
+        // Number of channels of the decoded output. 0 decodes all channels of the source,
+        // 1 mixes stereo sources to mono before synthesis, so only one channel is synthesized,
+        // 2 duplicates mono sources. Must be set before start() or attach(), finish() resets it.
+        //
+        void setNumOutputChannels(int numChannels);
         int getNumChannels() const;
+        int getNumSourceChannels() const;
 
         CodecId getCodecId() const;
         static const char* getVersionString();
 
+        // Scans the frame headers of the whole file.
+        // The decoding position is not changed.
+        //
+        void buildIndex(MpegFrameIndex* index);
+
+        // Sample accurate seek using the frame index.
+        // Decoding starts a few frames before the target frame to fill the
+        // bit reservoir and the synthesis filters, the output is discarded
+        // up to the requested sample.
+        // Returns the new position.
+        //
+        int64 seek(const MpegFrameIndex& index, int64 sample);
+
+        // Approximate seek using the table of contents of the Xing/LAME header.
+        // Returns the requested position, the true position may differ by some frames.
+        //
+        int64 seekApproximate(int64 sample, int64 numSamples);
+        bool hasToc() const         { return xing_.hasToc_; }
+
+        // Encoder delay and padding in samples, as written by LAME or the Fraunhofer encoder.
+        // Not applied to the decoded output, see getNumLeadingFrames().
+        //
+        int getEncoderDelay() const     { return xing_.encoderDelay_; }
+        int getEncoderPadding() const   { return xing_.encoderPadding_; }
+
+        // Frames of the decoded output that are not part of the encoded signal, 0 when the
+        // file has no encoder delay and padding. Leading are the frame holding the info header,
+        // the encoder delay and the delay of the synthesis filters, which shortens the padding.
+        //
+        int64 getNumLeadingFrames() const;
+        int64 getNumTrailingFrames() const;
+
+        // Byte range of the audio data, without the tags at the start and end of the input.
+        //
+        int64 getPayloadStart() const   { return payloadStart_; }
+        int64 getPayloadEnd() const     { return payloadEnd_; }
+
     protected:
-        int64 getDurationMs(unsigned char* buffer, size_t bufferSize);
+        // Contents of a Xing, Info or VBRI header
+        //
+        struct XingHeader
+        {
+            XingHeader() : offset_(0), frameSize_(0), numFrames_(0), numBytes_(0), hasToc_(false), encoderDelay_(0), encoderPadding_(0) {}
+
+            int64 offset_;                  // byte offset of the frame containing the header
+            int frameSize_;                 // samples decoded from that frame
+            unsigned long numFrames_;
+            unsigned long numBytes_;
+            bool hasToc_;
+            unsigned char toc_[100];
+            int encoderDelay_;
+            int encoderPadding_;
+        };
+
+        typedef Buffer<unsigned char> CharBuffer;
+
+        size_t startDecoding();
+        void reset();
+        void resetStream();
+        void scanTags();
+        bool readInput(int64 offset, unsigned char* data, size_t size) const;
+        int64 scanInfoHeader();
         bool readMpgFile();
+        bool fillStream(struct mad_stream* stream, CharBuffer& buffer, int64& bufferOffset, bool& endOfInput);
         bool consumeId3Tag();
+        size_t skipId3Tag(struct mad_stream* stream);
+        int64 getFileSize() const;
+        void restart(int64 offset);
+        int64 synthNextFrame();
+        void synthFrame();
 
-        typedef Buffer<unsigned char> CharBuffer;
         CharBuffer decodeBuffer_;
 
         FILE* handle_;
+        const unsigned char* mappedData_;
+        size_t mappedSize_;
+        int64 payloadStart_;                // byte range of the audio data
+        int64 payloadEnd_;
         size_t bufferSize_;
+        int64 bufferOffset_;                // file offset of the first byte in the stream buffer
+        bool endOfInput_;
         int currentFrame_;
         int numMpegFrames_;
+        int numOutputChannels_;             // 0: same as source
         int64 durationMsec_;
         bool initialized_;
 
@@ -52,10 +164,16 @@ namespace e3 {
         struct mad_frame  madFrame_;
         struct mad_synth  madSynth_;
         mad_timer_t       madTimer_;
+        XingHeader        xing_;
+
+        static const int numWarmupFrames_s = 3;
+        static const int synthesisDelay_s = 529;    // samples, of the MDCT and the polyphase filterbank
 
-        static unsigned long xingFrames(struct mad_bitptr ptr, unsigned bitlen);
-        static void timerMultiply(mad_timer_t* t, double d);
+        static bool parseXingHeader(struct mad_bitptr ptr, unsigned bitlen, XingHeader* xing);
+        static bool parseVbriHeader(const unsigned char* frame, size_t length, XingHeader* xing);
         static int getId3TagSize(const unsigned char* data, size_t length);
+        static size_t getId3v2TagSize(const unsigned char* data, char id0, char id1, char id2);
+        static uint32 readLittleEndian32(const unsigned char* data);
     };
 
 } // namespace e3
\ No newline at end of file
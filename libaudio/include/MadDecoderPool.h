@@ -0,0 +1,49 @@
+//------------------------------------------------------------
+// MadDecoderPool.h
+// Pool of reusable MadDecoder instances
+//------------------------------------------------------------
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <e3_CommonMacros.h>
+
+
+namespace e3 {
+
+    class MadDecoder;
+
+    //------------------------------------------------------------------
+    // class MadDecoderPool
+    //
+    // Keeps finished decoders, so opening many short files does not
+    // allocate a decoder and the libmad buffers each time.
+    // Every decoder taken by acquire() must be given back by release().
+    //------------------------------------------------------------------
+
+    class MadDecoderPool
+    {
+        DECLARE_THREADSAFE_SINGLETON(MadDecoderPool)
+
+    public:
+        ~MadDecoderPool();
+
+        MadDecoder* acquire();
+        void release(MadDecoder* decoder);
+
+        void setMaxSize(size_t maxSize);
+        size_t getMaxSize() const;
+        size_t getNumAvailable() const;
+        void clear();
+
+    protected:
+        typedef std::vector<MadDecoder*> DecoderVector;
+        DecoderVector decoders_;
+        size_t maxSize_;
+
+        mutable std::mutex mutex_;
+    };
+
+} // namespace e3
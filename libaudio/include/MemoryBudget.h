@@ -0,0 +1,96 @@
+//------------------------------------------------------------
+// MemoryBudget.h
+// Accounting of resident sample memory with spill-to-disk
+//------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <set>
+
+#include <boost/filesystem.hpp>
+
+#include <e3_CommonMacros.h>
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    class AudioBuffer;
+
+    enum MemoryCategory
+    {
+        MemorySamples = 0,      // samples loaded for playback
+        MemoryPreview,          // previews and waveform data
+        MemoryProcessing,       // temporary buffers of offline jobs
+        MemoryCategoryCount
+    };
+
+
+    //------------------------------------------------------------------
+    // class MemoryBudget
+    //
+    // Every AudioBuffer registers its sample memory here.
+    // When the resident memory exceeds the budget, the least recently
+    // used buffers are copied to a memory mapped scratch file and their
+    // memory is released. A spilled buffer is restored on the next access
+    // through AudioBuffer::getHead().
+    // Pinned buffers are never spilled. A buffer is pinned while raw pointers
+    // to its data are used, see ScopedPin.
+    // Buffers are ordered by their last pin, unpin or resize, reads through
+    // getHead() alone are not tracked.
+    //------------------------------------------------------------------
+
+    class MemoryBudget
+    {
+        DECLARE_THREADSAFE_SINGLETON(MemoryBudget)
+
+    public:
+        struct Usage
+        {
+            Usage() : numResidentBytes_(0), numSpilledBytes_(0), numBuffers_(0) {}
+
+            int64 numResidentBytes_;
+            int64 numSpilledBytes_;
+            int numBuffers_;
+        };
+
+        void setBudget(int64 numBytes);                     // 0 means unlimited
+        int64 getBudget() const;
+
+        void setScratchDirectory(const boost::filesystem::path& directory);
+        boost::filesystem::path getScratchDirectory() const;
+
+        Usage getUsage() const;
+        Usage getUsage(MemoryCategory category) const;
+        static const char* getCategoryName(MemoryCategory category);
+
+        static uint64 tick()                                { return ++clock_s; }
+
+    protected:
+        friend class AudioBuffer;
+
+        void add(AudioBuffer* buffer);
+        void remove(AudioBuffer* buffer);
+        void update(AudioBuffer* buffer);
+        void restore(AudioBuffer* buffer);
+        void pin(AudioBuffer* buffer);
+        void setCategory(AudioBuffer* buffer, MemoryCategory category);
+
+        void enforce(const AudioBuffer* exclude);
+        void spill(AudioBuffer* buffer);
+        void discard(AudioBuffer* buffer);
+        int64 calcNumBytes(const AudioBuffer* buffer) const;
+
+        typedef std::set<AudioBuffer*> BufferSet;
+        BufferSet buffers_;
+        Usage usage_[MemoryCategoryCount];
+        int64 budget_;
+        boost::filesystem::path scratchDirectory_;
+
+        mutable std::recursive_mutex mutex_;
+        static std::atomic<uint64> clock_s;
+    };
+
+} // namespace e3
@@ -6,18 +6,23 @@
 #pragma once
 
 #include <stdio.h>
+#include <exception>
 
 #include <boost/smart_ptr.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 
 #include <e3_Exception.h>
+#include <AudioBackend.h>
 #include <AudioFile.h>
-
-class AudioBuffer;
-class MadDecoder;
+#include <MpegFrameIndex.h>
+#include <Resampler.h>
 
 
 namespace e3 {
 
+    class MadDecoder;
+
+
     class MpegFile : public AudioFile
     {
         friend class FormatManager;
@@ -27,21 +32,113 @@ namespace e3 {
 
         void open(const Path& filename, FileOpenMode mode);
         void load(AudioBuffer* buffer);
+        int64_t read(float* data, int64_t numFrames);
+        int64_t seek(int64_t frame);
         void store(const AudioBuffer* buffer)               { THROW(std::exception, "Storing not implemented for MPEG"); }
         void close();
-        bool isOpened() const                               { return handle_ != NULL; }
+        bool isOpened() const                               { return handle_ != NULL || mappedFile_.is_open(); }
+
+        int64_t getNumLeadingFrames() const;
+        int64_t getNumTrailingFrames() const;
+
+        // Returns the frame index, builds it on first use.
+        //
+        const MpegFrameIndex& getFrameIndex();
+
+        // When fast seeking is enabled and no frame index is built yet,
+        // seek uses the table of contents of the Xing/LAME header.
+        // This is not sample accurate.
+        //
+        void setFastSeeking(bool fastSeeking)              { fastSeeking_ = fastSeeking; }
+        bool getFastSeeking() const                         { return fastSeeking_; }
+
+        // When enabled, a frame index is stored next to the MPEG file.
+        // An existing index file is always used.
+        //
+        void setPersistentIndex(bool persistentIndex)      { persistentIndex_ = persistentIndex; }
+        bool getPersistentIndex() const                     { return persistentIndex_; }
+
+        // Number of threads used by load. With more than one thread the file
+        // is split into frame ranges that are decoded in parallel.
+        // 0 uses one thread per core, the default is 1.
+        //
+        void setNumLoadThreads(int numThreads)              { numLoadThreads_ = numThreads; }
+        int getNumLoadThreads() const                       { return numLoadThreads_; }
+
+        // When enabled, the file is memory mapped and handed to the decoder
+        // as a whole instead of being read in chunks. Must be set before open.
+        //
+        void setMemoryMapped(bool memoryMapped)            { memoryMapped_ = memoryMapped; }
+        bool getMemoryMapped() const                        { return memoryMapped_; }
+
+        // Number of channels decoded by load and read. 0 keeps the channels of the file,
+        // 1 mixes stereo files to mono, 2 duplicates mono files. Must be set before open.
+        //
+        void setNumOutputChannels(int numChannels)         { numOutputChannels_ = numChannels; }
+        int getNumOutputChannels() const                    { return numOutputChannels_; }
+
+        // Sample rate of the frames returned by load and read. Decoded blocks are
+        // converted as they come, the file is never held at its own rate.
+        // Seeking takes frames of the target rate and is accurate to one source frame.
+        // 0 keeps the rate of the file. Must be set before open.
+        //
+        void setTargetSampleRate(int sampleRate)           { targetSampleRate_ = sampleRate; }
+        int getTargetSampleRate() const                     { return targetSampleRate_; }
 
         std::string getVersionString() const;
         static bool isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate = 0, int numChannels = 1);
 
     protected:
+        void buildIndex();
+        const unsigned char* getMappedData() const          { return reinterpret_cast<const unsigned char*>(mappedFile_.data()); }
+        void loadParallel(AudioBuffer* buffer, size_t numRanges);
+        void loadResampled(AudioBuffer* buffer);
+        int64_t readResampled(float* data, int64_t numFrames);
+        int64_t seekSource(int64_t frame);
+        int64_t toOutputFrames(int64_t numSourceFrames) const;
+        int64_t decodeRange(const std::vector<int64_t>& rangeStarts, const std::vector<int64_t>& rangeEnds, size_t range, float* output, ParallelLoad* load);
+
         FILE* handle_;
+        boost::iostreams::mapped_file_source mappedFile_;
         MadDecoder* decoder_;
-        friend class FormatManager;
+        MpegFrameIndex index_;
+        bool fastSeeking_;
+        bool persistentIndex_;
+        int numLoadThreads_;
+        int numOutputChannels_;
+        int targetSampleRate_;
+        bool memoryMapped_;
+
+        Resampler resampler_;
+        std::vector<float> pending_;        // decoded frames at the rate of the file, not yet converted
+        size_t pendingPos_;
+        bool endOfInput_;
+
+        static const size_t minFramesPerRange_s = 256;
+        friend class MpegBackend;
         static void initFormatInfos(FormatInfoVector& infos);
         static void initCodecInfos(CodecInfoVector& infos);
     };
 
     typedef boost::shared_ptr<MpegFile> MpegFilePtr;
 
+
+
+    class MpegBackend : public AudioBackend
+    {
+    public:
+        const char* getName() const                         { return "libmad"; }
+        int getPriority() const                             { return 10; }
+        unsigned getFeatures() const                        { return FeatureSeekable | FeatureStreaming | FeatureMemoryMapped | FeatureParallel; }
+
+        void initFormatInfos(FormatInfoVector& infos) const { MpegFile::initFormatInfos(infos); }
+        void initCodecInfos(CodecInfoVector& infos) const   { MpegFile::initCodecInfos(infos); }
+
+        bool canRead(FormatId format) const                 { return format == FORMAT_MPEG; }
+        bool isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate, int numChannels) const
+                                                            { return MpegFile::isFormatSupported(format, codec, sampleRate, numChannels); }
+
+        AudioFilePtr createFile() const                     { return MpegFilePtr(new MpegFile()); }
+    };
+
 } // namespace e3
\ No newline at end of file
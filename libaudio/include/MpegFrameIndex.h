@@ -0,0 +1,69 @@
+//------------------------------------------------------------
+// MpegFrameIndex.h
+// Byte offset and sample position of every MPEG frame
+//------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include <AudioFile.h>
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class MpegFrameIndex
+    //
+    // Built by a scan of the frame headers of an MPEG file.
+    // Finds the frame that contains a sample in O(log n).
+    // The index can be stored in a sidecar file next to the audio file.
+    // The sidecar file is only used as long as size and modification time
+    // of the audio file are unchanged.
+    // Indices of recently scanned files are also kept in a process wide cache,
+    // validated the same way.
+    //------------------------------------------------------------------
+
+    class MpegFrameIndex
+    {
+    public:
+        struct Entry
+        {
+            Entry(int64 offset = 0, int64 sample = 0) : offset_(offset), sample_(sample) {}
+
+            int64 offset_;      // byte offset of the frame header in the file
+            int64 sample_;      // first sample frame decoded from this frame
+        };
+
+        MpegFrameIndex();
+
+        void clear();
+        void add(int64 offset, int64 sample)            { entries_.push_back(Entry(offset, sample)); }
+
+        bool empty() const                              { return entries_.empty(); }
+        size_t size() const                             { return entries_.size(); }
+        const Entry& operator[] (size_t index) const    { return entries_[index]; }
+
+        int64 getNumSamples() const                     { return numSamples_; }
+        void setNumSamples(int64 numSamples)            { numSamples_ = numSamples; }
+
+        // Returns the index of the frame that contains sample.
+        //
+        size_t findFrame(int64 sample) const;
+
+        bool load(const Path& indexPath, const Path& audioPath);
+        bool store(const Path& indexPath, const Path& audioPath) const;
+
+        static Path getIndexPath(const Path& audioPath);
+
+        static bool lookup(const Path& audioPath, MpegFrameIndex* index);
+        static void remember(const Path& audioPath, const MpegFrameIndex& index);
+
+    protected:
+        typedef std::vector<Entry> EntryVector;
+        EntryVector entries_;
+        int64 numSamples_;
+    };
+
+} // namespace e3
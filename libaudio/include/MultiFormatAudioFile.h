@@ -19,6 +19,7 @@
 #include <EnumHelper.h>
 #include <IntegerTypes.h>
 
+#include "AudioBackend.h"
 #include "AudioFile.h"
 #include "AudioFormat.h"
 
@@ -40,6 +41,7 @@ namespace e3 {
 
         void open(const Path& filename, FileOpenMode mode);
         void load(AudioBuffer* buffer);
+        int64 read(float* data, int64 numFrames)        { return sf_readf_float(handle_, data, numFrames); }
         void store(const AudioBuffer* buffer);
         void close();
         int64 seek(int64 frame);
@@ -58,23 +60,58 @@ namespace e3 {
         bool isOpened() const                           { return handle_ != NULL; }
         int getNumSections() const                      { return numSections_; }
 
+        // Writes the instrument chunk into a WAV or AIFF file without rewriting
+        // the samples, see InstrumentChunkWriter. An opened file is closed for
+        // the update and opened again at frame 0.
+        //
+        void updateInstrumentChunk();
+
         static std::string getVersionString();
         static bool isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate = 0, int numChannels = 1);
 
+        // Table lookups between the ids and the libsndfile SF_FORMAT_* constants,
+        // no libsndfile call involved. isCodecAllowed() tells if a format can hold a codec.
+        //
+        static int toSfFormat(FormatId format, CodecId codec);
+        static FormatId toFormatId(int sfFormat);
+        static CodecId toCodecId(int sfFormat);
+        static bool isCodecAllowed(FormatId format, CodecId codec);
+
     protected:
-        int makeSfFormat() const      { return format_.idPrivate_ & SF_FORMAT_TYPEMASK | codec_.idPrivate_; }
+        int makeSfFormat() const      { return toSfFormat(format_.id_, codec_.id_); }
         void loadInstrumentChunk();
         void storeInstrumentChunk();
 
         int	numSections_;
         SNDFILE* handle_;
 
-        friend class FormatManager;
+        friend class SndfileBackend;
         static void initFormatInfos(FormatInfoVector& infos);
         static void initCodecInfos(CodecInfoVector& infos);
     };
 
     typedef boost::shared_ptr<MultiFormatAudioFile> MultiFormatAudioFilePtr;
 
+
+
+    // libsndfile probes the content itself, so it is also asked for unknown formats.
+    //
+    class SndfileBackend : public AudioBackend
+    {
+    public:
+        const char* getName() const                         { return "libsndfile"; }
+        int getPriority() const                             { return 0; }
+        unsigned getFeatures() const                        { return FeatureSeekable | FeatureStreaming | FeatureWrite; }
+
+        void initFormatInfos(FormatInfoVector& infos) const { MultiFormatAudioFile::initFormatInfos(infos); }
+        void initCodecInfos(CodecInfoVector& infos) const   { MultiFormatAudioFile::initCodecInfos(infos); }
+
+        bool canRead(FormatId format) const                 { return format != FORMAT_MPEG; }
+        bool isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate, int numChannels) const
+                                                            { return MultiFormatAudioFile::isFormatSupported(format, codec, sampleRate, numChannels); }
+
+        AudioFilePtr createFile() const                     { return MultiFormatAudioFilePtr(new MultiFormatAudioFile()); }
+    };
+
 } // namespace e3
 
@@ -0,0 +1,102 @@
+//------------------------------------------------------------
+// PlaylistStream.h
+// Gapless playback of a sequence of audio files
+//------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <boost/shared_ptr.hpp>
+
+#include <IntegerTypes.h>
+#include <AudioFile.h>
+#include <Resampler.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class PlaylistStream
+    //
+    // Splices a list of audio files into one continuous stream.
+    // A background thread opens the next entries ahead of time and
+    // decodes their head, so switching files causes no gap.
+    // Files with a different sample rate are converted to the stream rate,
+    // channels are mapped to the channel count of the stream.
+    // Frames a file marks as not part of the signal, like the encoder delay
+    // and padding of MP3 files, are skipped.
+    //------------------------------------------------------------------
+
+    class PlaylistStream
+    {
+    public:
+        PlaylistStream(int sampleRate = 44100, int numChannels = 2, size_t numPrefetch = 2, int64 prefetchFrames = 32768);
+        ~PlaylistStream();
+
+        void add(const Path& filename);
+        void start();
+        void stop();
+
+        // Reads interleaved frames at the sample rate of the stream.
+        // Blocks while the current entry is not yet decoded.
+        // Returns less than numFrames only when the end of the playlist is reached.
+        //
+        int64 read(float* data, int64 numFrames);
+
+        int getSampleRate() const       { return sampleRate_; }
+        int getNumChannels() const      { return numChannels_; }
+        size_t getNumEntries() const;
+        size_t getCurrentEntry() const;
+        int64 getPosition() const;
+        bool isFinished() const;
+
+    protected:
+        struct Entry
+        {
+            Entry(const Path& filename);
+
+            Path filename_;
+            AudioFilePtr file_;
+            Resampler resampler_;
+            std::vector<float> decoded_;   // converted to the rate and channels of the stream
+            size_t readPos_;
+            int64 filePos_;                 // frames read from the file
+            int64 signalStart_;             // frames of the file that belong to the signal
+            int64 signalEnd_;               // -1 when the file has no trailing frames
+            bool endOfFile_;
+        };
+        typedef boost::shared_ptr<Entry> EntryPtr;
+
+        void run();
+        EntryPtr findPending() const;
+        bool decodeChunk(Entry& entry, std::vector<float>& output);
+        void convertChannels(const float* input, int numInputChannels, int64 numFrames, std::vector<float>& output) const;
+
+        std::vector<EntryPtr> entries_;
+        int sampleRate_;
+        int numChannels_;
+        size_t numPrefetch_;
+        int64 prefetchFrames_;
+        int64 chunkFrames_;
+        size_t current_;
+        int64 position_;
+        bool running_;
+
+        std::vector<float> inputBuffer_;
+        std::vector<float> resampleBuffer_;
+
+        std::thread worker_;
+        mutable std::mutex mutex_;
+        std::condition_variable workerCondition_;
+        std::condition_variable readerCondition_;
+
+    private:
+        PlaylistStream(const PlaylistStream&);
+        PlaylistStream& operator= (const PlaylistStream&);
+    };
+
+} // namespace e3
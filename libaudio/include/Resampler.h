@@ -0,0 +1,56 @@
+//------------------------------------------------------------
+// Resampler.h
+// Streaming sample rate converter, wrapper for libsamplerate
+//------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include <IntegerTypes.h>
+
+struct SRC_STATE_tag;
+
+
+namespace e3 {
+
+    class Resampler
+    {
+    public:
+        enum Quality
+        {
+            QualityBest = 0,
+            QualityMedium = 1,
+            QualityFastest = 2
+        };
+
+        Resampler();
+        ~Resampler();
+
+        void init(int numChannels, int sourceRate, int targetRate, Quality quality = QualityMedium);
+        void reset();
+        bool isPassThrough() const          { return state_ == NULL; }
+        double getRatio() const             { return ratio_; }
+        int getNumChannels() const          { return numChannels_; }
+
+        // Converts interleaved input frames into output.
+        // Returns the number of frames written to output, numUsed receives the number of input frames consumed.
+        //
+        int64 process(const float* input, int64 numInput, float* output, int64 maxOutput, int64& numUsed, bool endOfInput);
+
+        // Converts all given input frames and appends the result to output.
+        // When endOfInput is set, the remaining converter state is flushed.
+        //
+        void process(const float* input, int64 numInput, std::vector<float>& output, bool endOfInput);
+
+    protected:
+        SRC_STATE_tag* state_;
+        int numChannels_;
+        double ratio_;
+
+    private:
+        Resampler(const Resampler&);
+        Resampler& operator= (const Resampler&);
+    };
+
+} // namespace e3
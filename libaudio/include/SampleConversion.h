@@ -0,0 +1,33 @@
+//------------------------------------------------------------
+// SampleConversion.h
+// Conversion kernels between sample formats
+//------------------------------------------------------------
+
+#pragma once
+
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    // Converts 32 bit floats to IEEE 754 half precision floats.
+    // Values are rounded to nearest even, values out of range become infinity.
+    // Uses F16C instructions when the CPU supports them.
+    //
+    extern void convertFloatToHalf(const float* input, uint16* output, size_t num);
+
+    // Converts IEEE 754 half precision floats to 32 bit floats.
+    // The conversion is exact. Uses F16C instructions when the CPU supports them.
+    //
+    extern void convertHalfToFloat(const uint16* input, float* output, size_t num);
+
+    // Converts fixed point samples with fracBits fractional bits to float,
+    // clipped to [-1, 1]. The planar input channels are interleaved into output.
+    // Uses AVX when the CPU supports it, SSE2 otherwise.
+    //
+    extern void convertFixedToFloat(const int32* const* input, int numChannels, int fracBits, float* output, size_t numFrames);
+
+    extern uint16 floatToHalf(float value);
+    extern float halfToFloat(uint16 value);
+
+} // namespace e3
@@ -0,0 +1,90 @@
+//------------------------------------------------------------
+// SampleStore.h
+// Content addressed store that shares identical sample data
+//------------------------------------------------------------
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+
+#include <boost/weak_ptr.hpp>
+
+#include <AudioBuffer.h>
+#include <AudioFile.h>
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    typedef boost::shared_ptr<const AudioBuffer> ConstAudioBufferPtr;
+
+
+    //------------------------------------------------------------------
+    // class SampleStore
+    //
+    // Maps decoded sample data to one shared buffer. Files that contain
+    // the same samples under different names, or in different formats,
+    // are held in memory once.
+    //
+    // Buffers are addressed by a 64 bit hash of their samples, rate and
+    // channel count. Buffers with equal hashes are compared sample by
+    // sample before they are shared.
+    //
+    // The store does not own the buffers. An entry expires when the last
+    // user releases its buffer, expired entries are swept from time to time.
+    // Shared buffers are const, a buffer the caller still refers to is
+    // copied before it is shared.
+    //------------------------------------------------------------------
+
+    class SampleStore
+    {
+    public:
+        struct Statistics
+        {
+            Statistics() : numRequests_(0), numHits_(0), numCollisions_(0), numBytesSaved_(0), numBuffers_(0), numBytesHeld_(0) {}
+
+            int64 numRequests_;         // buffers passed to the store
+            int64 numHits_;             // requests answered with a buffer already held
+            int64 numCollisions_;       // equal hashes of different samples
+            int64 numBytesSaved_;       // sample memory of all hits
+            int64 numBuffers_;          // distinct buffers currently held
+            int64 numBytesHeld_;        // their sample memory
+        };
+
+        SampleStore();
+
+        // Opens and loads the file, returns the shared buffer with its samples.
+        // Throws if the file can not be loaded.
+        //
+        ConstAudioBufferPtr load(const Path& filename);
+        ConstAudioBufferPtr load(AudioFile* file);
+
+        // Returns the buffer already held with the same samples, or buffer,
+        // which is held from now on. Pass the only reference to buffer, e.g.
+        // with std::move, otherwise the samples are copied.
+        //
+        ConstAudioBufferPtr insert(AudioBufferPtr buffer);
+
+        void clear();
+        Statistics getStatistics() const;
+
+        static uint64 calcHash(const AudioBuffer& buffer);
+
+    protected:
+        static bool isEqual(const AudioBuffer& a, const AudioBuffer& b);
+        void removeExpired();
+
+        typedef std::unordered_multimap<uint64, boost::weak_ptr<const AudioBuffer> > EntryMap;
+
+        EntryMap entries_;
+        size_t sweepSize_;                  // entries_ is swept for expired entries at this size
+        Statistics statistics_;
+        mutable std::mutex mutex_;
+
+    private:
+        SampleStore(const SampleStore&);
+        SampleStore& operator= (const SampleStore&);
+    };
+
+} // namespace e3
@@ -0,0 +1,97 @@
+//------------------------------------------------------------
+// WaveformOverview.h
+// Min/max/RMS pyramid for drawing waveforms at any zoom level
+//------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include <AudioFile.h>
+#include <IntegerTypes.h>
+
+
+namespace e3 {
+
+    class AudioBuffer;
+
+    //------------------------------------------------------------------
+    // class WaveformOverview
+    //
+    // Level 0 holds min, max and mean square of every block of
+    // blockSize frames, each further level combines two blocks of the
+    // level below. Samples are added in the order of the file, so the
+    // overview can be built while a file is loaded or streamed,
+    // see AudioFile::setWaveformOverview.
+    //
+    // A query reads from the coarsest level that still has at least
+    // one block per pixel, so its cost depends on the number of pixels only.
+    //
+    // Only level 0 is stored in the sidecar file, the other levels are
+    // rebuilt on load. The sidecar is used as long as size and modification
+    // time of the audio file are unchanged.
+    //------------------------------------------------------------------
+
+    class WaveformOverview
+    {
+    public:
+        struct Peak
+        {
+            float min_;
+            float max_;
+            float rms_;
+        };
+
+        WaveformOverview(int blockSize = 256);
+
+        // Starts a new overview, samples are interleaved.
+        // finish() builds the upper levels once all samples are added.
+        //
+        void init(int numChannels);
+        void add(const float* data, int64 numFrames);
+        void finish();
+        void build(const AudioBuffer& buffer);
+
+        bool isComplete() const                         { return complete_; }
+        int getNumChannels() const                      { return numChannels_; }
+        int64 getNumFrames() const                      { return numFrames_; }
+        int getBlockSize() const                        { return blockSize_; }
+        size_t getNumLevels() const                     { return levels_.size(); }
+
+        // Fills numPixels peaks of channel for the frames start to end.
+        // Zoomed in closer than blockSize frames per pixel, a pixel shows
+        // the block it falls into.
+        //
+        void getPeaks(int channel, int64 start, int64 end, Peak* output, size_t numPixels) const;
+
+        bool load(const Path& overviewPath, const Path& audioPath);
+        bool store(const Path& overviewPath, const Path& audioPath) const;
+
+        static Path getOverviewPath(const Path& audioPath);
+
+    protected:
+        struct Bucket
+        {
+            float min_;
+            float max_;
+            float power_;       // mean square
+        };
+        typedef std::vector<Bucket> BucketVector;
+
+        void flushPending();
+        void buildLevels();
+        int64 getNumFrames(size_t level, int64 block) const;
+
+        std::vector<BucketVector> levels_;      // numChannels_ buckets per block
+        std::vector<float> pendingMin_;         // running block, per channel
+        std::vector<float> pendingMax_;
+        std::vector<float> pendingSum_;
+        int64 numPending_;
+
+        int blockSize_;
+        int numChannels_;
+        int64 numFrames_;
+        bool complete_;
+    };
+
+} // namespace e3
@@ -0,0 +1,66 @@
+//------------------------------------------------------------
+// WorkerPool.h
+// Shared threads for background jobs
+//------------------------------------------------------------
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include <e3_CommonMacros.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class WorkerPool
+    //
+    // Runs jobs on a fixed number of threads, in the order they are posted.
+    // The threads are started with the first job.
+    // Jobs must not throw, exceptions are caught and traced.
+    //------------------------------------------------------------------
+
+    class WorkerPool
+    {
+        DECLARE_THREADSAFE_SINGLETON(WorkerPool)
+
+    public:
+        typedef boost::function<void ()> Job;
+
+        ~WorkerPool();
+
+        void post(const Job& job);
+
+        // Waits for the running jobs to finish and ends the threads.
+        // Pending jobs are kept and run when the next job is posted.
+        //
+        void stop();
+
+        // Takes effect when the threads are started the next time.
+        // 0 uses one thread per core.
+        //
+        void setNumThreads(size_t numThreads);
+        size_t getNumThreads() const;
+        size_t getNumPending() const;
+
+    protected:
+        void start();
+        void run(size_t generation);
+
+        std::deque<Job> jobs_;
+        std::vector<std::thread> threads_;
+        size_t numThreads_;
+        size_t generation_;
+        bool running_;
+
+        mutable std::mutex mutex_;
+        std::condition_variable condition_;
+    };
+
+} // namespace e3
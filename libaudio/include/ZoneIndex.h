@@ -0,0 +1,89 @@
+//------------------------------------------------------------
+// ZoneIndex.h
+// Key and velocity zones of many instrument chunks
+//------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include <IntegerTypes.h>
+#include <InstrumentChunk.h>
+
+
+namespace e3 {
+
+    //------------------------------------------------------------------
+    // class ZoneIndex
+    //
+    // The zones and loops of all added instrument chunks, one array per
+    // field. Zones are numbered in the order they are added.
+    //
+    // Every key holds the velocity ranges of the zones that cover it, so
+    // a zone takes one small record per key instead of one per key and
+    // velocity. The key lists are brought up to date by update(), which
+    // only appends the zones added since the last update.
+    // find() must not run concurrently with add() or update().
+    //------------------------------------------------------------------
+
+    class ZoneIndex
+    {
+    public:
+        typedef uint32 ZoneId;
+        typedef std::vector<ZoneId> ZoneIdVector;
+
+        ZoneIndex();
+
+        void clear();
+        void reserve(size_t numZones);
+
+        ZoneId add(const InstrumentChunk& chunk);
+        void update();
+
+        // Appends the zones covering note and velocity to result, in the order
+        // they were added, and returns their number.
+        // Zones added after the last update() are not found.
+        //
+        size_t find(int note, int velocity, ZoneIdVector& result) const;
+
+        size_t size() const                             { return keyLow_.size(); }
+        bool isUpToDate() const                         { return numIndexed_ == size(); }
+
+        int getKeyLow(ZoneId zone) const                { return keyLow_[zone]; }
+        int getKeyHigh(ZoneId zone) const               { return keyHigh_[zone]; }
+        int getVelocityLow(ZoneId zone) const           { return velocityLow_[zone]; }
+        int getVelocityHigh(ZoneId zone) const          { return velocityHigh_[zone]; }
+        int getBaseNote(ZoneId zone) const              { return baseNote_[zone]; }
+        int getDetune(ZoneId zone) const                { return detune_[zone]; }
+        int getGain(ZoneId zone) const                  { return gain_[zone]; }
+
+        size_t getNumLoops(ZoneId zone) const           { return loopStart_[zone + 1] - loopStart_[zone]; }
+        const InstrumentChunk::LoopData& getLoop(ZoneId zone, size_t index) const  { return loops_[loopStart_[zone] + index]; }
+
+    protected:
+        static const int numNotes_s = 128;
+
+        struct KeyZone
+        {
+            uint8 velocityLow_;
+            uint8 velocityHigh_;
+            ZoneId zone_;
+        };
+        typedef std::vector<KeyZone> KeyZoneVector;
+
+        std::vector<uint8> keyLow_;
+        std::vector<uint8> keyHigh_;
+        std::vector<uint8> velocityLow_;
+        std::vector<uint8> velocityHigh_;
+        std::vector<uint8> baseNote_;
+        std::vector<int16> detune_;
+        std::vector<int16> gain_;
+
+        std::vector<uint32> loopStart_;                 // size() + 1 entries into loops_
+        InstrumentChunk::LoopVector loops_;
+
+        KeyZoneVector keyZones_[numNotes_s];            // zones covering each key, in the order they were added
+        size_t numIndexed_;                             // zones contained in the key lists
+    };
+
+} // namespace e3
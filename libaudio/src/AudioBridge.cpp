@@ -10,25 +10,54 @@
 
 namespace e3 {
 
+    namespace {
+
+        struct PortName
+        {
+            AudioPortId id_;
+            const char* shortName_;
+            const char* longName_;
+        };
+
+        const PortName portNames[] =
+        {
+            { AP_UNSPECIFIED,  "UNSPECIFIED",   "Search for a working compiled API" },
+            { AP_ASIO,         "ASIO",          "Steinberg Audio Stream I/O" },
+            { AP_DS,           "DS",            "Microsoft Direct Sound" },
+            { AP_MME,          "MME",           "Microsoft Multimedia Extensions" },
+            { AP_WASAPI,       "WASAPI",        "Windows Audio Session" },
+            { AP_WDMKS,        "WDMKS",         "Windows Driver Model Kernel Streaming" },
+            { AP_ALSA,         "ALSA",          "Advanced Linux Sound Architecture" },
+            { AP_OSS,          "OSS",           "Linux Open Sound System" },
+            { AP_JACK,         "JACK",          "Jack Low-Latency Audio Server" },
+            { AP_COREAUDIO,    "COREAUDIO",     "Macintosh OS-X Core Audio" },
+            { AP_SOUNDMANAGER, "SOUNDMANAGER",  "SoundManager" },
+            { AP_BEOS,         "BEOS",          "BeOS" },
+            { AP_HPI,          "HPI",           "AudioScience Hardware Programming Interface" },
+        };
+
+    } // namespace
+
+
     AudioBridge::PortNames AudioBridge::portNames_s;
-    AudioBridge::Initializer AudioBridge::initializer_s;
+    std::once_flag AudioBridge::initFlag_s;
 
 
-    AudioBridge::Initializer::Initializer()
+    // The names are set up on first use, not at static initialization.
+    //
+    const AudioBridge::PortNames& AudioBridge::getPortNames()
     {
-        portNames_s.add(AP_UNSPECIFIED, "UNSPECIFIED", "Search for a working compiled API");
-        portNames_s.add(AP_ASIO, "ASIO", "Steinberg Audio Stream I/O");
-        portNames_s.add(AP_DS, "DS", "Microsoft Direct Sound");
-        portNames_s.add(AP_MME, "MME", "Microsoft Multimedia Extensions");
-        portNames_s.add(AP_WASAPI, "WASAPI", "Windows Audio Session");
-        portNames_s.add(AP_WDMKS, "WDMKS", "Windows Driver Model Kernel Streaming");
-        portNames_s.add(AP_ALSA, "ALSA", "Advanced Linux Sound Architecture");
-        portNames_s.add(AP_OSS, "OSS", "Linux Open Sound System");
-        portNames_s.add(AP_JACK, "JACK", "Jack Low-Latency Audio Server");
-        portNames_s.add(AP_COREAUDIO, "COREAUDIO", "Macintosh OS-X Core Audio");
-        portNames_s.add(AP_SOUNDMANAGER, "SOUNDMANAGER", "SoundManager");
-        portNames_s.add(AP_BEOS, "BEOS", "BeOS");
-        portNames_s.add(AP_HPI, "HPI", "AudioScience Hardware Programming Interface");
+        std::call_once(initFlag_s, &AudioBridge::initPortNames);
+        return portNames_s;
+    }
+
+
+
+    void AudioBridge::initPortNames()
+    {
+        for (size_t i = 0; i < sizeof(portNames) / sizeof(portNames[0]); ++i) {
+            portNames_s.add(portNames[i].id_, portNames[i].shortName_, portNames[i].longName_);
+        }
     }
 
 
@@ -8,33 +8,79 @@
 
 namespace e3 {
 
-    AudioBuffer::AudioBuffer(int numChannels) :
+    AudioBuffer::AudioBuffer(int numChannels, MemoryCategory category) :
         Buffer(),
         sampleRate_(0),
         numFrames_(0),
         numChannels_(numChannels),
-        framePos_(0)
-    {}
+        framePos_(0),
+        category_(category),
+        numPins_(0),
+        spilled_(false),
+        lastAccess_(0),
+        numAccountedBytes_(0)
+    {
+        MemoryBudget::instance().add(this);
+    }
 
 
     AudioBuffer::AudioBuffer(const AudioBuffer& source) :
-        Buffer(source),
+        Buffer(),
         sampleRate_(source.sampleRate_),
-        numFrames_(source.numChannels_),
+        numFrames_(source.numFrames_),
         numChannels_(source.numChannels_),
-        framePos_(0)
-    {}
+        framePos_(0),
+        category_(source.category_),
+        numPins_(0),
+        spilled_(false),
+        lastAccess_(0),
+        numAccountedBytes_(0)
+    {
+        MemoryBudget::instance().add(this);
+        {
+            ScopedPin sourcePin(&source);       // restores a spilled source and keeps it resident while copying
+            ScopedPin pin(this);
+            copy(source);
+        }
+        MemoryBudget::instance().update(this);
+    }
+
+
+
+    AudioBuffer::~AudioBuffer()
+    {
+        MemoryBudget::instance().remove(this);
+    }
+
+
+
+    void AudioBuffer::pin() const
+    {
+        MemoryBudget::instance().pin(const_cast<AudioBuffer*>(this));
+    }
 
 
 
     AudioBuffer& AudioBuffer::operator= (const AudioBuffer& source)
     {
-        copy(source);
+        if (this == &source)
+            return *this;
+
+        if (spilled_) {
+            MemoryBudget::instance().discard(this);
+        }
+        {
+            ScopedPin sourcePin(&source);
+            ScopedPin pin(this);
+            copy(source);
+        }
+
         sampleRate_  = source.sampleRate_;
         numFrames_   = source.numFrames_;
         numChannels_ = source.numChannels_;
         framePos_    = source.numFrames_;
 
+        MemoryBudget::instance().update(this);
         return *this;
     }
 
@@ -52,9 +98,12 @@ namespace e3 {
                 THROW(std::exception, "Samplerate can not be converted from %d to %d", sampleRate_, newRate);
             }
 
-            AudioBuffer output(numChannels_);
+            AudioBuffer output(numChannels_, MemoryProcessing);
             output.resize((int)ceil(size_ * ratio));  // set buffer size needed for new samplerate
 
+            ScopedPin pin(this);
+            ScopedPin outputPin(&output);
+
             // convert using libsamplerate
             SRC_DATA srcData;
             srcData.end_of_input = 0;
@@ -80,20 +129,47 @@ namespace e3 {
 
     float* AudioBuffer::resize(size_t size, bool clearData)
     {
+        float* pResult;
         if (clearData)
+        {
             clear();
-
-        float* pResult = Buffer::resize(size);
+            pResult = Buffer::resize(size);
+        }
+        else
+        {
+            ScopedPin pin(this);    // restores spilled data and keeps it resident while it is preserved
+            pResult = Buffer::resize(size);
+        }
 
         numFrames_ = (numChannels_ > 0 && data_) ? size / numChannels_ : 0;
+        MemoryBudget::instance().update(this);
+
         return pResult;
     }
 
 
+
+    void AudioBuffer::clear()
+    {
+        if (spilled_) {
+            MemoryBudget::instance().discard(this);
+        }
+        Buffer::clear();
+        MemoryBudget::instance().update(this);
+    }
+
+
+
+    void AudioBuffer::setMemoryCategory(MemoryCategory category)
+    {
+        MemoryBudget::instance().setCategory(this, category);
+    }
+
+
     float* AudioBuffer::getCurrent()
     {
         ASSERT(framePos_ <= numFrames_);
-        return data_ + framePos_ * numChannels_;
+        return getHead() + framePos_ * numChannels_;
     }
 
 } // namespace e3
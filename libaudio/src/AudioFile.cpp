@@ -3,9 +3,17 @@
 // AudioFile.cpp
 //--------------------------------------------------------
 
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <e3_Exception.h>
+
 #include <AudioBuffer.h>
 #include <AudioFile.h>
+#include <HalfAudioBuffer.h>
 #include <InstrumentChunk.h>
+#include <WaveformOverview.h>
 
 
 namespace e3 {
@@ -15,7 +23,8 @@ namespace e3 {
         numChannels_(2),
         numFrames_(0),
         fileOpenMode_(OpenRead),
-        instrumentChunk_(NULL)
+        instrumentChunk_(NULL),
+        overview_(NULL)
     {}
 
 
@@ -29,7 +38,260 @@ namespace e3 {
     {
         filename_ = filename;
         fileOpenMode_ = mode;
+        sections_.clear();
         ASSERT(filename_.empty() == false);
     }
 
+
+
+    // Loads the file into a half precision buffer.
+    // The file is read and converted in blocks, so the samples are never
+    // held as full size float buffer.
+    //
+    void AudioFile::loadHalf(HalfAudioBuffer* buffer, int64_t blockSize)
+    {
+        ASSERT(isReadable());
+        ASSERT(blockSize > 0);
+
+        try {
+            std::vector<float> block((size_t)(blockSize * numChannels_));
+
+            buffer->setSampleRate(sampleRate_);
+            buffer->setNumChannels(numChannels_);
+            buffer->clear();
+            buffer->resize((size_t)(numFrames_ * numChannels_));
+
+            seek(0);
+            beginOverview();
+            int64_t numDone = 0;
+
+            while (true)
+            {
+                int64_t numRead = read(&block[0], blockSize);
+                if (numRead <= 0)
+                    break;
+
+                if (numDone + numRead > buffer->getNumFrames())     // numFrames_ was only estimated
+                {
+                    size_t size = (size_t)((numDone + numRead + numDone / 4) * numChannels_);
+                    if (buffer->resize(size) == NULL || buffer->size() != size)
+                        THROW(std::exception, "Not enough memory to load file");
+                }
+                buffer->write(numDone, &block[0], numRead);
+                addToOverview(&block[0], numRead);
+                numDone += numRead;
+                reportProgress(numDone);
+
+                if (numRead < blockSize)
+                    break;
+            }
+            buffer->resize((size_t)(numDone * numChannels_));
+            numFrames_ = numDone;
+            finishOverview();
+        }
+        catch (const std::exception& e)
+        {
+            buffer->resize(0);
+            throw e;
+        }
+    }
+
+
+
+    // Throws if the progress callback asks to stop loading.
+    //
+    void AudioFile::reportProgress(int64_t numDone)
+    {
+        if (progressCallback_ && progressCallback_(numDone, numFrames_) == false)
+            THROW(std::exception, "Loading cancelled: %s", filename_.string().c_str());
+    }
+
+
+
+    void AudioFile::beginOverview()
+    {
+        if (overview_) {
+            overview_->init(numChannels_);
+        }
+    }
+
+
+
+    void AudioFile::addToOverview(const float* data, int64_t numFrames)
+    {
+        if (overview_) {
+            overview_->add(data, numFrames);
+        }
+    }
+
+
+
+    void AudioFile::finishOverview()
+    {
+        if (overview_) {
+            overview_->finish();
+        }
+    }
+
+
+
+    bool AudioFile::getFileStamp(const Path& path, int64_t& size, int64_t& time)
+    {
+        boost::system::error_code error;
+        size = (int64_t)boost::filesystem::file_size(path, error);
+        if (error) return false;
+        time = (int64_t)boost::filesystem::last_write_time(path, error);
+        return !error;
+    }
+
+
+
+    // Sizes the buffer for numFrames_ frames and decodes the ranges on a
+    // thread each, directly into their place in the buffer. Progress is
+    // reported from the calling thread, a cancel stops all ranges.
+    //
+    // rangeEnds holds the frame each range should reach. The buffer is cut
+    // at the first range that falls short, the frames of the ranges behind
+    // it would not follow on. Without rangeEnds the buffer keeps its size
+    // and frames that could not be decoded stay silent.
+    //
+    void AudioFile::runParallelLoad(AudioBuffer* buffer, size_t numRanges, const RangeDecoder& decodeRange, const std::vector<int64_t>& rangeEnds)
+    {
+        ASSERT(rangeEnds.empty() || rangeEnds.size() == numRanges);
+
+        buffer->setSampleRate(sampleRate_);
+        buffer->setNumChannels(numChannels_);
+        size_t numSamples = (size_t)(numFrames_ * numChannels_);
+        buffer->resize(numSamples);         // cleared
+        if (buffer->size() != numSamples)
+            THROW(std::exception, "Out of memory");
+
+        ScopedPin pin(buffer);      // the buffer must stay resident while the threads write to it
+        float* output = buffer->getHead();
+
+        ParallelLoad load;
+        std::vector<std::thread> threads;
+        std::vector<std::exception_ptr> errors(numRanges);
+        std::vector<int64_t> decodedEnds(numRanges, 0);
+        for (size_t i = 0; i < numRanges; ++i) {
+            threads.push_back(std::thread(&AudioFile::decodeParallelRange, &decodeRange, i, output, &load, &decodedEnds[i], &errors[i]));
+        }
+
+        std::exception_ptr cancelled;
+        while (progressCallback_ && load.numFinished_ < numRanges)     // progress is reported from the calling thread
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            try {
+                reportProgress(load.numDone_);
+            }
+            catch (...) {
+                cancelled = std::current_exception();
+                load.stop_ = true;
+                break;
+            }
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+
+        if (cancelled) {
+            buffer->resize(0);
+            std::rethrow_exception(cancelled);
+        }
+        for (size_t i = 0; i < errors.size(); ++i)
+        {
+            if (errors[i]) {
+                buffer->resize(0);
+                std::rethrow_exception(errors[i]);
+            }
+        }
+
+        for (size_t i = 0; i < rangeEnds.size(); ++i)
+        {
+            if (decodedEnds[i] < rangeEnds[i])      // damaged file or wrong index, keep what was decoded before
+            {
+                numFrames_ = decodedEnds[i];
+                buffer->resize((size_t)(numFrames_ * numChannels_), false);
+                break;
+            }
+        }
+
+        if (overview_) {                // the ranges finish in any order, the overview is built afterwards
+            overview_->build(*buffer);
+        }
+    }
+
+
+
+    void AudioFile::decodeParallelRange(const RangeDecoder* decodeRange, size_t range, float* output, ParallelLoad* load, int64_t* decodedEnd, std::exception_ptr* error)
+    {
+        try {
+            *decodedEnd = (*decodeRange)(range, output, load);
+        }
+        catch (...) {
+            *error = std::current_exception();
+        }
+        load->numFinished_++;
+    }
+
+
+
+    const AudioFile::SectionVector& AudioFile::getSections()
+    {
+        if (sections_.empty()) {
+            initSections();
+        }
+        return sections_;
+    }
+
+
+
+    // Default layout: the whole file is one section.
+    //
+    void AudioFile::initSections()
+    {
+        sections_.clear();
+        sections_.push_back(Section(0, numFrames_));
+    }
+
+
+
+    // Loads the frames of a single section into buffer.
+    // Only the section is read, the rest of the file is not touched.
+    //
+    void AudioFile::loadSection(size_t index, AudioBuffer* buffer)
+    {
+        ASSERT(isReadable());
+
+        const SectionVector& sections = getSections();
+        if (index >= sections.size())
+            THROW(std::exception, "Section %d does not exist (%d sections)", (int)index, (int)sections.size());
+
+        const Section& section = sections[index];
+
+        try {
+            buffer->setSampleRate(sampleRate_);
+            buffer->setNumChannels(numChannels_);
+
+            size_t numSamples = (size_t)(section.numFrames_ * numChannels_);
+            buffer->resize(numSamples);
+
+            if (buffer->size() != numSamples)
+                THROW(std::exception, "Not enough memory to load section");
+
+            if (seek(section.start_) != section.start_)
+                THROW(std::exception, "Can not seek to section %d", (int)index);
+
+            ScopedPin pin(buffer);
+            int64_t numRead = read(buffer->getHead(), section.numFrames_);
+            if (numRead != section.numFrames_)
+                THROW(std::exception, "Error reading section %d", (int)index);
+        }
+        catch (const std::exception&)
+        {
+            buffer->resize(0);
+            throw;
+        }
+    }
+
 } // namespace e3
\ No newline at end of file
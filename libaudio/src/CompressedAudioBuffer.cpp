@@ -0,0 +1,446 @@
+//------------------------------------------------------------
+// CompressedAudioBuffer.cpp
+// Lossless in-memory compression of AudioBuffer content
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+#include <e3_Exception.h>
+#include <CompressedAudioBuffer.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        const float kFixedScale = 8388608.f;    // 2^23, fixed point scale of 24 bit samples
+        const int kMaxShift = 23;
+        const int kMaxRiceParam = 30;
+        const uint32 kEscape = 32;              // quotients from here on are stored verbatim
+        const size_t kHeaderSize = 8;           // mode, shift, rice parameter, reserved, payload length
+
+
+        inline uint32 zigzag(int32 v)   { return ((uint32)v << 1) ^ (uint32)(v >> 31); }
+        inline int32 unzigzag(uint32 u) { return (int32)(u >> 1) ^ -(int32)(u & 1); }
+
+
+        inline int countLeadingZeros(uint64 x)
+        {
+            if (x == 0) return 64;
+#ifdef _MSC_VER
+            unsigned long index;
+            if (_BitScanReverse(&index, (unsigned long)(x >> 32)))
+                return 31 - (int)index;
+            _BitScanReverse(&index, (unsigned long)x);
+            return 63 - (int)index;
+#else
+            return __builtin_clzll(x);
+#endif
+        }
+
+
+        inline int countTrailingZeros(uint32 x)
+        {
+            if (x == 0) return 32;
+#ifdef _MSC_VER
+            unsigned long index;
+            _BitScanForward(&index, x);
+            return (int)index;
+#else
+            return __builtin_ctz(x);
+#endif
+        }
+
+
+        //----------------------------------------------------------
+        // Writes MSB first bit fields into a byte vector
+        //----------------------------------------------------------
+        class BitWriter
+        {
+        public:
+            BitWriter(std::vector<uint8>& output) : output_(output), cache_(0), numBits_(0) {}
+
+            void write(uint32 value, int numBits)      // numBits <= 32
+            {
+                cache_ = (cache_ << numBits) | value;
+                numBits_ += numBits;
+
+                while (numBits_ >= 8) {
+                    numBits_ -= 8;
+                    output_.push_back((uint8)(cache_ >> numBits_));
+                }
+            }
+
+            void writeRice(uint32 value, int k)
+            {
+                uint32 q = value >> k;
+                if (q >= kEscape) {
+                    write(0xFFFFFFFF, kEscape);
+                    write(value, 32);
+                }
+                else {
+                    write(((1u << q) - 1) << 1, q + 1);    // q ones terminated by a zero
+                    if (k > 0) write(value & ((1u << k) - 1), k);
+                }
+            }
+
+            void flush()
+            {
+                if (numBits_ > 0) {
+                    output_.push_back((uint8)(cache_ << (8 - numBits_)));
+                    numBits_ = 0;
+                }
+            }
+
+        private:
+            std::vector<uint8>& output_;
+            uint64 cache_;
+            int numBits_;
+        };
+
+
+        //----------------------------------------------------------
+        // Reads MSB first bit fields, keeps at least 57 bits cached
+        //----------------------------------------------------------
+        class BitReader
+        {
+        public:
+            BitReader(const uint8* data, size_t length) : pos_(data), end_(data + length), cache_(0), numBits_(0) {}
+
+            uint32 read(int numBits)     // numBits <= 32
+            {
+                if (numBits == 0) return 0;
+                refill();
+
+                uint32 value = (uint32)(cache_ >> (64 - numBits));
+                cache_ <<= numBits;
+                numBits_ -= numBits;
+                return value;
+            }
+
+            uint32 readRice(int k)
+            {
+                refill();
+                int q = countLeadingZeros(~cache_);
+
+                if (q >= (int)kEscape) {
+                    skip(kEscape);
+                    return read(32);
+                }
+                skip(q + 1);
+                return ((uint32)q << k) | read(k);
+            }
+
+        private:
+            void refill()
+            {
+                while (numBits_ <= 56) {
+                    uint64 byte = (pos_ < end_) ? *pos_++ : 0;
+                    cache_ |= byte << (56 - numBits_);
+                    numBits_ += 8;
+                }
+            }
+
+            void skip(int numBits)
+            {
+                cache_ <<= numBits;
+                numBits_ -= numBits;
+            }
+
+            const uint8* pos_;
+            const uint8* end_;
+            uint64 cache_;
+            int numBits_;
+        };
+
+    } // namespace
+
+
+
+    CompressedAudioBuffer::CompressedAudioBuffer(size_t blockSize, size_t numCacheBlocks) :
+        blockSize_(blockSize),
+        sampleRate_(0),
+        numChannels_(0),
+        numFrames_(0),
+        cache_(std::max<size_t>(1, numCacheBlocks)),
+        useCounter_(0)
+    {
+        ASSERT(blockSize_ > 0);
+    }
+
+
+
+    void CompressedAudioBuffer::clear()
+    {
+        std::vector<uint8>().swap(data_);
+        std::vector<uint64>().swap(blockOffsets_);
+
+        for (size_t i = 0; i < cache_.size(); ++i) {
+            cache_[i] = CacheSlot();
+        }
+        numFrames_ = 0;
+    }
+
+
+
+    void CompressedAudioBuffer::compress(const AudioBuffer& source)
+    {
+        clear();
+
+        sampleRate_ = source.getSampleRate();
+        numChannels_ = source.getNumChannels();
+        numFrames_ = source.getNumFrames();
+        if (numFrames_ == 0 || numChannels_ == 0)
+            return;
+
+        size_t numBlocks = (size_t)((numFrames_ + blockSize_ - 1) / blockSize_);
+        blockOffsets_.reserve(numBlocks);
+        data_.reserve((size_t)(source.calcNumBytes() / 2));
+        channel_.resize(blockSize_);
+
+        ScopedPin pin(&source);
+        const float* input = source.getHead();
+        for (size_t block = 0; block < numBlocks; ++block)
+        {
+            size_t numFrames = getBlockFrames(block);
+            blockOffsets_.push_back(data_.size());
+
+            for (int c = 0; c < numChannels_; ++c)
+            {
+                for (size_t i = 0; i < numFrames; ++i) {
+                    channel_[i] = input[i * numChannels_ + c];
+                }
+                encodeChannel(&channel_[0], numFrames);
+            }
+            input += numFrames * numChannels_;
+        }
+
+        std::vector<uint8>(data_).swap(data_);     // release unused capacity
+        std::vector<int32>().swap(ints_);
+        std::vector<float>().swap(channel_);
+    }
+
+
+
+    void CompressedAudioBuffer::decompress(AudioBuffer* target) const
+    {
+        ASSERT(target);
+
+        target->setSampleRate(sampleRate_);
+        target->setNumChannels(numChannels_);
+
+        size_t numSamples = (size_t)(numFrames_ * numChannels_);
+        target->resize(numSamples);
+        if (target->size() != numSamples)
+            THROW(std::exception, "Not enough memory to decompress buffer");
+
+        ScopedPin pin(target);
+        for (size_t block = 0; block < blockOffsets_.size(); ++block) {
+            decodeBlock(block, target->getHead() + block * blockSize_ * numChannels_);
+        }
+    }
+
+
+
+    int64 CompressedAudioBuffer::read(int64 frame, float* output, int64 numFrames)
+    {
+        if (frame < 0)
+            THROW(std::exception, "Invalid start frame %lld", (long long)frame);
+
+        numFrames = std::min(numFrames, numFrames_ - frame);
+        int64 numDone = 0;
+
+        while (numDone < numFrames)
+        {
+            size_t block = (size_t)(frame / blockSize_);
+            size_t offset = (size_t)(frame % blockSize_);
+            size_t num = (size_t)std::min<int64>(getBlockFrames(block) - offset, numFrames - numDone);
+
+            const float* data = getBlock(block);
+            memcpy(output, data + offset * numChannels_, num * numChannels_ * sizeof(float));
+
+            output += num * numChannels_;
+            frame += num;
+            numDone += num;
+        }
+        return std::max<int64>(numDone, 0);
+    }
+
+
+
+    const float* CompressedAudioBuffer::getBlock(size_t index)
+    {
+        ASSERT(index < blockOffsets_.size());
+
+        CacheSlot* victim = &cache_[0];
+        for (size_t i = 0; i < cache_.size(); ++i)
+        {
+            CacheSlot& slot = cache_[i];
+            if (slot.block_ == (int64)index) {
+                slot.lastUse_ = ++useCounter_;
+                return &slot.frames_[0];
+            }
+            if (slot.lastUse_ < victim->lastUse_) {
+                victim = &slot;
+            }
+        }
+
+        victim->frames_.resize(blockSize_ * numChannels_);
+        decodeBlock(index, &victim->frames_[0]);
+        victim->block_ = index;
+        victim->lastUse_ = ++useCounter_;
+
+        return &victim->frames_[0];
+    }
+
+
+
+    size_t CompressedAudioBuffer::getBlockFrames(size_t index) const
+    {
+        int64 start = (int64)index * blockSize_;
+        return (size_t)std::min<int64>(blockSize_, numFrames_ - start);
+    }
+
+
+
+    int64 CompressedAudioBuffer::calcNumBytes() const
+    {
+        return data_.size() + blockOffsets_.size() * sizeof(uint64);
+    }
+
+
+
+    double CompressedAudioBuffer::getCompressionRatio() const
+    {
+        int64 numBytesUncompressed = numFrames_ * numChannels_ * sizeof(float);
+        return numBytesUncompressed > 0 ? (double)calcNumBytes() / numBytesUncompressed : 1.0;
+    }
+
+
+
+    // Appends the coded samples of one channel of a block.
+    // Falls back to verbatim storage if the samples are not fixed point values
+    // or if coding does not save space.
+    //
+    void CompressedAudioBuffer::encodeChannel(const float* input, size_t numFrames)
+    {
+        ints_.resize(numFrames);
+
+        bool isFixedPoint = true;
+        uint32 usedBits = 0;
+        for (size_t i = 0; i < numFrames; ++i)
+        {
+            float v = input[i] * kFixedScale;
+            if (!(v >= -kFixedScale && v <= kFixedScale) || (float)(int32)v != v || (v == 0 && std::signbit(v))) {     // -0 has no fixed point value
+                isFixedPoint = false;
+                break;
+            }
+            ints_[i] = (int32)v;
+            usedBits |= (uint32)ints_[i];
+        }
+
+        uint8 header[kHeaderSize] = { BlockRaw, 0, 0, 0, 0, 0, 0, 0 };
+        int shift = std::min(countTrailingZeros(usedBits), kMaxShift);
+        int k = 0;
+
+        if (isFixedPoint)
+        {
+            // second order fixed prediction, history starts with zero so each block decodes on its own
+            uint64 sum = 0;
+            int32 x1 = 0, x2 = 0;
+            for (size_t i = 0; i < numFrames; ++i)
+            {
+                int32 x = ints_[i] >> shift;
+                uint32 u = zigzag(x - 2 * x1 + x2);
+                ints_[i] = (int32)u;
+                sum += u;
+                x2 = x1;
+                x1 = x;
+            }
+            while (k < kMaxRiceParam && ((uint64)numFrames << (k + 1)) <= sum) {
+                ++k;
+            }
+
+            uint64 numBits = 0;
+            for (size_t i = 0; i < numFrames; ++i) {
+                uint32 q = (uint32)ints_[i] >> k;
+                numBits += (q < kEscape) ? q + 1 + k : kEscape + 32;
+            }
+            isFixedPoint = (numBits + 7) / 8 < numFrames * sizeof(float);
+        }
+
+        size_t headerPos = data_.size();
+        data_.insert(data_.end(), header, header + kHeaderSize);
+
+        if (isFixedPoint)
+        {
+            BitWriter writer(data_);
+            for (size_t i = 0; i < numFrames; ++i) {
+                writer.writeRice((uint32)ints_[i], k);
+            }
+            writer.flush();
+
+            data_[headerPos] = BlockPredicted;
+            data_[headerPos + 1] = (uint8)shift;
+            data_[headerPos + 2] = (uint8)k;
+        }
+        else
+        {
+            const uint8* bytes = reinterpret_cast<const uint8*>(input);
+            data_.insert(data_.end(), bytes, bytes + numFrames * sizeof(float));
+        }
+
+        uint32 length = (uint32)(data_.size() - headerPos - kHeaderSize);
+        memcpy(&data_[headerPos + 4], &length, sizeof(length));
+    }
+
+
+
+    // Decodes all channels of a block into interleaved frames.
+    //
+    void CompressedAudioBuffer::decodeBlock(size_t index, float* output) const
+    {
+        const uint8* pos = &data_[(size_t)blockOffsets_[index]];
+        size_t numFrames = getBlockFrames(index);
+
+        for (int c = 0; c < numChannels_; ++c)
+        {
+            uint8 mode = pos[0];
+            int shift = pos[1];
+            int k = pos[2];
+            uint32 length;
+            memcpy(&length, pos + 4, sizeof(length));
+            pos += kHeaderSize;
+
+            float* out = output + c;
+            if (mode == BlockPredicted)
+            {
+                BitReader reader(pos, length);
+                float scale = ldexpf(1.f, shift - kMaxShift);
+                int32 x1 = 0, x2 = 0;
+
+                for (size_t i = 0; i < numFrames; ++i, out += numChannels_)
+                {
+                    int32 x = unzigzag(reader.readRice(k)) + 2 * x1 - x2;
+                    *out = x * scale;
+                    x2 = x1;
+                    x1 = x;
+                }
+            }
+            else
+            {
+                for (size_t i = 0; i < numFrames; ++i, out += numChannels_) {
+                    memcpy(out, pos + i * sizeof(float), sizeof(float));
+                }
+            }
+            pos += length;
+        }
+    }
+
+} // namespace e3
@@ -0,0 +1,662 @@
+//------------------------------------------------------------
+// FlacDecoder.cpp
+// Native decoder for FLAC frames in memory
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+#include <e3_Exception.h>
+
+#include <FlacDecoder.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        const int sampleRates[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000 };
+        const int sampleSizes[] = { 0, 8, 12, -1, 16, 20, 24, -1 };
+
+        enum ChannelMode
+        {
+            LeftSide  = 8,
+            SideRight = 9,
+            MidSide   = 10
+        };
+
+        // CRC-8 (x^8 + x^2 + x + 1) of frame headers and
+        // CRC-16 (x^16 + x^15 + x^2 + 1) of whole frames
+        //
+        struct CrcTables
+        {
+            CrcTables()
+            {
+                for (unsigned i = 0; i < 256; ++i)
+                {
+                    unsigned crc8 = i;
+                    unsigned crc16 = i << 8;
+                    for (int bit = 0; bit < 8; ++bit) {
+                        crc8 = (crc8 & 0x80) ? (crc8 << 1) ^ 0x07 : crc8 << 1;
+                        crc16 = (crc16 & 0x8000) ? (crc16 << 1) ^ 0x8005 : crc16 << 1;
+                    }
+                    crc8_[i] = (uint8)crc8;
+                    crc16_[i] = (uint16)crc16;
+                }
+            }
+
+            uint8 crc8_[256];
+            uint16 crc16_[256];
+        };
+
+        const CrcTables crcTables;
+
+        uint8 crc8(const uint8* data, size_t size)
+        {
+            uint8 crc = 0;
+            for (size_t i = 0; i < size; ++i) {
+                crc = crcTables.crc8_[crc ^ data[i]];
+            }
+            return crc;
+        }
+
+        uint16 crc16(const uint8* data, size_t size)
+        {
+            uint16 crc = 0;
+            for (size_t i = 0; i < size; ++i) {
+                crc = (uint16)((crc << 8) ^ crcTables.crc16_[(crc >> 8) ^ data[i]]);
+            }
+            return crc;
+        }
+
+        uint64 readBigEndian(const uint8* data, int numBytes)
+        {
+            uint64 value = 0;
+            for (int i = 0; i < numBytes; ++i) {
+                value = (value << 8) | data[i];
+            }
+            return value;
+        }
+
+        int countLeadingZeros(uint64 value)
+        {
+#if defined(_MSC_VER) && defined(_M_X64)
+            unsigned long index;
+            _BitScanReverse64(&index, value);
+            return 63 - (int)index;
+#elif defined(_MSC_VER)
+            unsigned long index;
+            if (_BitScanReverse(&index, (unsigned long)(value >> 32)))
+                return 31 - (int)index;
+            _BitScanReverse(&index, (unsigned long)value);
+            return 63 - (int)index;
+#else
+            return __builtin_clzll(value);
+#endif
+        }
+
+        int getBitLength(uint32 value)
+        {
+            int length = 0;
+            while (value) {
+                length++;
+                value >>= 1;
+            }
+            return length;
+        }
+
+    } // namespace
+
+
+
+    //--------------------------------------------------------------------
+    // class FlacDecoder::BitReader
+    //
+    // Reads big endian bit fields through a 64 bit cache whose valid
+    // bits are left aligned. Reading past the end returns zeros and
+    // is reported by isOverrun().
+    //--------------------------------------------------------------------
+
+    class FlacDecoder::BitReader
+    {
+    public:
+        BitReader(const uint8* data, size_t size) :
+            data_(data),
+            size_(size),
+            pos_(0),
+            cache_(0),
+            numBits_(0)
+        {
+            refill();
+        }
+
+        uint32 read(int numBits)
+        {
+            if (numBits == 0)
+                return 0;
+            if (numBits_ < numBits)
+                refill();
+
+            uint32 value = (uint32)(cache_ >> (64 - numBits));
+            cache_ <<= numBits;
+            numBits_ -= numBits;
+            return value;
+        }
+
+        int32 readSigned(int numBits)
+        {
+            if (numBits == 0)
+                return 0;
+
+            int shift = 32 - numBits;
+            return (int32)(read(numBits) << shift) >> shift;
+        }
+
+        // Counts zero bits up to the next one bit
+        //
+        uint32 readUnary()
+        {
+            uint32 count = 0;
+            while (true)
+            {
+                if (cache_ != 0)             // the bits below numBits_ are always zero
+                {
+                    int numZeros = countLeadingZeros(cache_);
+                    cache_ <<= numZeros;
+                    cache_ <<= 1;
+                    numBits_ -= numZeros + 1;
+                    return count + numZeros;
+                }
+                count += numBits_;
+                numBits_ = 0;
+
+                if (pos_ >= size_) {        // only padding left
+                    pos_ = size_ + 1;
+                    return count;
+                }
+                refill();
+            }
+        }
+
+        void alignToByte()                          { read(numBits_ & 7); }
+        size_t getBytePos() const                   { return (pos_ * 8 - numBits_ + 7) / 8; }
+        bool isOverrun() const                      { return pos_ * 8 - numBits_ > size_ * 8; }
+
+    private:
+        void refill()
+        {
+            while (numBits_ <= 56)
+            {
+                uint64 byte = (pos_ < size_) ? data_[pos_] : 0;
+                cache_ |= byte << (56 - numBits_);
+                numBits_ += 8;
+                pos_++;
+            }
+        }
+
+        const uint8* data_;
+        size_t size_;
+        size_t pos_;            // of the next byte to load into the cache
+        uint64 cache_;
+        int numBits_;
+    };
+
+
+
+    //--------------------------------------------------------------------
+    // class FlacDecoder
+    //--------------------------------------------------------------------
+
+    FlacDecoder::FlacDecoder() :
+        data_(NULL),
+        size_(0),
+        firstFrame_(0),
+        blockSize_(0),
+        numChannels_(0),
+        bitsPerSample_(0)
+    {}
+
+
+
+    void FlacDecoder::open(const uint8* data, size_t size)
+    {
+        data_ = data;
+        size_ = size;
+        streamInfo_ = StreamInfo();
+        seekPoints_.clear();
+
+        if (size < 8 || memcmp(data, "fLaC", 4) != 0)
+            THROW(std::exception, "No FLAC stream");
+
+        bool hasStreamInfo = false;
+        bool isLast = false;
+        size_t pos = 4;
+
+        while (isLast == false)
+        {
+            if (pos + 4 > size)
+                THROW(std::exception, "FLAC metadata is truncated");
+
+            isLast = (data[pos] & 0x80) != 0;
+            int type = data[pos] & 0x7f;
+            size_t length = (size_t)readBigEndian(data + pos + 1, 3);
+            const uint8* block = data + pos + 4;
+            pos += 4 + length;
+
+            if (pos > size)
+                THROW(std::exception, "FLAC metadata is truncated");
+
+            if (type == 0 && length >= 34)                      // STREAMINFO
+            {
+                uint64 fields = readBigEndian(block + 10, 8);
+                streamInfo_.minBlockSize_  = (int)readBigEndian(block, 2);
+                streamInfo_.maxBlockSize_  = (int)readBigEndian(block + 2, 2);
+                streamInfo_.sampleRate_    = (int)(fields >> 44);
+                streamInfo_.numChannels_   = (int)((fields >> 41) & 7) + 1;
+                streamInfo_.bitsPerSample_ = (int)((fields >> 36) & 31) + 1;
+                streamInfo_.numSamples_    = (int64)(fields & 0xfffffffffULL);
+                hasStreamInfo = true;
+            }
+            else if (type == 3)                                 // SEEKTABLE, offsets are relative to the first frame
+            {
+                for (size_t i = 0; i + 18 <= length; i += 18)
+                {
+                    uint64 sample = readBigEndian(block + i, 8);
+                    if (sample == 0xffffffffffffffffULL)        // placeholder
+                        continue;
+
+                    SeekPoint point;
+                    point.sample_ = (int64)sample;
+                    point.offset_ = (int64)readBigEndian(block + i + 8, 8);
+                    seekPoints_.push_back(point);
+                }
+            }
+        }
+        firstFrame_ = pos;
+
+        if (hasStreamInfo == false)
+            THROW(std::exception, "FLAC stream has no STREAMINFO block");
+        if (streamInfo_.bitsPerSample_ < 4 || streamInfo_.bitsPerSample_ > 24)
+            THROW(std::exception, "%d bit FLAC is not supported", streamInfo_.bitsPerSample_);
+        if (streamInfo_.sampleRate_ == 0)
+            THROW(std::exception, "FLAC stream has no sample rate");
+
+        // Points must be in order and inside the data
+        SeekPointVector points;
+        for (size_t i = 0; i < seekPoints_.size(); ++i)
+        {
+            SeekPoint point = seekPoints_[i];
+            point.offset_ += firstFrame_;
+            if (point.offset_ >= (int64)size_)
+                break;
+            if (points.empty() || (point.sample_ > points.back().sample_ && point.offset_ > points.back().offset_))
+                points.push_back(point);
+        }
+        seekPoints_.swap(points);
+    }
+
+
+
+    void FlacDecoder::attach(const FlacDecoder& other)
+    {
+        data_ = other.data_;
+        size_ = other.size_;
+        firstFrame_ = other.firstFrame_;
+        streamInfo_ = other.streamInfo_;
+        seekPoints_ = other.seekPoints_;
+    }
+
+
+
+    bool FlacDecoder::findFrame(size_t offset, Frame* frame)
+    {
+        for (size_t pos = std::max(offset, firstFrame_); pos + 1 < size_; ++pos)
+        {
+            const uint8* sync = (const uint8*)memchr(data_ + pos, 0xff, size_ - pos - 1);
+            if (sync == NULL)
+                break;
+
+            pos = sync - data_;
+            if ((data_[pos + 1] & 0xfe) == 0xf8 && decodeFrame(pos, frame))
+                return true;
+        }
+        return false;
+    }
+
+
+
+    bool FlacDecoder::decodeFrame(size_t offset, Frame* frame)
+    {
+        ASSERT(data_ != NULL);
+
+        int channelMode = 0;
+        size_t headerSize = readFrameHeader(offset, frame, &channelMode);
+        if (headerSize == 0)
+            return false;
+
+        blockSize_ = frame->numSamples_;
+        numChannels_ = streamInfo_.numChannels_;
+        if (samples_.size() < (size_t)(blockSize_ * numChannels_)) {
+            samples_.resize((size_t)(blockSize_ * numChannels_));
+        }
+
+        BitReader reader(data_ + offset + headerSize, size_ - offset - headerSize);
+        for (int c = 0; c < numChannels_; ++c)
+        {
+            bool isSide = (c == 1 && (channelMode == LeftSide || channelMode == MidSide)) || (c == 0 && channelMode == SideRight);
+            if (readSubframe(reader, bitsPerSample_ + (isSide ? 1 : 0), &samples_[c * blockSize_]) == false)
+                return false;
+        }
+        reader.alignToByte();
+
+        size_t end = offset + headerSize + reader.getBytePos();
+        if (reader.isOverrun() || end + 2 > size_)
+            return false;
+        if (crc16(data_ + offset, end - offset) != (uint16)readBigEndian(data_ + end, 2))
+            return false;
+
+        decorrelate(channelMode);
+        frame->offset_ = offset;
+        frame->size_ = end + 2 - offset;
+        return true;
+    }
+
+
+
+    // Returns the size of the header or 0 if there is no valid header at offset.
+    // Headers that do not match the STREAMINFO are taken as false syncs.
+    //
+    size_t FlacDecoder::readFrameHeader(size_t offset, Frame* frame, int* channelMode)
+    {
+        const size_t maxHeaderSize = 16;
+        if (offset + 6 > size_)
+            return 0;
+
+        const uint8* header = data_ + offset;
+        size_t available = std::min(size_ - offset, maxHeaderSize);
+
+        if (header[0] != 0xff || (header[1] & 0xfe) != 0xf8 || (header[3] & 1) != 0)
+            return 0;
+
+        bool variableBlockSize = (header[1] & 1) != 0;
+        int blockSizeCode = header[2] >> 4;
+        int sampleRateCode = header[2] & 15;
+        int channelCode = header[3] >> 4;
+        int sampleSizeCode = (header[3] >> 1) & 7;
+
+        if (blockSizeCode == 0 || sampleRateCode == 15 || channelCode > MidSide || sampleSizeCode == 3 || sampleSizeCode == 7)
+            return 0;
+
+        // frame or sample number, coded like UTF-8 with up to 7 bytes
+        size_t pos = 4;
+        uint8 lead = header[pos++];
+        uint64 number = lead;
+        int numExtra = 0;
+        while (numExtra < 7 && (lead & (0x80 >> numExtra))) {
+            numExtra++;
+        }
+        if (numExtra == 1 || (numExtra == 7 && lead != 0xfe))
+            return 0;
+        if (numExtra > 0) {
+            numExtra--;
+            number = lead & (0x7f >> (numExtra + 1));
+        }
+        if (pos + numExtra + 5 > available)
+            return 0;
+
+        for (int i = 0; i < numExtra; ++i)
+        {
+            uint8 next = header[pos++];
+            if ((next & 0xc0) != 0x80)
+                return 0;
+            number = (number << 6) | (next & 0x3f);
+        }
+
+        int blockSize;
+        if (blockSizeCode == 1)         blockSize = 192;
+        else if (blockSizeCode <= 5)    blockSize = 576 << (blockSizeCode - 2);
+        else if (blockSizeCode == 6)    blockSize = header[pos++] + 1;
+        else if (blockSizeCode == 7)    { blockSize = (int)readBigEndian(header + pos, 2) + 1; pos += 2; }
+        else                            blockSize = 256 << (blockSizeCode - 8);
+
+        int sampleRate;
+        if (sampleRateCode == 0)        sampleRate = streamInfo_.sampleRate_;
+        else if (sampleRateCode < 12)   sampleRate = sampleRates[sampleRateCode];
+        else if (sampleRateCode == 12)  sampleRate = header[pos++] * 1000;
+        else if (sampleRateCode == 13)  { sampleRate = (int)readBigEndian(header + pos, 2); pos += 2; }
+        else                            { sampleRate = (int)readBigEndian(header + pos, 2) * 10; pos += 2; }
+
+        if (crc8(header, pos) != header[pos])
+            return 0;
+        pos++;
+
+        int numChannels = (channelCode < LeftSide) ? channelCode + 1 : 2;
+        int bitsPerSample = (sampleSizeCode == 0) ? streamInfo_.bitsPerSample_ : sampleSizes[sampleSizeCode];
+
+        if (numChannels != streamInfo_.numChannels_ || bitsPerSample != streamInfo_.bitsPerSample_ || sampleRate != streamInfo_.sampleRate_)
+            return 0;
+        if (streamInfo_.maxBlockSize_ > 0 && blockSize > streamInfo_.maxBlockSize_)
+            return 0;
+
+        int64 sample = (int64)number;
+        if (variableBlockSize == false) {
+            sample *= (streamInfo_.minBlockSize_ > 0) ? streamInfo_.minBlockSize_ : blockSize;
+        }
+
+        frame->sample_ = sample;
+        frame->numSamples_ = blockSize;
+        bitsPerSample_ = bitsPerSample;
+        *channelMode = channelCode;
+        return pos;
+    }
+
+
+
+    bool FlacDecoder::readSubframe(BitReader& reader, int bitsPerSample, int32* output)
+    {
+        if (reader.read(1) != 0)
+            return false;
+
+        int type = (int)reader.read(6);
+        int numWasted = 0;
+        if (reader.read(1))
+        {
+            numWasted = (int)reader.readUnary() + 1;
+            bitsPerSample -= numWasted;
+            if (bitsPerSample <= 0)
+                return false;
+        }
+
+        if (type == 0)                                  // CONSTANT
+        {
+            std::fill(output, output + blockSize_, reader.readSigned(bitsPerSample));
+        }
+        else if (type == 1)                             // VERBATIM
+        {
+            for (int i = 0; i < blockSize_; ++i) {
+                output[i] = reader.readSigned(bitsPerSample);
+            }
+        }
+        else if (type >= 8 && type <= 12)               // FIXED
+        {
+            int order = type - 8;
+            if (order > blockSize_)
+                return false;
+
+            for (int i = 0; i < order; ++i) {
+                output[i] = reader.readSigned(bitsPerSample);
+            }
+            if (readResidual(reader, order, output) == false)
+                return false;
+
+            int32* s = output;
+            switch (order)
+            {
+            case 1: for (int i = 1; i < blockSize_; ++i) s[i] += s[i - 1]; break;
+            case 2: for (int i = 2; i < blockSize_; ++i) s[i] += 2 * s[i - 1] - s[i - 2]; break;
+            case 3: for (int i = 3; i < blockSize_; ++i) s[i] += 3 * (s[i - 1] - s[i - 2]) + s[i - 3]; break;
+            case 4: for (int i = 4; i < blockSize_; ++i) s[i] += 4 * (s[i - 1] + s[i - 3]) - 6 * s[i - 2] - s[i - 4]; break;
+            }
+        }
+        else if (type >= 32)                            // LPC
+        {
+            int order = type - 31;
+            if (order > blockSize_)
+                return false;
+
+            for (int i = 0; i < order; ++i) {
+                output[i] = reader.readSigned(bitsPerSample);
+            }
+            int precision = (int)reader.read(4) + 1;
+            int shift = reader.readSigned(5);
+            if (precision == 16 || shift < 0)
+                return false;
+
+            int32 coefs[32];
+            for (int i = 0; i < order; ++i) {
+                coefs[i] = reader.readSigned(precision);
+            }
+            if (readResidual(reader, order, output) == false)
+                return false;
+
+            // 32 bit sums are enough for most 16 bit streams
+            if (bitsPerSample + precision + getBitLength(order) <= 32)
+            {
+                for (int i = order; i < blockSize_; ++i)
+                {
+                    int32 sum = 0;
+                    for (int j = 0; j < order; ++j) {
+                        sum += coefs[j] * output[i - j - 1];
+                    }
+                    output[i] += sum >> shift;
+                }
+            }
+            else
+            {
+                for (int i = order; i < blockSize_; ++i)
+                {
+                    int64 sum = 0;
+                    for (int j = 0; j < order; ++j) {
+                        sum += (int64)coefs[j] * output[i - j - 1];
+                    }
+                    output[i] += (int32)(sum >> shift);
+                }
+            }
+        }
+        else return false;
+
+        if (numWasted > 0)
+        {
+            for (int i = 0; i < blockSize_; ++i) {
+                output[i] = (int32)((uint32)output[i] << numWasted);
+            }
+        }
+        return reader.isOverrun() == false;
+    }
+
+
+
+    // Reads the Rice coded residual of a predicted subframe behind its warm-up samples.
+    //
+    bool FlacDecoder::readResidual(BitReader& reader, int predictorOrder, int32* output)
+    {
+        int method = (int)reader.read(2);
+        if (method > 1)
+            return false;
+
+        int parameterBits = (method == 0) ? 4 : 5;
+        uint32 escape = (1u << parameterBits) - 1;
+        int partitionOrder = (int)reader.read(4);
+        int partitionSize = blockSize_ >> partitionOrder;
+
+        if ((partitionSize << partitionOrder) != blockSize_ || partitionSize < predictorOrder)
+            return false;
+
+        int32* sample = output + predictorOrder;
+        for (int p = 0; p < (1 << partitionOrder); ++p)
+        {
+            int numSamples = (p == 0) ? partitionSize - predictorOrder : partitionSize;
+            uint32 parameter = reader.read(parameterBits);
+
+            if (parameter == escape)                    // unencoded samples
+            {
+                int numBits = (int)reader.read(5);
+                for (int i = 0; i < numSamples; ++i) {
+                    sample[i] = reader.readSigned(numBits);
+                }
+            }
+            else
+            {
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    uint32 value = (reader.readUnary() << parameter) | reader.read(parameter);
+                    sample[i] = (int32)(value >> 1) ^ -(int32)(value & 1);
+                }
+            }
+            sample += numSamples;
+
+            if (reader.isOverrun())
+                return false;
+        }
+        return true;
+    }
+
+
+
+    void FlacDecoder::decorrelate(int channelMode)
+    {
+        if (channelMode < LeftSide)
+            return;
+
+        int32* first = &samples_[0];
+        int32* second = &samples_[blockSize_];
+
+        switch (channelMode)
+        {
+        case LeftSide:
+            for (int i = 0; i < blockSize_; ++i) {
+                second[i] = first[i] - second[i];
+            }
+            break;
+
+        case SideRight:
+            for (int i = 0; i < blockSize_; ++i) {
+                first[i] += second[i];
+            }
+            break;
+
+        case MidSide:
+            for (int i = 0; i < blockSize_; ++i)
+            {
+                int32 side = second[i];
+                int32 mid = (int32)((uint32)first[i] << 1) | (side & 1);
+                first[i] = (mid + side) >> 1;
+                second[i] = (mid - side) >> 1;
+            }
+            break;
+        }
+    }
+
+
+
+    void FlacDecoder::getSamples(int start, int numSamples, float* output) const
+    {
+        ASSERT(start >= 0 && start + numSamples <= blockSize_);
+
+        float scale = 1.f / (float)(1 << (bitsPerSample_ - 1));
+        for (int c = 0; c < numChannels_; ++c)
+        {
+            const int32* input = &samples_[c * blockSize_ + start];
+            float* out = output + c;
+
+            for (int i = 0; i < numSamples; ++i) {
+                out[i * numChannels_] = input[i] * scale;
+            }
+        }
+    }
+
+} // namespace e3
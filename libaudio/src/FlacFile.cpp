@@ -0,0 +1,351 @@
+
+//--------------------------------------------------------
+// FlacFile.cpp
+//--------------------------------------------------------
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <boost/bind.hpp>
+
+#include <e3_Exception.h>
+
+#include <AudioBuffer.h>
+#include <AudioFormat.h>
+#include <FlacFile.h>
+#include <FormatManager.h>
+
+
+namespace e3 {
+
+    FlacFile::FlacFile() : AudioFile(),
+        numLoadThreads_(0),
+        nextOffset_(0),
+        pendingPos_(0),
+        pendingSize_(0)
+    {}
+
+
+    FlacFile::~FlacFile()
+    {
+        close();
+    }
+
+
+
+    void FlacFile::open(const Path& filename, FileOpenMode mode)
+    {
+        AudioFile::open(filename, mode);
+
+        if (fileOpenMode_ != OpenRead)
+            THROW(std::exception, "Only read mode is supported for FLAC");
+
+        try {
+            mappedFile_.open(filename_.string());
+        }
+        catch (const std::exception& e) {
+            THROW(std::exception, "%s: %s", e.what(), filename_.string().c_str());
+        }
+
+        try {
+            decoder_.open(getMappedData(), mappedFile_.size());
+        }
+        catch (const std::exception& e) {
+            mappedFile_.close();
+            THROW(std::exception, "%s: %s", e.what(), filename_.string().c_str());
+        }
+
+        const FlacDecoder::StreamInfo& info = decoder_.getStreamInfo();
+        sampleRate_ = info.sampleRate_;
+        numChannels_ = info.numChannels_;
+        numFrames_ = (info.numSamples_ > 0) ? info.numSamples_ : countFrames();
+
+        nextOffset_ = decoder_.getFirstFrameOffset();
+        pendingPos_ = pendingSize_ = 0;
+
+        CodecId codec = (info.bitsPerSample_ <= 8) ? CODEC_PCM_S8 : (info.bitsPerSample_ <= 16) ? CODEC_PCM_S16 : CODEC_PCM_S24;
+        format_ = FormatManager::getFormat(FORMAT_FLAC);
+        codec_ = FormatManager::getCodec(codec);
+    }
+
+
+
+    void FlacFile::load(AudioBuffer* buffer)
+    {
+        ASSERT(isReadable());
+
+        size_t numThreads = (numLoadThreads_ > 0) ? numLoadThreads_ : std::max(1u, std::thread::hardware_concurrency());
+        size_t numRanges = std::min(numThreads, (mappedFile_.size() - decoder_.getFirstFrameOffset()) / minBytesPerRange_s);
+        if (numRanges > 1) {
+            loadParallel(buffer, numRanges);
+            return;
+        }
+
+        try {
+            buffer->setSampleRate(sampleRate_);
+            buffer->setNumChannels(numChannels_);
+
+            size_t numSamples = (size_t)(numFrames_ * numChannels_);
+            buffer->resize(numSamples);
+            if (buffer->size() != numSamples)
+                THROW(std::exception, "Out of memory");
+
+            ScopedPin pin(buffer);
+            seek(0);
+            beginOverview();
+            int64_t numDone = 0;
+
+            while (numDone < numFrames_)
+            {
+                int64_t numPending = std::min(progressBlockSize_s, numFrames_ - numDone);
+                int64_t numRead = read(buffer->getHead() + numDone * numChannels_, numPending);
+
+                addToOverview(buffer->getHead() + numDone * numChannels_, numRead);
+                numDone += numRead;
+                reportProgress(numDone);
+                if (numRead < numPending)
+                    break;
+            }
+            if (numDone != numFrames_) {            // damaged file
+                buffer->resize((size_t)(numDone * numChannels_), false);
+                numFrames_ = numDone;
+            }
+            finishOverview();
+        }
+        catch (const std::exception&)
+        {
+            buffer->resize(0);
+            throw;
+        }
+    }
+
+
+
+    // The mapped file is cut into ranges of about the same size that start
+    // at frame boundaries. Every frame carries its sample position, so each
+    // thread decodes its frames directly into their place in the buffer.
+    // Damaged frames stay silent.
+    //
+    void FlacFile::loadParallel(AudioBuffer* buffer, size_t numRanges)
+    {
+        size_t size = mappedFile_.size();
+        size_t firstFrame = decoder_.getFirstFrameOffset();
+
+        std::vector<size_t> starts(1, firstFrame);
+        for (size_t i = 1; i < numRanges; ++i)
+        {
+            size_t start = findRangeStart(firstFrame + (size - firstFrame) * i / numRanges);
+            if (start > starts.back() && start < size)
+                starts.push_back(start);
+        }
+        starts.push_back(size);
+        numRanges = starts.size() - 1;
+
+        runParallelLoad(buffer, numRanges, boost::bind(&FlacFile::decodeRange, this, boost::cref(starts), _1, _2, _3), std::vector<int64_t>());
+    }
+
+
+
+    // Decodes the frames that start inside the range. Each thread has its own
+    // decoder on the shared mapping.
+    //
+    int64_t FlacFile::decodeRange(const std::vector<size_t>& starts, size_t range, float* output, ParallelLoad* load)
+    {
+        size_t endOffset = starts[range + 1];
+        int64_t decodedEnd = 0;
+
+        FlacDecoder decoder;
+        decoder.attach(decoder_);
+        FlacDecoder::Frame frame;
+
+        for (size_t offset = starts[range]; offset < endOffset && load->stop_ == false; )
+        {
+            if (decoder.decodeFrame(offset, &frame) == false)      // damaged frame, go on with the next one
+            {
+                if (decoder.findFrame(offset + 1, &frame) == false || frame.offset_ >= endOffset)
+                    break;
+            }
+            if (frame.sample_ < numFrames_)
+            {
+                int64 numSamples = std::min<int64>(frame.numSamples_, numFrames_ - frame.sample_);
+                decoder.getSamples(0, (int)numSamples, output + frame.sample_ * numChannels_);
+            }
+            offset = frame.offset_ + frame.size_;
+            decodedEnd = frame.sample_ + frame.numSamples_;
+            load->numDone_ += frame.numSamples_;
+        }
+        return decodedEnd;
+    }
+
+
+
+    // Returns the offset of a frame near offset, preferably a seek point.
+    //
+    size_t FlacFile::findRangeStart(size_t offset)
+    {
+        const FlacDecoder::SeekPointVector& points = decoder_.getSeekPoints();
+        size_t start = 0;
+        for (size_t i = 0; i < points.size() && points[i].offset_ <= (int64)offset; ++i) {
+            start = (size_t)points[i].offset_;
+        }
+        if (start > 0 && offset - start < minBytesPerRange_s)
+            return start;
+
+        FlacDecoder decoder;
+        decoder.attach(decoder_);
+        FlacDecoder::Frame frame;
+
+        return decoder.findFrame(offset, &frame) ? frame.offset_ : mappedFile_.size();
+    }
+
+
+
+    int64_t FlacFile::read(float* data, int64_t numFrames)
+    {
+        ASSERT(isReadable());
+
+        int64_t numDone = 0;
+        while (numDone < numFrames)
+        {
+            if (pendingPos_ == pendingSize_ && decodeNextFrame() == false)
+                break;
+
+            int num = (int)std::min<int64_t>(pendingSize_ - pendingPos_, numFrames - numDone);
+            decoder_.getSamples(pendingPos_, num, data + numDone * numChannels_);
+            pendingPos_ += num;
+            numDone += num;
+        }
+        return numDone;
+    }
+
+
+
+    bool FlacFile::decodeNextFrame()
+    {
+        if (nextOffset_ >= mappedFile_.size())
+            return false;
+
+        if (decoder_.decodeFrame(nextOffset_, &frame_) == false && decoder_.findFrame(nextOffset_ + 1, &frame_) == false) {
+            nextOffset_ = mappedFile_.size();
+            return false;
+        }
+        nextOffset_ = frame_.offset_ + frame_.size_;
+        pendingPos_ = 0;
+        pendingSize_ = (int)std::max<int64>(0, std::min<int64>(frame_.numSamples_, numFrames_ - frame_.sample_));
+        return true;
+    }
+
+
+
+    // Starts at the last seek point before the frame and decodes up to it.
+    //
+    int64_t FlacFile::seek(int64_t frame)
+    {
+        ASSERT(isReadable());
+
+        frame = std::max<int64_t>(0, std::min(frame, numFrames_));
+        pendingPos_ = pendingSize_ = 0;
+        nextOffset_ = decoder_.getFirstFrameOffset();
+
+        const FlacDecoder::SeekPointVector& points = decoder_.getSeekPoints();
+        for (size_t i = 0; i < points.size() && points[i].sample_ <= frame; ++i) {
+            nextOffset_ = (size_t)points[i].offset_;
+        }
+
+        while (decodeNextFrame())
+        {
+            if (frame_.sample_ + frame_.numSamples_ > frame)
+            {
+                pendingPos_ = (int)std::max<int64>(0, frame - frame_.sample_);
+                return frame_.sample_ + pendingPos_;
+            }
+        }
+        return numFrames_;
+    }
+
+
+
+    // Every seek point starts a section, seek and read of a section start
+    // right at the point. Without a seek table the file is one section.
+    //
+    void FlacFile::initSections()
+    {
+        sections_.clear();
+        sections_.push_back(Section(0, numFrames_));
+
+        const FlacDecoder::SeekPointVector& points = decoder_.getSeekPoints();
+        for (size_t i = 0; i < points.size() && points[i].sample_ < numFrames_; ++i)
+        {
+            if (points[i].sample_ <= sections_.back().start_)
+                continue;
+            sections_.back().numFrames_ = points[i].sample_ - sections_.back().start_;
+            sections_.push_back(Section(points[i].sample_, numFrames_ - points[i].sample_));
+        }
+    }
+
+
+
+    // Used when STREAMINFO does not know the length. Searches backwards
+    // from the end for a frame, the frames from there on tell the length.
+    //
+    int64_t FlacFile::countFrames()
+    {
+        const size_t blockSize = 65536;
+        size_t firstFrame = decoder_.getFirstFrameOffset();
+        FlacDecoder::Frame frame;
+
+        for (size_t start = mappedFile_.size(); start > firstFrame; )
+        {
+            start = (start - firstFrame > blockSize) ? start - blockSize : firstFrame;
+            if (decoder_.findFrame(start, &frame))
+            {
+                int64_t end = frame.sample_ + frame.numSamples_;
+                while (decoder_.decodeFrame(frame.offset_ + frame.size_, &frame)) {
+                    end = frame.sample_ + frame.numSamples_;
+                }
+                return end;
+            }
+        }
+        return 0;
+    }
+
+
+
+    void FlacFile::close()
+    {
+        if (mappedFile_.is_open()) {
+            mappedFile_.close();
+        }
+        nextOffset_ = 0;
+        pendingPos_ = pendingSize_ = 0;
+    }
+
+
+
+    //-----------------------------------------------------------
+    // Static members
+    //-----------------------------------------------------------
+
+    bool FlacFile::isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate, int numChannels)
+    {
+        return format.id_ == FORMAT_FLAC && (codec.id_ == CODEC_PCM_S8 || codec.id_ == CODEC_PCM_S16 || codec.id_ == CODEC_PCM_S24);
+    }
+
+
+
+    void FlacFile::initFormatInfos(FormatInfoVector& infos)
+    {
+        infos.push_back(FormatInfo(FORMAT_FLAC, -1, "FLAC", "flac", "FLAC lossless file format"));
+    }
+
+
+
+    void FlacFile::initCodecInfos(CodecInfoVector& infos)
+    {
+        infos.push_back(CodecInfo(CODEC_PCM_S8, -1, "PCM_S8", "Signed 8 bit PCM"));
+        infos.push_back(CodecInfo(CODEC_PCM_S16, -1, "PCM_S16", "Signed 16 bit PCM"));
+        infos.push_back(CodecInfo(CODEC_PCM_S24, -1, "PCM_S24", "Signed 24 bit PCM"));
+    }
+
+} // namespace e3
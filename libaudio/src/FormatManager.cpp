@@ -1,13 +1,18 @@
-
 //--------------------------------------------------------
 // FormatManager.cpp
 //--------------------------------------------------------
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/bind.hpp>
 
 #include <e3_CommonMacros.h>
 #include <e3_Exception.h>
 
+#include <FlacFile.h>
 #include <FormatManager.h>
 #include <MultiFormatAudioFile.h>
 #include <MpegFile.h>
@@ -15,119 +20,411 @@
 
 namespace e3 {
 
+    namespace {
+
+        // Magic bytes at the start of a file, optionally followed by a second
+        // magic at another offset, e.g. the form type of RIFF and IFF files.
+        //
+        struct Signature
+        {
+            size_t offset_;
+            const char* magic_;
+            size_t offset2_;
+            const char* magic2_;
+            FormatId format_;
+        };
+
+        const Signature signatures[] =
+        {
+            { 0, "RIFF",  8, "WAVE", FORMAT_WAV },
+            { 0, "RIFX",  8, "WAVE", FORMAT_WAV },
+            { 0, "RF64",  8, "WAVE", FORMAT_RF64 },
+            { 0, "riff", 24, "wave", FORMAT_W64 },
+            { 0, "FORM",  8, "AIFF", FORMAT_AIFF },
+            { 0, "FORM",  8, "AIFC", FORMAT_AIFF },
+            { 0, "FORM",  8, "8SVX", FORMAT_SVX },
+            { 0, "FORM",  8, "16SV", FORMAT_SVX },
+            { 0, "fLaC",  0, NULL,   FORMAT_FLAC },
+            { 0, "OggS",  0, NULL,   FORMAT_OGG },
+            { 0, "caff",  0, NULL,   FORMAT_CAF },
+            { 0, ".snd",  0, NULL,   FORMAT_AU },
+            { 0, "dns.",  0, NULL,   FORMAT_AU },
+            { 0, "2BIT",  0, NULL,   FORMAT_AVR },
+            { 0, "NIST_1A", 0, NULL, FORMAT_NIST },
+            { 0, "MATLAB 5.0", 0, NULL, FORMAT_MAT5 },
+            { 0, "Creative Voice File", 0, NULL, FORMAT_VOC },
+            { 0, "Extended Instrument:", 0, NULL, FORMAT_XI },
+        };
+
+        const size_t maxSignatureLength = 32;
+
+        // Common extensions that are not the default extension of a format
+        //
+        struct Extension
+        {
+            const char* extension_;
+            FormatId format_;
+        };
+
+        const Extension extensions[] =
+        {
+            { "mp1",  FORMAT_MPEG },
+            { "mp2",  FORMAT_MPEG },
+            { "mpga", FORMAT_MPEG },
+            { "aif",  FORMAT_AIFF },
+            { "aifc", FORMAT_AIFF },
+            { "ogg",  FORMAT_OGG },
+        };
+
+        bool matches(const unsigned char* data, size_t length, size_t offset, const char* magic)
+        {
+            size_t size = strlen(magic);
+            return offset + size <= length && memcmp(data + offset, magic, size) == 0;
+        }
+
+        // Size of an ID3v2 tag at the start of the data including its header
+        // and footer, 0 if there is none. The tag is not part of the audio
+        // format, ID3 tagged WAV, AIFF and FLAC files exist as well as MP3s.
+        //
+        size_t getId3TagSize(const unsigned char* data, size_t length)
+        {
+            const size_t headerSize = 10;
+            if (!matches(data, length, 0, "ID3") || length < headerSize)
+                return 0;
+            if (data[3] == 0xff || data[4] == 0xff)
+                return 0;
+            if ((data[6] | data[7] | data[8] | data[9]) & 0x80)      // synchsafe, 7 bits per byte
+                return 0;
+
+            size_t size = ((size_t)data[6] << 21) | ((size_t)data[7] << 14) | ((size_t)data[8] << 7) | data[9];
+            size += headerSize;
+            if (data[5] & 0x10)                                         // footer present
+                size += headerSize;
+            return size;
+        }
+
+    } // namespace
+
+
+
+    std::vector<AudioBackendPtr> FormatManager::backends_;
     FormatInfoVector FormatManager::formatInfos_;
     CodecInfoVector FormatManager::codecInfos_;
 
-    FormatManager::Initializer FormatManager::initializer_s;
+    std::vector<int> FormatManager::formatIndex_;
+    std::vector<int> FormatManager::codecIndex_;
+    FormatManager::IdIndexMap FormatManager::formatPrivateIndex_;
+    FormatManager::IdIndexMap FormatManager::codecPrivateIndex_;
+    FormatManager::NameIndexMap FormatManager::formatNameIndex_;
+    FormatManager::NameIndexMap FormatManager::codecNameIndex_;
+    std::unordered_map<std::string, FormatId> FormatManager::extensions_;
+
+    std::once_flag FormatManager::initFlag_s;
 
-    FormatManager::Initializer::Initializer()
+    void FormatManager::initialize()
     {
         formatInfos_.reserve(FORMAT_COUNT);
         codecInfos_.reserve(CODEC_COUNT);
 
-        MultiFormatAudioFile::initFormatInfos(formatInfos_);
-        MultiFormatAudioFile::initCodecInfos(codecInfos_);
+        addBackend(AudioBackendPtr(new SndfileBackend()));
+        addBackend(AudioBackendPtr(new MpegBackend()));
+        addBackend(AudioBackendPtr(new FlacBackend()));
+    }
+
+
+
+    void FormatManager::registerBackend(const AudioBackendPtr& backend)
+    {
+        init();
+        addBackend(backend);
+    }
+
+
 
-        MpegFile::initFormatInfos(formatInfos_);
-        MpegFile::initCodecInfos(codecInfos_);
+    // The infos of the formats and codecs it added are kept, so
+    // references to them stay valid.
+    //
+    void FormatManager::unregisterBackend(const AudioBackendPtr& backend)
+    {
+        init();
+        backends_.erase(std::remove(backends_.begin(), backends_.end(), backend), backends_.end());
     }
 
 
 
-    AudioFilePtr FormatManager::createFile(const Path& filename)
+    // Formats and codecs already known from another backend are not added again,
+    // so the infos of the first backend stay valid.
+    //
+    void FormatManager::addBackend(const AudioBackendPtr& backend)
     {
-        if (filename.extension().string() == ".mp3") {                          // TODO: put this information to FormatInfo
-            return MpegFilePtr(new MpegFile());
+        ASSERT(backend);
+
+        std::vector<AudioBackendPtr>::iterator it = backends_.begin();
+        while (it != backends_.end() && (*it)->getPriority() >= backend->getPriority()) {
+            ++it;
         }
-        else {
-            return MultiFormatAudioFilePtr(new MultiFormatAudioFile());
+        backends_.insert(it, backend);
+
+        FormatInfoVector formats;
+        backend->initFormatInfos(formats);
+        for (size_t i = 0; i < formats.size(); ++i) {
+            if (std::find_if(formatInfos_.begin(), formatInfos_.end(), boost::bind(&FormatInfo::id_, _1) == formats[i].id_) == formatInfos_.end())
+                formatInfos_.push_back(formats[i]);
+        }
+
+        CodecInfoVector codecs;
+        backend->initCodecInfos(codecs);
+        for (size_t i = 0; i < codecs.size(); ++i) {
+            if (std::find_if(codecInfos_.begin(), codecInfos_.end(), boost::bind(&CodecInfo::id_, _1) == codecs[i].id_) == codecInfos_.end())
+                codecInfos_.push_back(codecs[i]);
         }
+
+        buildIndices();
     }
 
 
 
+    AudioBackendPtr FormatManager::findBackend(FormatId format, unsigned features)
+    {
+        init();
+        for (size_t i = 0; i < backends_.size(); ++i)
+        {
+            if (backends_[i]->canRead(format) && backends_[i]->hasFeatures(features))
+                return backends_[i];
+        }
+        return AudioBackendPtr();
+    }
+
 
-    const FormatInfo& FormatManager::getFormat(FormatId id)
+
+    // Several infos may share an id or name, the first one is found,
+    // as before with a linear search.
+    //
+    void FormatManager::buildIndices()
     {
-        FormatInfoVector::iterator it =
-            std::find_if(formatInfos_.begin(), formatInfos_.end(), boost::bind(&FormatInfo::id_, _1) == id);
+        formatIndex_.assign(FORMAT_COUNT, -1);
+        codecIndex_.assign(CODEC_COUNT, -1);
+        formatPrivateIndex_.clear();
+        codecPrivateIndex_.clear();
+        formatNameIndex_.clear();
+        codecNameIndex_.clear();
+        extensions_.clear();
+
+        for (size_t i = 0; i < formatInfos_.size(); ++i)
+        {
+            const FormatInfo& info = formatInfos_[i];
+            if (formatIndex_[info.id_] < 0)
+                formatIndex_[info.id_] = (int)i;
+
+            formatPrivateIndex_.insert(std::make_pair(info.idPrivate_, (int)i));
+            formatNameIndex_.insert(std::make_pair(info.name_, (int)i));
+            if (info.extension_.empty() == false)
+                extensions_.insert(std::make_pair(boost::algorithm::to_lower_copy(info.extension_), info.id_));
+        }
+        for (size_t i = 0; i < codecInfos_.size(); ++i)
+        {
+            const CodecInfo& info = codecInfos_[i];
+            if (codecIndex_[info.id_] < 0)
+                codecIndex_[info.id_] = (int)i;
+
+            codecPrivateIndex_.insert(std::make_pair(info.idPrivate_, (int)i));
+            codecNameIndex_.insert(std::make_pair(info.name_, (int)i));
+        }
+
+        for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+            extensions_.insert(std::make_pair(std::string(extensions[i].extension_), extensions[i].format_));
+        }
+    }
+
+
+
+    AudioFilePtr FormatManager::createFile(const Path& filename, AudioFile::FileOpenMode mode, unsigned features)
+    {
+        // A file opened for writing is replaced, its extension names the format
+        FormatId format = (mode == AudioFile::OpenWrite) ? getFormatFromExtension(filename) : detectFormat(filename);
+        if (mode != AudioFile::OpenRead) {
+            features |= AudioBackend::FeatureWrite;
+        }
 
-        if (it == formatInfos_.end())
+        AudioBackendPtr backend = findBackend(format, features);
+        if (!backend)
+            THROW(std::exception, "No backend for format %d with features 0x%x: %s", format, features, filename.string().c_str());
+
+        return backend->createFile();
+    }
+
+
+
+    FormatId FormatManager::detectFormat(const Path& filename)
+    {
+        FormatId extensionFormat = getFormatFromExtension(filename);
+
+        unsigned char data[maxSignatureLength];
+        size_t length = 0;
+        size_t tagSize = 0;
+
+        FILE* handle = fopen(filename.string().c_str(), "rb");
+        if (handle != NULL)
+        {
+            length = fread(data, 1, sizeof(data), handle);
+
+            // Sniff the bytes behind an ID3v2 tag
+            tagSize = getId3TagSize(data, length);
+            if (tagSize > 0) {
+                length = (fseek(handle, (long)tagSize, SEEK_SET) == 0) ? fread(data, 1, sizeof(data), handle) : 0;
+            }
+            fclose(handle);
+        }
+
+        FormatId format = detectFormat(data, length);
+        if (format != FORMAT_UNKNOWN)
+            return format;
+
+        // A bare MPEG frame header is a weak signature, trust it only
+        // when the extension does not name another format.
+        if ((extensionFormat == FORMAT_UNKNOWN || extensionFormat == FORMAT_MPEG) && isMpegFrameHeader(data, length))
+            return FORMAT_MPEG;
+
+        // ID3v2 tags are mostly found in MP3s
+        if (extensionFormat == FORMAT_UNKNOWN && tagSize > 0)
+            return FORMAT_MPEG;
+
+        return extensionFormat;
+    }
+
+
+
+    FormatId FormatManager::detectFormat(const unsigned char* data, size_t length)
+    {
+        for (size_t i = 0; i < sizeof(signatures) / sizeof(signatures[0]); ++i)
+        {
+            const Signature& signature = signatures[i];
+
+            if (matches(data, length, signature.offset_, signature.magic_) &&
+                (signature.magic2_ == NULL || matches(data, length, signature.offset2_, signature.magic2_)))
+            {
+                return signature.format_;
+            }
+        }
+
+        size_t tagSize = getId3TagSize(data, length);
+        if (tagSize > 0 && tagSize < length)
+        {
+            FormatId format = detectFormat(data + tagSize, length - tagSize);
+            if (format == FORMAT_UNKNOWN && isMpegFrameHeader(data + tagSize, length - tagSize))
+                format = FORMAT_MPEG;
+            return format;
+        }
+        return FORMAT_UNKNOWN;
+    }
+
+
+
+    FormatId FormatManager::getFormatFromExtension(const Path& filename)
+    {
+        init();
+        std::string extension = boost::algorithm::to_lower_copy(filename.extension().string());
+        if (extension.empty())
+            return FORMAT_UNKNOWN;
+
+        std::unordered_map<std::string, FormatId>::const_iterator it = extensions_.find(extension.substr(1));
+        return (it != extensions_.end()) ? it->second : FORMAT_UNKNOWN;
+    }
+
+
+
+    // Frame sync, valid layer, bitrate and sample rate
+    //
+    bool FormatManager::isMpegFrameHeader(const unsigned char* data, size_t length)
+    {
+        return length >= 4 &&
+            data[0] == 0xff && (data[1] & 0xe0) == 0xe0 &&
+            (data[1] & 0x06) != 0 &&
+            (data[2] & 0xf0) != 0xf0 &&
+            (data[2] & 0x0c) != 0x0c;
+    }
+
+
+
+    const FormatInfo& FormatManager::getFormat(FormatId id)
+    {
+        init();
+        if (id < 0 || id >= (int)formatIndex_.size() || formatIndex_[id] < 0)
             THROW(std::exception, "Unknown format: %d", id);
 
-        return *it;
+        return formatInfos_[formatIndex_[id]];
     }
 
 
     const FormatInfo& FormatManager::getFormat(int idPrivate)
     {
-        FormatInfoVector::iterator it =
-            std::find_if(formatInfos_.begin(), formatInfos_.end(), boost::bind(&FormatInfo::idPrivate_, _1) == idPrivate);
+        init();
+        IdIndexMap::const_iterator it = formatPrivateIndex_.find(idPrivate);
 
-        if (it == formatInfos_.end())
+        if (it == formatPrivateIndex_.end())
             THROW(std::exception, "Unknown format: %d", idPrivate);
 
-        return *it;
+        return formatInfos_[it->second];
     }
 
 
 
     const FormatInfo& FormatManager::getFormat(const std::string& name)
     {
-        FormatInfoVector::iterator it =
-            std::find_if(formatInfos_.begin(), formatInfos_.end(), boost::bind(&FormatInfo::name_, _1) == name);
+        init();
+        NameIndexMap::const_iterator it = formatNameIndex_.find(name);
 
-        if (it == formatInfos_.end())
+        if (it == formatNameIndex_.end())
             THROW(std::exception, "Unknown format: %s", name.c_str());
 
-        return *it;
+        return formatInfos_[it->second];
     }
 
     const CodecInfo& FormatManager::getCodec(CodecId id)
     {
-        CodecInfoVector::iterator it =
-            std::find_if(codecInfos_.begin(), codecInfos_.end(), boost::bind(&CodecInfo::id_, _1) == id);
-
-        if (it == codecInfos_.end())
+        init();
+        if (id < 0 || id >= (int)codecIndex_.size() || codecIndex_[id] < 0)
             THROW(std::exception, "Unknown codec: %d", id);
 
-        return *it;
+        return codecInfos_[codecIndex_[id]];
     }
 
 
     const CodecInfo& FormatManager::getCodec(int idPrivate)
     {
-        CodecInfoVector::iterator it =
-            std::find_if(codecInfos_.begin(), codecInfos_.end(), boost::bind(&CodecInfo::idPrivate_, _1) == idPrivate);
+        init();
+        IdIndexMap::const_iterator it = codecPrivateIndex_.find(idPrivate);
 
-        if (it == codecInfos_.end())
+        if (it == codecPrivateIndex_.end())
             THROW(std::exception, "Unknown codec: %d", idPrivate);
 
-        return *it;
+        return codecInfos_[it->second];
     }
 
 
 
     const CodecInfo& FormatManager::getCodec(const std::string& name)
     {
-        CodecInfoVector::iterator it =
-            std::find_if(codecInfos_.begin(), codecInfos_.end(), boost::bind(&CodecInfo::name_, _1) == name);
+        init();
+        NameIndexMap::const_iterator it = codecNameIndex_.find(name);
 
-        if (it == codecInfos_.end())
+        if (it == codecNameIndex_.end())
             THROW(std::exception, "Unknown codec: %s", name.c_str());
 
-        return *it;
+        return codecInfos_[it->second];
     }
 
 
 
     bool FormatManager::isSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate, int numChannels)
     {
-        bool result = false;
-        result |= MultiFormatAudioFile::isFormatSupported(format, codec, sampleRate, numChannels);
-        result |= MpegFile::isFormatSupported(format, codec, sampleRate, numChannels);
-
-        return result;
+        init();
+        for (size_t i = 0; i < backends_.size(); ++i)
+        {
+            if (backends_[i]->isFormatSupported(format, codec, sampleRate, numChannels))
+                return true;
+        }
+        return false;
     }
 
-} // namespace e3
\ No newline at end of file
+} // namespace e3
@@ -0,0 +1,84 @@
+//------------------------------------------------------------
+// HalfAudioBuffer.cpp
+// Audio buffer with half precision (float16) sample storage
+//------------------------------------------------------------
+
+#include <algorithm>
+
+#include <e3_Exception.h>
+
+#include <AudioBuffer.h>
+#include <HalfAudioBuffer.h>
+#include <SampleConversion.h>
+
+
+namespace e3 {
+
+    HalfAudioBuffer::HalfAudioBuffer(int numChannels) :
+        Buffer(),
+        sampleRate_(0),
+        numChannels_(numChannels),
+        numFrames_(0)
+    {}
+
+
+
+    uint16* HalfAudioBuffer::resize(size_t size)
+    {
+        uint16* result = Buffer::resize(size);
+
+        numFrames_ = (numChannels_ > 0 && data_) ? size / numChannels_ : 0;
+        return result;
+    }
+
+
+
+    void HalfAudioBuffer::fromFloat(const AudioBuffer& source)
+    {
+        sampleRate_ = source.getSampleRate();
+        numChannels_ = source.getNumChannels();
+
+        clear();
+        resize(source.size());
+        if (size_ != source.size())
+            THROW(std::exception, "Not enough memory to convert buffer");
+
+        ScopedPin pin(&source);
+        convertFloatToHalf(source.getHead(), data_, size_);
+    }
+
+
+
+    void HalfAudioBuffer::toFloat(AudioBuffer* target) const
+    {
+        ASSERT(target);
+
+        target->setSampleRate(sampleRate_);
+        target->setNumChannels(numChannels_);
+        target->resize(size_);
+        if (target->size() != size_)
+            THROW(std::exception, "Not enough memory to convert buffer");
+
+        ScopedPin pin(target);
+        convertHalfToFloat(data_, target->getHead(), size_);
+    }
+
+
+
+    int64 HalfAudioBuffer::read(int64 frame, float* output, int64 numFrames) const
+    {
+        numFrames = std::max<int64>(0, std::min(numFrames, numFrames_ - frame));
+        convertHalfToFloat(data_ + frame * numChannels_, output, (size_t)(numFrames * numChannels_));
+
+        return numFrames;
+    }
+
+
+
+    void HalfAudioBuffer::write(int64 frame, const float* input, int64 numFrames)
+    {
+        ASSERT(frame + numFrames <= numFrames_);
+        convertFloatToHalf(input, data_ + frame * numChannels_, (size_t)(numFrames * numChannels_));
+    }
+
+} // namespace e3
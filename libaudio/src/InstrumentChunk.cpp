@@ -7,17 +7,44 @@
 
 namespace e3 {
 
+    namespace {
+
+        struct LoopModeName
+        {
+            InstrumentChunk::LoopMode mode_;
+            const char* name_;
+        };
+
+        const LoopModeName loopModeNames[] =
+        {
+            { InstrumentChunk::LoopNone,        "NONE" },
+            { InstrumentChunk::LoopForward,     "FORWARD" },
+            { InstrumentChunk::LoopBackward,    "BACKWARD" },
+            { InstrumentChunk::LoopAlternating, "ALTERNATING" },
+        };
+
+    } // namespace
+
+
     InstrumentChunk::LoopModeInfo InstrumentChunk::loopModeInfo_s;
+    std::once_flag InstrumentChunk::initFlag_s;
+
+
+    // The names are set up on first use, not at static initialization.
+    //
+    InstrumentChunk::LoopModeInfo& InstrumentChunk::getLoopModeInfo()
+    {
+        std::call_once(initFlag_s, &InstrumentChunk::initLoopModeInfo);
+        return loopModeInfo_s;
+    }
 
-    InstrumentChunk::Initializer InstrumentChunk::initializer_s;
 
 
-    InstrumentChunk::Initializer::Initializer()
+    void InstrumentChunk::initLoopModeInfo()
     {
-        loopModeInfo_s.add(LoopNone, "NONE");
-        loopModeInfo_s.add(LoopForward, "FORWARD");
-        loopModeInfo_s.add(LoopBackward, "BACKWARD");
-        loopModeInfo_s.add(LoopAlternating, "ALTERNATING");
+        for (size_t i = 0; i < sizeof(loopModeNames) / sizeof(loopModeNames[0]); ++i) {
+            loopModeInfo_s.add(loopModeNames[i].mode_, loopModeNames[i].name_);
+        }
     }
 
 
@@ -0,0 +1,506 @@
+//------------------------------------------------------------
+// InstrumentChunkWriter.cpp
+// Updates the instrument chunks of WAV and AIFF files in place
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include <e3_Exception.h>
+
+#include <InstrumentChunkWriter.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        uint32 makeId(const char* id)
+        {
+            return ((uint8)id[0] << 24) | ((uint8)id[1] << 16) | ((uint8)id[2] << 8) | (uint8)id[3];
+        }
+
+        const uint32 riffId = makeId("RIFF");
+        const uint32 rifxId = makeId("RIFX");
+        const uint32 waveId = makeId("WAVE");
+        const uint32 formId = makeId("FORM");
+        const uint32 aiffId = makeId("AIFF");
+        const uint32 aifcId = makeId("AIFC");
+        const uint32 fmtId  = makeId("fmt ");
+        const uint32 smplId = makeId("smpl");
+        const uint32 instId = makeId("inst");
+        const uint32 junkId = makeId("JUNK");
+        const uint32 aiffInstId = makeId("INST");
+        const uint32 markId = makeId("MARK");
+        const uint32 fllrId = makeId("FLLR");
+
+        const size_t smplHeaderSize = 36;
+        const size_t smplLoopSize = 24;
+        const size_t aiffInstSize = 20;
+
+        int clamp(int value, int low, int high)
+        {
+            return std::max(low, std::min(value, high));
+        }
+
+        //--------------------------------------------------------------------
+        // A RIFF or IFF file opened for update. Chunks are replaced or
+        // appended, finish() writes the new size of the file into the header.
+        //--------------------------------------------------------------------
+
+        class ChunkFile
+        {
+        public:
+            struct Chunk
+            {
+                uint32 id_;
+                int64 offset_;          // of the chunk header
+                uint32 size_;
+            };
+            typedef std::vector<uint8> Data;
+
+            ChunkFile();
+            ~ChunkFile();
+
+            void open(const Path& filename);
+            bool isAiff() const                             { return isAiff_; }
+            Chunk* find(uint32 id);
+            Data read(const Chunk* chunk);
+            void replace(uint32 id, const Data& data);
+            void finish();
+
+            uint32 get16(const uint8* data) const           { return bigEndian_ ? (data[0] << 8) | data[1] : (data[1] << 8) | data[0]; }
+            uint32 get32(const uint8* data) const           { return bigEndian_ ? (get16(data) << 16) | get16(data + 2) : (get16(data + 2) << 16) | get16(data); }
+            void append16(Data& data, uint32 value) const;
+            void append32(Data& data, uint32 value) const;
+
+        private:
+            void writeChunk(int64 offset, uint32 id, const Data& data);
+            void writeFiller(int64 offset, uint32 size);
+            void writeAt(int64 offset, const void* data, size_t size);
+
+            Path filename_;
+            FILE* handle_;
+            bool bigEndian_;
+            bool isAiff_;
+            int64 end_;
+            std::vector<Chunk> chunks_;
+        };
+
+
+
+        ChunkFile::ChunkFile() :
+            handle_(NULL),
+            bigEndian_(false),
+            isAiff_(false),
+            end_(0)
+        {}
+
+
+
+        ChunkFile::~ChunkFile()
+        {
+            if (handle_) {
+                fclose(handle_);
+            }
+        }
+
+
+
+        void ChunkFile::open(const Path& filename)
+        {
+            filename_ = filename;
+            handle_ = fopen(filename_.string().c_str(), "r+b");
+            if (handle_ == NULL)
+                THROW(std::exception, "%s: %s", strerror(errno), filename_.string().c_str());
+
+            uint8 header[12];
+            uint32 type = 0;
+            uint32 form = 0;
+            if (fread(header, 1, sizeof(header), handle_) == sizeof(header)) {
+                type = makeId((const char*)header);
+                form = makeId((const char*)header + 8);
+            }
+
+            if ((type == riffId || type == rifxId) && form == waveId) {
+                bigEndian_ = type == rifxId;
+            }
+            else if (type == formId && (form == aiffId || form == aifcId)) {
+                bigEndian_ = isAiff_ = true;
+            }
+            else THROW(std::exception, "Instrument chunks can only be updated in WAV and AIFF files: %s", filename_.string().c_str());
+
+            _fseeki64(handle_, 0, SEEK_END);
+            int64 fileSize = _ftelli64(handle_);
+            int64 formEnd = 8 + (int64)get32(header + 4);
+            if (formEnd < fileSize - 1)
+                THROW(std::exception, "File has data behind the %s chunk: %s", isAiff_ ? "FORM" : "RIFF", filename_.string().c_str());
+
+            // The last chunk may lack its pad byte
+            int64 pos = 12;
+            while (pos + 8 <= std::min(formEnd, fileSize))
+            {
+                uint8 chunkHeader[8];
+                _fseeki64(handle_, pos, SEEK_SET);
+                if (fread(chunkHeader, 1, sizeof(chunkHeader), handle_) != sizeof(chunkHeader))
+                    break;
+
+                Chunk chunk;
+                chunk.id_ = makeId((const char*)chunkHeader);
+                chunk.offset_ = pos;
+                chunk.size_ = get32(chunkHeader + 4);
+                chunks_.push_back(chunk);
+
+                pos += 8 + (((int64)chunk.size_ + 1) & ~1LL);
+            }
+            if (pos > fileSize + 1)
+                THROW(std::exception, "File is truncated: %s", filename_.string().c_str());
+            end_ = pos;
+        }
+
+
+
+        ChunkFile::Chunk* ChunkFile::find(uint32 id)
+        {
+            for (size_t i = 0; i < chunks_.size(); ++i)
+            {
+                if (chunks_[i].id_ == id)
+                    return &chunks_[i];
+            }
+            return NULL;
+        }
+
+
+
+        ChunkFile::Data ChunkFile::read(const Chunk* chunk)
+        {
+            Data data;
+            if (chunk == NULL)
+                return data;
+
+            data.resize(chunk->size_);
+            _fseeki64(handle_, chunk->offset_ + 8, SEEK_SET);
+            if (data.empty() == false && fread(&data[0], 1, data.size(), handle_) != data.size())
+                THROW(std::exception, "Error reading chunk: %s", filename_.string().c_str());
+
+            return data;
+        }
+
+
+
+        // The samples are never moved: a chunk in front of the sample data
+        // can only be overwritten with one that is not larger.
+        //
+        void ChunkFile::replace(uint32 id, const Data& data)
+        {
+            uint32 size = (uint32)((data.size() + 1) & ~1u);
+            Chunk* old = find(id);
+
+            if (old != NULL)
+            {
+                uint32 oldSize = (old->size_ + 1) & ~1u;
+                bool isLast = old->offset_ + 8 + oldSize >= end_;
+
+                if (size == oldSize || size + 8 <= oldSize || (isLast && size > oldSize))
+                {
+                    writeChunk(old->offset_, id, data);
+                    old->size_ = (uint32)data.size();
+
+                    if (isLast && size > oldSize) {
+                        end_ = old->offset_ + 8 + size;
+                    }
+                    else if (size != oldSize)
+                    {
+                        Chunk filler;
+                        filler.id_ = isAiff_ ? fllrId : junkId;
+                        filler.offset_ = old->offset_ + 8 + size;
+                        filler.size_ = oldSize - size - 8;
+                        writeFiller(filler.offset_, filler.size_);
+                        chunks_.push_back(filler);
+                    }
+                    return;
+                }
+
+                old->id_ = isAiff_ ? fllrId : junkId;
+                writeAt(old->offset_, isAiff_ ? "FLLR" : "JUNK", 4);
+            }
+
+            Chunk chunk;
+            chunk.id_ = id;
+            chunk.offset_ = end_;
+            chunk.size_ = (uint32)data.size();
+            writeChunk(chunk.offset_, id, data);
+            chunks_.push_back(chunk);
+            end_ += 8 + size;
+        }
+
+
+
+        void ChunkFile::finish()
+        {
+            if (end_ - 8 > 0xffffffffLL)
+                THROW(std::exception, "File gets too large: %s", filename_.string().c_str());
+
+            Data size;
+            append32(size, (uint32)(end_ - 8));
+            writeAt(4, &size[0], size.size());
+
+            int result = fclose(handle_);
+            handle_ = NULL;
+            if (result != 0)
+                THROW(std::exception, "%s: %s", strerror(errno), filename_.string().c_str());
+        }
+
+
+
+        void ChunkFile::writeChunk(int64 offset, uint32 id, const Data& data)
+        {
+            Data chunk;
+            append32(chunk, 0);
+            append32(chunk, (uint32)data.size());
+            chunk[0] = (uint8)(id >> 24); chunk[1] = (uint8)(id >> 16); chunk[2] = (uint8)(id >> 8); chunk[3] = (uint8)id;
+            chunk.insert(chunk.end(), data.begin(), data.end());
+            if (data.size() & 1) {
+                chunk.push_back(0);
+            }
+            writeAt(offset, &chunk[0], chunk.size());
+        }
+
+
+
+        void ChunkFile::writeFiller(int64 offset, uint32 size)
+        {
+            Data filler(size);
+            writeChunk(offset, isAiff_ ? fllrId : junkId, filler);
+        }
+
+
+
+        void ChunkFile::writeAt(int64 offset, const void* data, size_t size)
+        {
+            if (_fseeki64(handle_, offset, SEEK_SET) != 0 || fwrite(data, 1, size, handle_) != size)
+                THROW(std::exception, "%s: %s", strerror(errno), filename_.string().c_str());
+        }
+
+
+
+        void ChunkFile::append16(Data& data, uint32 value) const
+        {
+            uint8 bytes[2] = { (uint8)(value >> 8), (uint8)value };
+            if (bigEndian_ == false)
+                std::swap(bytes[0], bytes[1]);
+            data.insert(data.end(), bytes, bytes + 2);
+        }
+
+
+
+        void ChunkFile::append32(Data& data, uint32 value) const
+        {
+            if (bigEndian_) {
+                append16(data, value >> 16);
+                append16(data, value);
+            }
+            else {
+                append16(data, value);
+                append16(data, value >> 16);
+            }
+        }
+
+
+
+        //--------------------------------------------------------------------
+        // WAV: smpl and inst chunks as written by libsndfile. The loop end
+        // in the smpl chunk is inclusive. Manufacturer, SMPTE and sampler
+        // specific data of an existing smpl chunk are kept.
+        //--------------------------------------------------------------------
+
+        void writeWav(ChunkFile& file, const InstrumentChunk& chunk, const Path& filename)
+        {
+            ChunkFile::Data format = file.read(file.find(fmtId));
+            if (format.size() < 8)
+                THROW(std::exception, "WAV file has no fmt chunk: %s", filename.string().c_str());
+            uint32 sampleRate = file.get32(&format[4]);
+
+            ChunkFile::Data old = file.read(file.find(smplId));
+            uint32 manufacturer = 0, product = 0, smpteFormat = 0, smpteOffset = 0;
+            ChunkFile::Data samplerData;
+            if (old.size() >= smplHeaderSize)
+            {
+                manufacturer = file.get32(&old[0]);
+                product = file.get32(&old[4]);
+                smpteFormat = file.get32(&old[20]);
+                smpteOffset = file.get32(&old[24]);
+
+                size_t begin = smplHeaderSize + file.get32(&old[28]) * smplLoopSize;
+                size_t size = file.get32(&old[32]);
+                if (begin + size <= old.size()) {
+                    samplerData.assign(old.begin() + begin, old.begin() + begin + size);
+                }
+            }
+
+            // The pitch fraction can only raise the unity note
+            int unityNote = chunk.getBaseNote();
+            int detune = clamp(chunk.getDetune(), -99, 99);
+            if (detune < 0) {
+                unityNote--;
+                detune += 100;
+            }
+
+            ChunkFile::Data smpl;
+            file.append32(smpl, manufacturer);
+            file.append32(smpl, product);
+            file.append32(smpl, sampleRate > 0 ? 1000000000 / sampleRate : 0);
+            file.append32(smpl, clamp(unityNote, 0, 127));
+            file.append32(smpl, (uint32)(detune * 4294967296.0 / 100.0));
+            file.append32(smpl, smpteFormat);
+            file.append32(smpl, smpteOffset);
+            file.append32(smpl, chunk.getNumLoops());
+            file.append32(smpl, (uint32)samplerData.size());
+
+            const InstrumentChunk::LoopVector& loops = chunk.getLoops();
+            for (size_t i = 0; i < loops.size(); ++i)
+            {
+                uint32 type;
+                switch (loops[i].mode_) {
+                case InstrumentChunk::LoopForward:     type = 0; break;
+                case InstrumentChunk::LoopAlternating: type = 1; break;
+                case InstrumentChunk::LoopBackward:    type = 2; break;
+                default:                               type = 32;
+                }
+                file.append32(smpl, (uint32)i);
+                file.append32(smpl, type);
+                file.append32(smpl, loops[i].start_);
+                file.append32(smpl, loops[i].end_ > 0 ? loops[i].end_ - 1 : 0);
+                file.append32(smpl, 0);
+                file.append32(smpl, loops[i].numRepeats_);
+            }
+            smpl.insert(smpl.end(), samplerData.begin(), samplerData.end());
+
+            ChunkFile::Data inst;
+            inst.push_back((uint8)clamp(chunk.getBaseNote(), 0, 127));
+            inst.push_back((uint8)(int8)clamp(chunk.getDetune(), -50, 50));
+            inst.push_back((uint8)(int8)clamp(chunk.getGain(), -64, 64));
+            inst.push_back((uint8)clamp(chunk.getKeyLow(), 0, 127));
+            inst.push_back((uint8)clamp(chunk.getKeyHigh(), 0, 127));
+            inst.push_back((uint8)clamp(chunk.getVelocityLow(), 1, 127));
+            inst.push_back((uint8)clamp(chunk.getVelocityHigh(), 1, 127));
+
+            file.replace(smplId, smpl);
+            file.replace(instId, inst);
+        }
+
+
+
+        //--------------------------------------------------------------------
+        // AIFF: the INST chunk refers to loop markers in the MARK chunk.
+        // The markers of the old loops are replaced, all others are kept.
+        //--------------------------------------------------------------------
+
+        void writeAiff(ChunkFile& file, const InstrumentChunk& chunk)
+        {
+            std::set<uint32> loopMarkers;
+            ChunkFile::Data oldInst = file.read(file.find(aiffInstId));
+            if (oldInst.size() >= aiffInstSize)
+            {
+                const size_t markerOffsets[] = { 10, 12, 16, 18 };
+                for (size_t i = 0; i < 4; ++i) {
+                    loopMarkers.insert(file.get16(&oldInst[markerOffsets[i]]));
+                }
+            }
+
+            ChunkFile::Data keptMarkers;
+            uint32 numKept = 0;
+            uint32 nextId = 1;
+            ChunkFile::Data oldMark = file.read(file.find(markId));
+            if (oldMark.size() >= 2)
+            {
+                size_t pos = 2;
+                for (uint32 i = 0; i < file.get16(&oldMark[0]) && pos + 7 <= oldMark.size(); ++i)
+                {
+                    uint32 id = file.get16(&oldMark[pos]);
+                    size_t size = 6 + ((1 + oldMark[pos + 6] + 1) & ~1u);     // id, position and even sized name
+                    if (pos + size > oldMark.size())
+                        break;
+
+                    if (loopMarkers.count(id) == 0) {
+                        keptMarkers.insert(keptMarkers.end(), oldMark.begin() + pos, oldMark.begin() + pos + size);
+                        numKept++;
+                        nextId = std::max(nextId, id + 1);
+                    }
+                    pos += size;
+                }
+            }
+
+            const InstrumentChunk::LoopVector& loops = chunk.getLoops();
+            size_t numLoops = std::min<size_t>(loops.size(), 2);
+
+            ChunkFile::Data mark;
+            file.append16(mark, numKept + 2 * numLoops);
+            mark.insert(mark.end(), keptMarkers.begin(), keptMarkers.end());
+
+            ChunkFile::Data inst;
+            inst.push_back((uint8)clamp(chunk.getBaseNote(), 0, 127));
+            inst.push_back((uint8)(int8)clamp(chunk.getDetune(), -50, 50));
+            inst.push_back((uint8)clamp(chunk.getKeyLow(), 0, 127));
+            inst.push_back((uint8)clamp(chunk.getKeyHigh(), 0, 127));
+            inst.push_back((uint8)clamp(chunk.getVelocityLow(), 1, 127));
+            inst.push_back((uint8)clamp(chunk.getVelocityHigh(), 1, 127));
+            file.append16(inst, (uint32)clamp(chunk.getGain(), -32768, 32767));
+
+            for (size_t i = 0; i < 2; ++i)                 // sustain and release loop
+            {
+                if (i >= numLoops) {
+                    file.append16(inst, 0);
+                    file.append16(inst, 0);
+                    file.append16(inst, 0);
+                    continue;
+                }
+
+                uint32 mode;
+                switch (loops[i].mode_) {
+                case InstrumentChunk::LoopForward:
+                case InstrumentChunk::LoopBackward:    mode = 1; break;        // AIFF has no backward loops
+                case InstrumentChunk::LoopAlternating: mode = 2; break;
+                default:                               mode = 0;
+                }
+                uint32 begin = nextId++;
+                uint32 end = nextId++;
+                file.append16(inst, mode);
+                file.append16(inst, begin);
+                file.append16(inst, end);
+
+                file.append16(mark, begin);
+                file.append32(mark, loops[i].start_);
+                file.append16(mark, 0);                     // empty name
+                file.append16(mark, end);
+                file.append32(mark, loops[i].end_);
+                file.append16(mark, 0);
+            }
+
+            file.replace(markId, mark);
+            file.replace(aiffInstId, inst);
+        }
+
+    } // namespace
+
+
+
+    void InstrumentChunkWriter::write(const Path& filename, const InstrumentChunk& chunk)
+    {
+        ChunkFile file;
+        file.open(filename);
+
+        if (file.isAiff()) {
+            writeAiff(file, chunk);
+        }
+        else {
+            writeWav(file, chunk, filename);
+        }
+        file.finish();
+    }
+
+} // namespace e3
@@ -0,0 +1,652 @@
+//------------------------------------------------------------
+// LibraryIndex.cpp
+// Metadata of all audio files below a set of directories
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cfloat>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <e3_Exception.h>
+#include <e3_Trace.h>
+
+#include <FormatManager.h>
+#include <InstrumentChunk.h>
+#include <LibraryIndex.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        const uint32 indexMagic   = ('E' << 24) | ('3' << 16) | ('L' << 8) | 'X';
+        const uint32 indexVersion = 1;
+
+        struct IndexHeader
+        {
+            uint32 magic_;
+            uint32 version_;
+            uint32 numEntries_;
+            uint32 poolSize_;
+        };
+
+        // Offsets of the arrays in the index file, the Entries are 8 byte aligned.
+        //
+        size_t getEntriesOffset(size_t numEntries)
+        {
+            size_t end = sizeof(IndexHeader) + numEntries * sizeof(LibraryIndex::Filter);
+            return (end + 7) & ~(size_t)7;
+        }
+
+        size_t getPathsOffset(size_t numEntries)
+        {
+            return getEntriesOffset(numEntries) + numEntries * sizeof(LibraryIndex::Entry);
+        }
+
+        uint8 clampMidi(int value)
+        {
+            return (uint8)std::min(127, std::max(0, value));
+        }
+
+        bool isMatch(const LibraryIndex::Filter& filter, const LibraryIndex::Query& query, float maxDuration)
+        {
+            return (filter.flags_ & LibraryIndex::FlagProbeFailed) == 0 &&
+                (query.format_ == FORMAT_UNKNOWN || filter.format_ == query.format_) &&
+                filter.keyLow_ <= query.keyHigh_ && filter.keyHigh_ >= query.keyLow_ &&
+                filter.velocityLow_ <= query.velocityHigh_ && filter.velocityHigh_ >= query.velocityLow_ &&
+                filter.duration_ >= query.minDuration_ && filter.duration_ <= maxDuration;
+        }
+
+        // Orders entry indices by an attribute of their Filters, and compares
+        // them with a value of the attribute for the binary searches.
+        //
+        struct DurationLess
+        {
+            DurationLess(const LibraryIndex::Filter* filters) : filters_(filters) {}
+
+            bool operator() (uint32 a, uint32 b) const      { return filters_[a].duration_ < filters_[b].duration_; }
+            bool operator() (uint32 a, float b) const       { return filters_[a].duration_ < b; }
+            bool operator() (float a, uint32 b) const       { return a < filters_[b].duration_; }
+
+            const LibraryIndex::Filter* filters_;
+        };
+
+        struct KeyLowLess
+        {
+            KeyLowLess(const LibraryIndex::Filter* filters) : filters_(filters) {}
+
+            bool operator() (uint32 a, uint32 b) const      { return filters_[a].keyLow_ < filters_[b].keyLow_; }
+            bool operator() (uint32 a, int b) const         { return filters_[a].keyLow_ < b; }
+            bool operator() (int a, uint32 b) const         { return a < filters_[b].keyLow_; }
+
+            const LibraryIndex::Filter* filters_;
+        };
+
+    } // namespace
+
+
+
+    struct LibraryIndex::Item
+    {
+        bool operator< (const Item& other) const    { return path_ < other.path_; }
+
+        Filter filter_;
+        Entry entry_;
+        std::string path_;
+    };
+
+
+
+    struct LibraryIndex::ScanState
+    {
+        ScanState() : numBusy_(0), numProbed_(0), numKnown_(0) {}
+
+        std::mutex mutex_;
+        std::condition_variable condition_;
+        std::deque<Path> directories_;      // waiting to be listed
+        size_t numBusy_;                    // threads listing a directory
+        ItemVector items_;
+        size_t numProbed_;
+        size_t numKnown_;                   // files that were in the index before
+
+        std::unordered_map<std::string, size_t> previous_;     // read only while scanning
+        std::unordered_set<std::string> visited_;               // canonical paths of the directories listed
+    };
+
+
+
+    LibraryIndex::LibraryIndex() :
+        filters_(nullptr),
+        entries_(nullptr),
+        paths_(nullptr),
+        numEntries_(0)
+    {}
+
+
+
+    void LibraryIndex::clear()
+    {
+        if (file_.is_open()) {
+            file_.close();
+        }
+        filterVector_.clear();
+        entryVector_.clear();
+        pathVector_.clear();
+        clearQueryIndex();
+
+        filters_ = nullptr;
+        entries_ = nullptr;
+        paths_ = nullptr;
+        numEntries_ = 0;
+    }
+
+
+
+    std::string LibraryIndex::getPath(size_t index) const
+    {
+        ASSERT(index < numEntries_);
+
+        const Entry& entry = entries_[index];
+        return std::string(paths_ + entry.pathOffset_, entry.pathLength_);
+    }
+
+
+
+    //--------------------------------------------------------------------
+    // Queries
+    //--------------------------------------------------------------------
+
+    // Tests the smallest of the candidate sets the indices offer: the entries
+    // of the format, the entries within the duration range, or the entries
+    // whose lowest key is not above the range of the query.
+    //
+    void LibraryIndex::find(const Query& query, std::vector<size_t>& result) const
+    {
+        float maxDuration = query.maxDuration_ > 0 ? query.maxDuration_ : FLT_MAX;
+
+        const uint32* begin = nullptr;
+        const uint32* end = nullptr;
+        size_t numCandidates = numEntries_;
+        bool isSorted = true;
+
+        if (query.format_ != FORMAT_UNKNOWN)
+        {
+            if ((size_t)query.format_ >= formatEntries_.size() || formatEntries_[query.format_].empty())
+                return;
+
+            const std::vector<uint32>& entries = formatEntries_[query.format_];
+            begin = &entries[0];
+            end = begin + entries.size();
+            numCandidates = entries.size();
+        }
+        if (durationOrder_.empty() == false)
+        {
+            const uint32* first = &durationOrder_[0];
+            const uint32* last = first + durationOrder_.size();
+            const uint32* low = std::lower_bound(first, last, query.minDuration_, DurationLess(filters_));
+            const uint32* high = std::upper_bound(low, last, maxDuration, DurationLess(filters_));
+            if ((size_t)(high - low) < numCandidates) {
+                begin = low;
+                end = high;
+                numCandidates = high - low;
+                isSorted = false;
+            }
+        }
+        if (keyOrder_.empty() == false)
+        {
+            const uint32* first = &keyOrder_[0];
+            const uint32* high = std::upper_bound(first, first + keyOrder_.size(), query.keyHigh_, KeyLowLess(filters_));
+            if ((size_t)(high - first) < numCandidates) {
+                begin = first;
+                end = high;
+                numCandidates = high - first;
+                isSorted = false;
+            }
+        }
+
+        size_t numFound = result.size();
+        if (begin == nullptr)
+        {
+            for (size_t i = 0; i < numEntries_; ++i) {
+                if (isMatch(filters_[i], query, maxDuration))
+                    result.push_back(i);
+            }
+        }
+        else
+        {
+            for (const uint32* it = begin; it != end; ++it) {
+                if (isMatch(filters_[*it], query, maxDuration))
+                    result.push_back(*it);
+            }
+        }
+
+        if (isSorted == false) {
+            std::sort(result.begin() + numFound, result.end());
+        }
+    }
+
+
+
+    // Entries are sorted by path.
+    //
+    int LibraryIndex::find(const Path& path) const
+    {
+        std::string key = path.generic_string();
+        size_t low = 0;
+        size_t high = numEntries_;
+
+        while (low < high)
+        {
+            size_t mid = (low + high) / 2;
+            const Entry& entry = entries_[mid];
+            int result = key.compare(0, std::string::npos, paths_ + entry.pathOffset_, entry.pathLength_);
+
+            if (result == 0)
+                return (int)mid;
+            if (result < 0)
+                high = mid;
+            else
+                low = mid + 1;
+        }
+        return -1;
+    }
+
+
+
+    //--------------------------------------------------------------------
+    // Scanning
+    //--------------------------------------------------------------------
+
+    LibraryIndex::ScanResult LibraryIndex::scan(const Path& directory, size_t numThreads)
+    {
+        detach();
+
+        // Paths are stored below the canonical directory, so "lib" and "./lib" find the same entries
+        boost::system::error_code error;
+        Path root = boost::filesystem::canonical(directory, error);
+        if (error) {
+            root = directory;
+        }
+
+        std::string prefix = root.generic_string();
+        if (prefix.empty() == false && *prefix.rbegin() != '/') {
+            prefix += '/';
+        }
+
+        ScanState state;
+        ItemVector items;
+        size_t numInside = 0;
+
+        for (size_t i = 0; i < numEntries_; ++i)
+        {
+            Item item;
+            item.filter_ = filters_[i];
+            item.entry_ = entries_[i];
+            item.path_ = getPath(i);
+
+            if (item.path_.compare(0, prefix.size(), prefix) == 0) {
+                state.previous_[item.path_] = i;
+                numInside++;
+            }
+            else {
+                items.push_back(item);      // not below directory, kept as it is
+            }
+        }
+
+        state.directories_.push_back(root);
+
+        if (numThreads == 0) {
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < numThreads; ++i) {
+            threads.push_back(std::thread(&LibraryIndex::scanThread, this, &state));
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+
+        ScanResult result;
+        result.numFiles_   = state.items_.size();
+        result.numProbed_  = state.numProbed_;
+        result.numRemoved_ = numInside - state.numKnown_;
+
+        items.insert(items.end(), state.items_.begin(), state.items_.end());
+        std::sort(items.begin(), items.end());
+        assign(items);
+
+        return result;
+    }
+
+
+
+    // Takes directories from the shared queue until it is empty
+    // and no other thread can add to it anymore.
+    //
+    void LibraryIndex::scanThread(ScanState* state)
+    {
+        ItemVector items;
+        std::vector<Path> subdirectories;
+
+        while (true)
+        {
+            Path directory;
+            {
+                std::unique_lock<std::mutex> lock(state->mutex_);
+                while (state->directories_.empty() && state->numBusy_ > 0) {
+                    state->condition_.wait(lock);
+                }
+                if (state->directories_.empty())
+                    break;
+
+                directory = state->directories_.front();
+                state->directories_.pop_front();
+                state->numBusy_++;
+            }
+
+            // Directories reached through symbolic links are listed once,
+            // links to a parent directory would be followed forever.
+            // A directory that can not be resolved is listed, but not marked.
+            bool isVisited = false;
+            boost::system::error_code error;
+            Path canonical = boost::filesystem::canonical(directory, error);
+            if (!error) {
+                std::lock_guard<std::mutex> lock(state->mutex_);
+                isVisited = state->visited_.insert(canonical.generic_string()).second == false;
+            }
+
+            subdirectories.clear();
+            if (isVisited == false) {
+                scanDirectory(state, directory, subdirectories, items);
+            }
+
+            std::lock_guard<std::mutex> lock(state->mutex_);
+            state->directories_.insert(state->directories_.end(), subdirectories.begin(), subdirectories.end());
+            state->numBusy_--;
+            state->condition_.notify_all();
+        }
+
+        std::lock_guard<std::mutex> lock(state->mutex_);
+        state->items_.insert(state->items_.end(), items.begin(), items.end());
+    }
+
+
+
+    void LibraryIndex::scanDirectory(ScanState* state, const Path& directory, std::vector<Path>& subdirectories, ItemVector& items)
+    {
+        size_t numProbed = 0;
+        size_t numKnown = 0;
+        boost::system::error_code error;
+        boost::filesystem::directory_iterator end;
+
+        for (boost::filesystem::directory_iterator it(directory, error); !error && it != end; it.increment(error))
+        {
+            const Path& path = it->path();
+            boost::filesystem::file_status status = it->status(error);
+            if (error) {
+                error.clear();
+                continue;
+            }
+
+            if (boost::filesystem::is_directory(status)) {
+                subdirectories.push_back(path);
+                continue;
+            }
+            if (boost::filesystem::is_regular_file(status) == false ||
+                FormatManager::getFormatFromExtension(path) == FORMAT_UNKNOWN)
+                continue;
+
+            int64 fileSize, fileTime;
+            if (AudioFile::getFileStamp(path, fileSize, fileTime) == false)
+                continue;
+
+            Item item;
+            item.path_ = path.generic_string();
+
+            std::unordered_map<std::string, size_t>::const_iterator previous = state->previous_.find(item.path_);
+            if (previous != state->previous_.end())
+            {
+                numKnown++;
+                const Entry& entry = entries_[previous->second];
+                if (entry.fileSize_ == fileSize && entry.fileTime_ == fileTime)
+                {
+                    item.filter_ = filters_[previous->second];
+                    item.entry_ = entry;
+                    items.push_back(item);
+                    continue;
+                }
+            }
+
+            probe(path, item);
+            item.entry_.fileSize_ = fileSize;
+            item.entry_.fileTime_ = fileTime;
+            items.push_back(item);
+            numProbed++;
+        }
+
+        std::lock_guard<std::mutex> lock(state->mutex_);
+        state->numProbed_ += numProbed;
+        state->numKnown_ += numKnown;
+    }
+
+
+
+    void LibraryIndex::probe(const Path& path, Item& item) const
+    {
+        memset(&item.filter_, 0, sizeof(item.filter_));
+        memset(&item.entry_, 0, sizeof(item.entry_));
+
+        Filter& filter = item.filter_;
+        Entry& entry = item.entry_;
+        filter.format_ = (uint8)FormatManager::getFormatFromExtension(path);
+        filter.keyHigh_ = 127;
+        filter.velocityHigh_ = 127;
+        entry.baseNote_ = 60;
+
+        try {
+            AudioFilePtr file = FormatManager::createFile(path);
+            file->open(path, AudioFile::OpenRead);
+
+            filter.format_     = (uint8)file->getFormat().id_;
+            entry.codec_       = (uint8)file->getCodec().id_;
+            entry.sampleRate_  = file->getSampleRate();
+            entry.numChannels_ = (uint16)file->getNumChannels();
+            entry.numFrames_   = file->getNumFrames();
+            filter.duration_   = entry.sampleRate_ > 0 ? (float)((double)entry.numFrames_ / entry.sampleRate_) : 0.f;
+
+            InstrumentChunk* chunk = file->getInstrumentChunk();
+            if (chunk != nullptr)
+            {
+                filter.keyLow_       = clampMidi(chunk->getKeyLow());
+                filter.keyHigh_      = clampMidi(chunk->getKeyHigh());
+                filter.velocityLow_  = clampMidi(chunk->getVelocityLow());
+                filter.velocityHigh_ = clampMidi(chunk->getVelocityHigh());
+                filter.flags_       |= FlagInstrument;
+                entry.baseNote_      = clampMidi(chunk->getBaseNote());
+            }
+            file->close();
+        }
+        catch (const std::exception& e)
+        {
+            TRACE("LibraryIndex: %s can not be probed: %s\n", path.string().c_str(), e.what());
+            filter.flags_ |= FlagProbeFailed;
+        }
+    }
+
+
+
+    //--------------------------------------------------------------------
+    // Storage
+    //--------------------------------------------------------------------
+
+    // Copies the mapped arrays, so that they can be modified.
+    //
+    void LibraryIndex::detach()
+    {
+        if (file_.is_open() == false)
+            return;
+
+        filterVector_.assign(filters_, filters_ + numEntries_);
+        entryVector_.assign(entries_, entries_ + numEntries_);
+        pathVector_.clear();
+        if (numEntries_ > 0) {
+            const Entry& last = entries_[numEntries_ - 1];
+            pathVector_.assign(paths_, last.pathOffset_ + last.pathLength_);
+        }
+        file_.close();
+
+        filters_ = filterVector_.empty() ? nullptr : &filterVector_[0];
+        entries_ = entryVector_.empty() ? nullptr : &entryVector_[0];
+        paths_ = pathVector_.c_str();
+    }
+
+
+
+    void LibraryIndex::assign(const ItemVector& items)
+    {
+        filterVector_.resize(items.size());
+        entryVector_.resize(items.size());
+        pathVector_.clear();
+
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+            filterVector_[i] = items[i].filter_;
+            entryVector_[i] = items[i].entry_;
+            entryVector_[i].pathOffset_ = (uint32)pathVector_.size();
+            entryVector_[i].pathLength_ = (uint32)items[i].path_.size();
+            pathVector_ += items[i].path_;
+        }
+
+        numEntries_ = items.size();
+        filters_ = filterVector_.empty() ? nullptr : &filterVector_[0];
+        entries_ = entryVector_.empty() ? nullptr : &entryVector_[0];
+        paths_ = pathVector_.c_str();
+
+        buildQueryIndex();
+    }
+
+
+
+    // Entries whose probe failed never match and are left out.
+    //
+    void LibraryIndex::buildQueryIndex()
+    {
+        clearQueryIndex();
+
+        for (size_t i = 0; i < numEntries_; ++i)
+        {
+            const Filter& filter = filters_[i];
+            if (filter.flags_ & FlagProbeFailed)
+                continue;
+
+            if (filter.format_ >= formatEntries_.size()) {
+                formatEntries_.resize(filter.format_ + 1);
+            }
+            formatEntries_[filter.format_].push_back((uint32)i);
+            durationOrder_.push_back((uint32)i);
+        }
+        keyOrder_ = durationOrder_;
+
+        std::sort(durationOrder_.begin(), durationOrder_.end(), DurationLess(filters_));
+        std::sort(keyOrder_.begin(), keyOrder_.end(), KeyLowLess(filters_));
+    }
+
+
+
+    void LibraryIndex::clearQueryIndex()
+    {
+        formatEntries_.clear();
+        durationOrder_.clear();
+        keyOrder_.clear();
+    }
+
+
+
+    bool LibraryIndex::load(const Path& indexPath)
+    {
+        clear();
+
+        try {
+            file_.open(indexPath.string());
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+
+        const char* data = file_.data();
+        size_t size = file_.size();
+        const IndexHeader* header = reinterpret_cast<const IndexHeader*>(data);
+
+        bool result = size >= sizeof(IndexHeader) &&
+            header->magic_ == indexMagic && header->version_ == indexVersion &&
+            header->numEntries_ <= (size - sizeof(IndexHeader)) / (sizeof(Filter) + sizeof(Entry)) &&
+            size >= getPathsOffset(header->numEntries_) + header->poolSize_;
+
+        if (result)
+        {
+            // The paths must lie within the pool, getPath() and find() do not check them.
+            const Entry* entries = reinterpret_cast<const Entry*>(data + getEntriesOffset(header->numEntries_));
+            for (uint32 i = 0; i < header->numEntries_ && result; ++i) {
+                result = (uint64)entries[i].pathOffset_ + entries[i].pathLength_ <= header->poolSize_;
+            }
+        }
+
+        if (result == false) {
+            clear();
+            return false;
+        }
+
+        numEntries_ = header->numEntries_;
+        filters_ = reinterpret_cast<const Filter*>(data + sizeof(IndexHeader));
+        entries_ = reinterpret_cast<const Entry*>(data + getEntriesOffset(numEntries_));
+        paths_ = data + getPathsOffset(numEntries_);
+
+        buildQueryIndex();
+        return true;
+    }
+
+
+
+    // Must not be called with the path of the mapped file, scan() releases the mapping.
+    //
+    bool LibraryIndex::store(const Path& indexPath) const
+    {
+        IndexHeader header;
+        header.magic_      = indexMagic;
+        header.version_    = indexVersion;
+        header.numEntries_ = (uint32)numEntries_;
+        header.poolSize_   = 0;
+        if (numEntries_ > 0) {
+            const Entry& last = entries_[numEntries_ - 1];
+            header.poolSize_ = last.pathOffset_ + last.pathLength_;
+        }
+
+        FILE* handle = fopen(indexPath.string().c_str(), "wb");
+        if (handle == NULL)
+            return false;
+
+        const char padding[8] = { 0 };
+        size_t numPadding = getEntriesOffset(numEntries_) - sizeof(IndexHeader) - numEntries_ * sizeof(Filter);
+
+        bool result = fwrite(&header, sizeof(header), 1, handle) == 1 &&
+            fwrite(filters_, sizeof(Filter), numEntries_, handle) == numEntries_ &&
+            fwrite(padding, 1, numPadding, handle) == numPadding &&
+            fwrite(entries_, sizeof(Entry), numEntries_, handle) == numEntries_ &&
+            fwrite(paths_, 1, header.poolSize_, handle) == header.poolSize_;
+        result &= fclose(handle) == 0;
+
+        if (result == false) {
+            boost::system::error_code error;
+            boost::filesystem::remove(indexPath, error);
+        }
+        return result;
+    }
+
+} // namespace e3
@@ -0,0 +1,127 @@
+//------------------------------------------------------------
+// LoadTask.cpp
+// Asynchronous loading of audio files
+//------------------------------------------------------------
+
+#include <boost/bind.hpp>
+
+#include <e3_Exception.h>
+
+#include <FlacFile.h>
+#include <FormatManager.h>
+#include <LoadTask.h>
+#include <MpegFile.h>
+#include <WorkerPool.h>
+
+
+namespace e3 {
+
+    LoadTaskPtr loadAsync(const Path& filename, const LoadOptions& options)
+    {
+        LoadTaskPtr task(new LoadTask(filename, options));
+        WorkerPool::instance().post(boost::bind(&LoadTask::run, task));
+
+        return task;
+    }
+
+
+
+    LoadTask::LoadTask(const Path& filename, const LoadOptions& options) :
+        filename_(filename),
+        options_(options),
+        state_(Pending),
+        cancelled_(false),
+        numDone_(0),
+        numTotal_(0)
+    {
+        future_ = promise_.get_future().share();
+    }
+
+
+
+    float LoadTask::getProgress() const
+    {
+        if (getState() == Finished)
+            return 1.f;
+
+        int64 numTotal = numTotal_;
+        return (numTotal > 0) ? std::min(1.f, (float)numDone_ / (float)numTotal) : 0.f;
+    }
+
+
+
+    void LoadTask::run()
+    {
+        if (cancelled_) {       // cancelled before it was started
+            try {
+                THROW(std::exception, "Loading cancelled: %s", filename_.string().c_str());
+            }
+            catch (...) {
+                promise_.set_exception(std::current_exception());
+            }
+            complete(Cancelled);
+            return;
+        }
+        state_ = Running;
+
+        try {
+            AudioFilePtr file = FormatManager::createFile(filename_);
+            file->setProgressCallback(boost::bind(&LoadTask::onProgress, this, _1, _2));
+
+            MpegFilePtr mpegFile = boost::dynamic_pointer_cast<MpegFile>(file);
+            if (mpegFile) {
+                mpegFile->setNumLoadThreads(options_.numThreads_);
+                mpegFile->setNumOutputChannels(options_.numChannels_);
+                mpegFile->setTargetSampleRate(options_.sampleRate_);     // converted while decoding
+            }
+            FlacFilePtr flacFile = boost::dynamic_pointer_cast<FlacFile>(file);
+            if (flacFile) {
+                flacFile->setNumLoadThreads(options_.numThreads_);
+            }
+
+            file->open(filename_, AudioFile::OpenRead);
+            numTotal_ = file->getNumFrames();
+
+            AudioBufferPtr buffer(new AudioBuffer(0, options_.category_));
+            file->load(buffer.get());
+            file->close();
+
+            if (options_.sampleRate_ > 0 && buffer->getSampleRate() != options_.sampleRate_) {
+                buffer->convertSampleRate(options_.sampleRate_);
+            }
+
+            promise_.set_value(buffer);
+            complete(Finished);
+        }
+        catch (...)
+        {
+            promise_.set_exception(std::current_exception());
+            complete(cancelled_ ? Cancelled : Failed);
+        }
+    }
+
+
+
+    bool LoadTask::onProgress(int64_t numDone, int64_t numTotal)
+    {
+        numDone_ = numDone;
+        numTotal_ = numTotal;
+
+        if (options_.onProgress_) {
+            options_.onProgress_(getProgress());
+        }
+        return cancelled_ == false;
+    }
+
+
+
+    void LoadTask::complete(State state)
+    {
+        state_ = state;
+
+        if (options_.onCompletion_) {
+            options_.onCompletion_(*this);
+        }
+    }
+
+} // namespace e3
@@ -19,6 +19,7 @@
 
 #include <e3_Exception.h>
 #include <MadDecoder.h>
+#include <SampleConversion.h>
 
 
 
@@ -26,35 +27,68 @@ namespace e3 {
 
     MadDecoder::MadDecoder() :
         handle_(NULL),
+        mappedData_(NULL),
+        mappedSize_(0),
+        payloadStart_(0),
+        payloadEnd_(0),
         bufferSize_(8192),
+        bufferOffset_(0),
+        endOfInput_(false),
         currentFrame_(0),
         numMpegFrames_(0),
+        numOutputChannels_(0),
         initialized_(false)
-    {}
+    {
+        decodeBuffer_.resize(bufferSize_ + MAD_BUFFER_GUARD, false);
+        ASSERT(decodeBuffer_.size() == bufferSize_ + MAD_BUFFER_GUARD);
+
+        mad_stream_init(&madStream_);
+        mad_frame_init(&madFrame_);
+        mad_synth_init(&madSynth_);
+        mad_timer_reset(&madTimer_);
+    }
+
+
+
+    MadDecoder::~MadDecoder()
+    {
+        mad_synth_finish(&madSynth_);
+        mad_frame_finish(&madFrame_);
+        mad_stream_finish(&madStream_);
+    }
+
 
 
     size_t MadDecoder::start(FILE* handle)
     {
+        reset();
         handle_ = handle;
 
-        decodeBuffer_.resize(bufferSize_, false);
-        ASSERT(decodeBuffer_.size() == bufferSize_);
-        unsigned char* buffer = decodeBuffer_.getHead();
+        return startDecoding();
+    }
 
-        int64 durationMsec = getDurationMs(buffer, bufferSize_);
 
-        mad_stream_init(&madStream_);
-        mad_frame_init(&madFrame_);
-        mad_synth_init(&madSynth_);
-        mad_timer_reset(&madTimer_);
+
+    size_t MadDecoder::start(const unsigned char* data, size_t size)
+    {
+        reset();
+        mappedData_ = data;
+        mappedSize_ = size;
+
+        return startDecoding();
+    }
+
+
+
+    size_t MadDecoder::startDecoding()
+    {
+        scanTags();
+        int64 numSamples = scanInfoHeader();
 
         // Decode at least one valid frame to find out the input format.
         // The decoded frame will be saved off so that it can be processed later.
         //
-        size_t bytesRead = fread(buffer, (size_t)1, bufferSize_, handle_);
-        if (bytesRead != bufferSize_ && ferror(handle_))
-            THROW(std::exception, "%s", strerror(errno));
-        mad_stream_buffer(&madStream_, buffer, bytesRead);
+        readMpgFile();
 
         // Find a valid frame before starting up.
         // This make sure that we have a valid MP3 
@@ -84,30 +118,113 @@ namespace e3 {
         }
 
         mad_timer_add(&madTimer_, madFrame_.header.duration);
-        mad_synth_frame(&madSynth_, &madFrame_);
+        synthFrame();
 
         //unsigned int precision_ = 16;
         currentFrame_ = 0;
         numMpegFrames_ = 0;
         initialized_ = true;
 
-        return (size_t)(durationMsec * .001 * getSampleRate() + .5);  // number of sample frames
+        return (size_t)numSamples;
+    }
+
+
+
+    void MadDecoder::attach(FILE* handle)
+    {
+        reset();
+        handle_ = handle;
+        scanTags();
+        initialized_ = true;
+    }
+
+
+
+    void MadDecoder::attach(const unsigned char* data, size_t size)
+    {
+        reset();
+        mappedData_ = data;
+        mappedSize_ = size;
+        scanTags();
+        initialized_ = true;
     }
 
 
 
     void MadDecoder::finish()
     {
-        mad_synth_finish(&madSynth_);
-        mad_frame_finish(&madFrame_);
-        mad_stream_finish(&madStream_);
+        reset();
+        numOutputChannels_ = 0;
+    }
 
+
+
+    // Detaches from the input and clears the decoder state.
+    // Buffers allocated by libmad and decodeBuffer_ are kept for the next input.
+    //
+    void MadDecoder::reset()
+    {
+        handle_ = NULL;
+        mappedData_ = NULL;
+        mappedSize_ = 0;
+        payloadStart_ = 0;
+        payloadEnd_ = 0;
+        bufferOffset_ = 0;
+        endOfInput_ = false;
+        currentFrame_ = 0;
+        numMpegFrames_ = 0;
         initialized_ = false;
+        xing_ = XingHeader();
+
+        resetStream();
+        mad_header_init(&madFrame_.header);
+        mad_frame_mute(&madFrame_);
+        mad_synth_mute(&madSynth_);
+        madSynth_.pcm.length = 0;
+        mad_timer_reset(&madTimer_);
+    }
+
+
+
+    // Reinitializes the stream, but keeps the bit reservoir buffer allocated by libmad.
+    //
+    void MadDecoder::resetStream()
+    {
+        unsigned char (*mainData)[MAD_BUFFER_MDLEN] = madStream_.main_data;
+
+        mad_stream_init(&madStream_);
+        madStream_.main_data = mainData;
+    }
+
+
+
+    size_t MadDecoder::read(float* output, size_t numFrames)
+    {
+        size_t numChannels = getNumChannels();
+
+        return decode(numFrames * numChannels, output) / numChannels;
+    }
+
+
+
+    void MadDecoder::setNumOutputChannels(int numChannels)
+    {
+        if (numChannels < 0 || numChannels > 2)
+            THROW(std::exception, "Invalid number of output channels: %d", numChannels);
+
+        numOutputChannels_ = numChannels;
     }
 
 
 
     int MadDecoder::getNumChannels() const
+    {
+        return (numOutputChannels_ > 0) ? numOutputChannels_ : getNumSourceChannels();
+    }
+
+
+
+    int MadDecoder::getNumSourceChannels() const
     {
         if (initialized_ == false) THROW(std::exception, "MadDecoder not initialized");
 
@@ -141,114 +258,96 @@ namespace e3 {
 
 
 
-    int64 MadDecoder::getDurationMs(unsigned char* buffer, size_t bufferSize)
+    // Looks for a Xing, Info or VBRI header in the first frame.
+    // Returns the number of sample frames the file decodes to,
+    // or 0 if there is no such header.
+    //
+    int64 MadDecoder::scanInfoHeader()
     {
-        struct mad_stream madStream;
-        struct mad_frame  madFrame;
         struct mad_header madHeader;
-        mad_timer_t  time = mad_timer_zero;
+        int64 numSamples = 0;
+        bool found = false;
 
-        bool depadded = false;
-        bool vbr = false;
-        size_t tagsize = 0;
-        size_t consumed = 0;
-        size_t numFrames = 0;
-        size_t initialBitrate = 0;
-
-
-        mad_stream_init(&madStream);
         mad_header_init(&madHeader);
-        mad_frame_init(&madFrame);
 
-        do  // Read data from the MP3 file 
+        while (found == false && readMpgFile())
         {
-            int padding = 0;
-            size_t leftover = madStream.bufend - madStream.next_frame;
-            memcpy(buffer, madStream.this_frame, leftover);
-
-            int bytesRead = fread(buffer + leftover, (size_t)1, bufferSize - leftover, handle_);
-            if (bytesRead <= 0) {
-                break;
-            }
-            for (; !depadded && padding < bytesRead && !buffer[padding]; ++padding);
-            depadded = true;
-            mad_stream_buffer(&madStream, buffer + padding, leftover + bytesRead - padding);
-
-            while (true)   // decode frame headers 
+            while (true)   // find the first frame header
             {
-                madStream.error = MAD_ERROR_NONE;
-                if (mad_header_decode(&madHeader, &madStream) == -1)
+                madStream_.error = MAD_ERROR_NONE;
+                if (mad_header_decode(&madHeader, &madStream_) == -1)
                 {
-                    if (madStream.error == MAD_ERROR_BUFLEN)     // Normal behaviour; get some more data from the file
-                        break;
-                    if (MAD_RECOVERABLE(madStream.error) == 0)
+                    if (madStream_.error == MAD_ERROR_BUFLEN || MAD_RECOVERABLE(madStream_.error) == 0)
                         break;
-                    if (madStream.error == MAD_ERROR_LOSTSYNC)
-                    {
-                        unsigned available = (madStream.bufend - madStream.this_frame);
-                        tagsize = getId3TagSize(madStream.this_frame, (size_t)available);
-
-                        if (tagsize)    // It's some ID3 tags, so just skip 
-                        {
-                            if (tagsize >= available) {
-                                _fseeki64(handle_, (int64)(tagsize - available), SEEK_CUR);
-                                depadded = false;
-                            }
-                            mad_stream_skip(&madStream, std::min(tagsize, available));
-                        }
-                    }
-                    continue; // not an audio frame
+                    if (madStream_.error == MAD_ERROR_LOSTSYNC)
+                        skipId3Tag(&madStream_);
+                    continue;
                 }
+                found = true;
 
-                mad_timer_add(&time, madHeader.duration);
-                consumed += madStream.next_frame - madStream.this_frame;
-
-                if (numFrames == 0) {
-                    initialBitrate = madHeader.bitrate;
+                int64 frameOffset = bufferOffset_ + (madStream_.this_frame - madStream_.buffer);
+                size_t available = madStream_.bufend - madStream_.this_frame;
 
-                    // Get the precise frame count from the XING header if present 
-                    madFrame.header = madHeader;
-                    if (mad_frame_decode(&madFrame, &madStream) == -1)
-                    {
-                        if (MAD_RECOVERABLE(madStream.error) == 0) {
-                            break;
-                        }
-                    }
-                    if ((numFrames = xingFrames(madStream.anc_ptr, madStream.anc_bitlen)))
-                    {
-                        mad_timer_multiply(&time, (signed long)numFrames);
-                        break;
+                xing_.frameSize_ = 32 * MAD_NSBSAMPLES(&madHeader);
+                bool hasHeader = parseVbriHeader(madStream_.this_frame, available, &xing_);
+                if (hasHeader == false)
+                {
+                    madFrame_.header = madHeader;
+                    if (mad_frame_decode(&madFrame_, &madStream_) == 0 || MAD_RECOVERABLE(madStream_.error)) {
+                        hasHeader = parseXingHeader(madStream_.anc_ptr, madStream_.anc_bitlen, &xing_);
                     }
                 }
-                else {
-                    vbr |= madHeader.bitrate != initialBitrate;
-                }
-
-                // If not VBR, we can time just a few frames then extrapolate (not exact!)
-                if (++numFrames == 25 && !vbr)
+                if (hasHeader && xing_.numFrames_ > 0)
                 {
-                    struct stat st;
-                    fstat(fileno(handle_), &st);
-                    timerMultiply(&time, (double)(st.st_size - tagsize) / consumed);
-                    break;
+                    // The frame count does not include the frame holding the header,
+                    // which decodes to silence
+                    xing_.offset_ = frameOffset;
+                    numSamples = (int64)(xing_.numFrames_ + 1) * 32 * MAD_NSBSAMPLES(&madHeader);
                 }
-            }   // while(true)
-        } while (madStream.error == MAD_ERROR_BUFLEN);
+                break;
+            }
+            if (madStream_.error != MAD_ERROR_BUFLEN)
+                break;
+        }
 
-        mad_frame_finish(&madFrame);
+        // back to the start of the audio payload
         mad_header_finish(&madHeader);
-        mad_stream_finish(&madStream);
-        rewind(handle_);
+        resetStream();
+        mad_frame_mute(&madFrame_);
+        bufferOffset_ = payloadStart_;
+        endOfInput_ = false;
+        if (handle_) {
+            clearerr(handle_);
+            _fseeki64(handle_, payloadStart_, SEEK_SET);
+        }
 
-        return mad_timer_count(time, MAD_UNITS_MILLISECONDS);
+        return numSamples;
     }
 
 
-    // Read from the mpeg file and (re)fill the stream buffer that is to be decoded.  
-    // If any data still exists in the buffer then they are first shifted to be
-    // front of the stream buffer.
-    //
+
     bool MadDecoder::readMpgFile()
+    {
+        if (fillStream(&madStream_, decodeBuffer_, bufferOffset_, endOfInput_) == false)
+            return false;
+
+        madStream_.error = MAD_ERROR_NONE;
+        return true;
+    }
+
+
+
+    // (Re)fills stream from the file or from the mapped memory.
+    // bufferOffset is the file offset of the first byte of the stream buffer.
+    // Input ends at payloadEnd_, tags appended to the audio data are never read.
+    //
+    // Mapped memory is handed to libmad as a whole, a file is read in chunks.
+    // libmad needs MAD_BUFFER_GUARD bytes after the last frame to decode it,
+    // so at the end of the input the remaining bytes are copied to buffer
+    // and padded with zeros.
+    // Returns false if there is no more input.
+    //
+    bool MadDecoder::fillStream(struct mad_stream* stream, CharBuffer& buffer, int64& bufferOffset, bool& endOfInput)
     {
         // libmad does not consume all the buffer it's given. Some
         // data, part of a truncated frame, is left unused at the
@@ -260,67 +359,376 @@ namespace e3 {
         // TODO: Is 2016 bytes the size of the largest frame?
         // (448000*(1152/32000))/8
         //
-        size_t bufferSize = decodeBuffer_.size();
-        unsigned char* buffer = decodeBuffer_.getHead();
-        size_t leftover = madStream_.bufend - madStream_.next_frame;
-        memmove(buffer, madStream_.next_frame, leftover);
+        if (endOfInput)
+            return false;
 
-        clearerr(handle_);
-        size_t bytesRead = fread(buffer + leftover, (size_t)1, bufferSize - leftover, handle_);
+        unsigned char* data = buffer.getHead();
+        size_t leftover = stream->bufend - stream->next_frame;
+
+        if (mappedData_)
+        {
+            if (stream->buffer == NULL) {       // hand over everything from bufferOffset
+                ASSERT(bufferOffset <= payloadEnd_);
+                mad_stream_buffer(stream, mappedData_ + bufferOffset, (unsigned long)(payloadEnd_ - bufferOffset));
+                return true;
+            }
+            ASSERT(leftover + MAD_BUFFER_GUARD <= buffer.size());
+            bufferOffset += stream->next_frame - stream->buffer;
+            memmove(data, stream->next_frame, leftover);
+        }
+        else
+        {
+            memmove(data, stream->next_frame, leftover);
 
-        if (bytesRead != bufferSize && ferror(handle_))
-            THROW(std::exception, "%s", strerror(errno));
+            clearerr(handle_);
+            int64 position = _ftelli64(handle_);
+            size_t numBytes = (size_t)std::max<int64>(0, std::min<int64>(bufferSize_ - leftover, payloadEnd_ - position));
+            size_t bytesRead = fread(data + leftover, (size_t)1, numBytes, handle_);
+            bufferOffset = position - leftover;
 
-        if (bytesRead == 0) {       // eof
-            ASSERT(feof(handle_));
-            return false;
+            if (bytesRead != numBytes && ferror(handle_))
+                THROW(std::exception, "%s", strerror(errno));
+
+            if (bytesRead > 0) {
+                mad_stream_buffer(stream, data, leftover + bytesRead);
+                return true;
+            }
         }
 
-        mad_stream_buffer(&madStream_, buffer, bytesRead + leftover);
-        madStream_.error = MAD_ERROR_NONE;
+        // end of input, pad the last frame
+        endOfInput = true;
+        if (leftover == 0)
+            return false;
 
+        memset(data + leftover, 0, MAD_BUFFER_GUARD);
+        mad_stream_buffer(stream, data, leftover + MAD_BUFFER_GUARD);
         return true;
     }
 
 
+
+    // Skips an ID3 tag at the current position of stream,
+    // also when the tag is larger than the data in the stream buffer.
+    // Returns the size of the tag, or 0 if there is none.
+    //
+    size_t MadDecoder::skipId3Tag(struct mad_stream* stream)
+    {
+        size_t available = stream->bufend - stream->this_frame;
+        size_t tagsize = getId3TagSize(stream->this_frame, available);
+
+        if (tagsize > 0)
+        {
+            if (tagsize > available && handle_ != NULL) {
+                _fseeki64(handle_, (int64)(tagsize - available), SEEK_CUR);
+            }
+            mad_stream_skip(stream, std::min(tagsize, available));
+        }
+        return tagsize;
+    }
+
+
+
+    // Finds the audio payload between the tags at the start and at the end of the input,
+    // reading only the tag headers and footers. Handles any number of ID3v2 tags at the
+    // start and ID3v1, APEv2 and appended ID3v2 tags at the end.
+    // Leaves the file positioned at the start of the payload.
+    //
+    void MadDecoder::scanTags()
+    {
+        int64 fileSize = getFileSize();
+        unsigned char data[32];
+
+        payloadStart_ = 0;
+        payloadEnd_ = fileSize;
+
+        while (readInput(payloadStart_, data, 10))
+        {
+            size_t tagsize = getId3v2TagSize(data, 'I', 'D', '3');
+            if (tagsize == 0)
+                break;
+            payloadStart_ += tagsize;
+        }
+        payloadStart_ = std::min(payloadStart_, fileSize);
+
+        while (payloadEnd_ > payloadStart_)
+        {
+            int64 tagsize = 0;
+
+            if (payloadEnd_ - payloadStart_ >= 128 && readInput(payloadEnd_ - 128, data, 3) &&
+                data[0] == 'T' && data[1] == 'A' && data[2] == 'G')
+            {
+                tagsize = 128;                                          // ID3v1
+            }
+            else if (readInput(payloadEnd_ - 32, data, 32) && memcmp(data, "APETAGEX", 8) == 0)
+            {
+                tagsize = readLittleEndian32(data + 12);               // APEv2, footer size includes items and footer
+                if (data[23] & 0x80)
+                    tagsize += 32;                                      // header present
+            }
+            else if (readInput(payloadEnd_ - 10, data, 10))
+            {
+                tagsize = getId3v2TagSize(data, '3', 'D', 'I');        // ID3v2 footer of an appended tag
+            }
+
+            if (tagsize == 0 || tagsize > payloadEnd_ - payloadStart_)
+                break;
+            payloadEnd_ -= tagsize;
+        }
+
+        if (handle_) {
+            clearerr(handle_);
+            _fseeki64(handle_, payloadStart_, SEEK_SET);
+        }
+        bufferOffset_ = payloadStart_;
+    }
+
+
+
+    // Reads size bytes at offset without going through the stream.
+    // Returns false if the input is too short.
+    //
+    bool MadDecoder::readInput(int64 offset, unsigned char* data, size_t size) const
+    {
+        if (offset < 0)
+            return false;
+
+        if (mappedData_)
+        {
+            if (offset + (int64)size > (int64)mappedSize_)
+                return false;
+            memcpy(data, mappedData_ + offset, size);
+            return true;
+        }
+
+        clearerr(handle_);
+        return _fseeki64(handle_, offset, SEEK_SET) == 0 && fread(data, 1, size, handle_) == size;
+    }
+
+
+
+    int64 MadDecoder::getFileSize() const
+    {
+        if (mappedData_)
+            return mappedSize_;
+
+        struct stat st;
+        fstat(fileno(handle_), &st);
+        return st.st_size;
+    }
+
+
+    //-------------------------------------------------------------------
+    // Frame index and seeking
+    //-------------------------------------------------------------------
+
+    void MadDecoder::buildIndex(MpegFrameIndex* index)
+    {
+        ASSERT(index);
+        index->clear();
+
+        int64 position = 0;
+        if (handle_) {
+            position = _ftelli64(handle_);
+            _fseeki64(handle_, payloadStart_, SEEK_SET);
+        }
+
+        CharBuffer buffer(bufferSize_ + MAD_BUFFER_GUARD);
+        struct mad_stream madStream;
+        struct mad_header madHeader;
+        int64 bufferOffset = payloadStart_;
+        int64 numSamples = 0;
+        bool endOfInput = false;
+
+        mad_stream_init(&madStream);
+        mad_header_init(&madHeader);
+
+        while (fillStream(&madStream, buffer, bufferOffset, endOfInput))
+        {
+            while (true)   // decode frame headers
+            {
+                madStream.error = MAD_ERROR_NONE;
+                if (mad_header_decode(&madHeader, &madStream) == -1)
+                {
+                    if (madStream.error == MAD_ERROR_BUFLEN || MAD_RECOVERABLE(madStream.error) == 0)
+                        break;
+                    if (madStream.error == MAD_ERROR_LOSTSYNC)
+                        skipId3Tag(&madStream);
+                    continue;
+                }
+                index->add(bufferOffset + (madStream.this_frame - madStream.buffer), numSamples);
+                numSamples += 32 * MAD_NSBSAMPLES(&madHeader);
+            }
+            if (madStream.error != MAD_ERROR_BUFLEN)
+                break;
+        }
+
+        mad_header_finish(&madHeader);
+        mad_stream_finish(&madStream);
+
+        index->setNumSamples(numSamples);
+        if (handle_) {
+            clearerr(handle_);
+            _fseeki64(handle_, position, SEEK_SET);
+        }
+    }
+
+
+
+    int64 MadDecoder::seek(const MpegFrameIndex& index, int64 sample)
+    {
+        if (initialized_ == false) THROW(std::exception, "MadDecoder not initialized");
+        if (index.empty()) THROW(std::exception, "Frame index is empty");
+
+        sample = std::max<int64>(0, std::min(sample, index.getNumSamples()));
+        size_t target = index.findFrame(sample);
+        size_t first = target > numWarmupFrames_s ? target - numWarmupFrames_s : 0;
+
+        restart(index[first].offset_);
+
+        int64 offset;
+        do {
+            offset = synthNextFrame();
+            if (offset < 0)
+                THROW(std::exception, "Unexpected end of file while seeking");
+        } while (offset < index[target].offset_);
+
+        currentFrame_ = (int)(sample - index[target].sample_);
+        ASSERT(currentFrame_ <= (int)madSynth_.pcm.length);
+
+        return sample;
+    }
+
+
+
+    int64 MadDecoder::getNumLeadingFrames() const
+    {
+        if (xing_.encoderDelay_ == 0 && xing_.encoderPadding_ == 0)
+            return 0;
+
+        return xing_.frameSize_ + xing_.encoderDelay_ + synthesisDelay_s;
+    }
+
+
+
+    int64 MadDecoder::getNumTrailingFrames() const
+    {
+        if (xing_.encoderDelay_ == 0 && xing_.encoderPadding_ == 0)
+            return 0;
+
+        return std::max(0, xing_.encoderPadding_ - synthesisDelay_s);
+    }
+
+
+
+    int64 MadDecoder::seekApproximate(int64 sample, int64 numSamples)
+    {
+        if (initialized_ == false) THROW(std::exception, "MadDecoder not initialized");
+        if (xing_.hasToc_ == false || numSamples <= 0) THROW(std::exception, "No table of contents available");
+
+        sample = std::max<int64>(0, std::min(sample, numSamples));
+
+        int64 numBytes = xing_.numBytes_;
+        if (numBytes == 0) {
+            numBytes = payloadEnd_ - xing_.offset_;
+        }
+
+        double percent = std::min(99.999, 100. * sample / numSamples);
+        int i = (int)percent;
+        double a = xing_.toc_[i];
+        double b = (i < 99) ? xing_.toc_[i + 1] : 256.;
+        double fraction = (a + (b - a) * (percent - i)) / 256.;
+
+        restart(xing_.offset_ + (int64)(fraction * numBytes));
+
+        for (int n = 0; n < numWarmupFrames_s; ++n) {
+            if (synthNextFrame() < 0) break;
+        }
+        currentFrame_ = 0;
+
+        return sample;
+    }
+
+
+
+    // Discards the decoder state and continues decoding at offset.
+    //
+    void MadDecoder::restart(int64 offset)
+    {
+        resetStream();
+        mad_frame_mute(&madFrame_);
+        mad_synth_mute(&madSynth_);
+        madSynth_.pcm.length = 0;
+        currentFrame_ = 0;
+        bufferOffset_ = offset;
+        endOfInput_ = false;
+
+        if (handle_)
+        {
+            clearerr(handle_);
+            if (_fseeki64(handle_, offset, SEEK_SET) != 0)
+                THROW(std::exception, "%s", strerror(errno));
+        }
+        readMpgFile();
+    }
+
+
+
+    // Decodes and synthesizes the next frame.
+    // Frames with damaged audio data are muted, so the timeline is kept.
+    // Returns the file offset of the frame, or -1 at the end of the file.
+    //
+    int64 MadDecoder::synthNextFrame()
+    {
+        while (mad_frame_decode(&madFrame_, &madStream_))
+        {
+            if (madStream_.error == MAD_ERROR_BUFLEN) {
+                if (readMpgFile() == false)
+                    return -1;
+                continue;
+            }
+            if (MAD_RECOVERABLE(madStream_.error) == 0)
+                THROW(std::exception, "unrecoverable frame level error (%s).", mad_stream_errorstr(&madStream_));
+
+            if (madStream_.error < MAD_ERROR_BADCRC) {      // header error, no frame was consumed
+                consumeId3Tag();
+                continue;
+            }
+            mad_frame_mute(&madFrame_);                     // e.g. bit reservoir not yet filled
+            break;
+        }
+        synthFrame();
+        currentFrame_ = 0;
+
+        return bufferOffset_ + (madStream_.this_frame - madStream_.buffer);
+    }
+
+
+
     //
     // Read up samples from madSynth_
     // If needed, read some more MP3 data, decode them and synth them
-    // Place in audioBuffer_.
+    // Place them interleaved in output.
     // Return number of samples read.
     //
-    size_t MadDecoder::decode(size_t numPendingTotal, AudioBuffer* buffer)
+    size_t MadDecoder::decode(size_t numPendingTotal, float* output)
     {
         size_t numProcessedTotal = 0;
-        int numChannels = getNumChannels();
-        mad_fixed_t sample;
+        size_t numChannels = getNumChannels();
 
         do {
-            size_t numPendingFrame = (madSynth_.pcm.length - currentFrame_) * numChannels;
-            numPendingFrame = std::min(numPendingTotal, numPendingFrame);
-            size_t numProcessedFrame = 0;
-
-            while (numProcessedFrame < numPendingFrame)
+            size_t numFrames = std::min(numPendingTotal / numChannels, (size_t)(madSynth_.pcm.length - currentFrame_));
+            if (numFrames > 0)
             {
-                for (int channel = 0; channel < numChannels; channel++)
-                {
-                    sample = madSynth_.pcm.samples[channel][currentFrame_];
-                    if (sample < -MAD_F_ONE)
-                        sample = -MAD_F_ONE;
-                    else if (sample >= MAD_F_ONE)
-                        sample = MAD_F_ONE - 1;
-
-                    float fSample = (float)(sample / (float)(1L << MAD_F_FRACBITS));
-                    float* pos = buffer->getHead() + numProcessedTotal;
-                    *pos = fSample;
-                    numProcessedFrame++;
-                    numProcessedTotal++;
-                }
-                currentFrame_++;
+                // a mono frame is duplicated when stereo output is requested
+                const mad_fixed_t* left = madSynth_.pcm.samples[0] + currentFrame_;
+                const mad_fixed_t* channels[2] = { left, (madSynth_.pcm.channels > 1) ? madSynth_.pcm.samples[1] + currentFrame_ : left };
+                convertFixedToFloat(channels, numChannels, MAD_F_FRACBITS, output + numProcessedTotal, numFrames);
+
+                currentFrame_ += numFrames;
+                numProcessedTotal += numFrames * numChannels;
+                numPendingTotal -= numFrames * numChannels;
             }
-
-            numPendingTotal -= numProcessedFrame;
-            if (numPendingTotal == 0)
+            if (numPendingTotal < numChannels)      // no complete sample frame pending
                 break;
 
             if (madStream_.error == MAD_ERROR_BUFLEN) {     // check whether input buffer needs a refill 
@@ -342,7 +750,7 @@ namespace e3 {
                 }
             }
             mad_timer_add(&madTimer_, madFrame_.header.duration);
-            mad_synth_frame(&madSynth_, &madFrame_);
+            synthFrame();
             currentFrame_ = 0;
             numMpegFrames_++;
         } while (true);
@@ -352,6 +760,37 @@ namespace e3 {
 
 
 
+    // Synthesizes the decoded frame to PCM.
+    // For mono output of a stereo frame the subband samples are mixed down
+    // and only one channel is synthesized. The synthesis filter is linear,
+    // so this equals mixing the synthesized channels.
+    //
+    void MadDecoder::synthFrame()
+    {
+        if (numOutputChannels_ != 1 || MAD_NCHANNELS(&madFrame_.header) == 1) {
+            mad_synth_frame(&madSynth_, &madFrame_);
+            return;
+        }
+
+        int numSlots = MAD_NSBSAMPLES(&madFrame_.header);
+        for (int s = 0; s < numSlots; ++s)
+        {
+            mad_fixed_t* left = madFrame_.sbsample[0][s];
+            const mad_fixed_t* right = madFrame_.sbsample[1][s];
+
+            for (int sb = 0; sb < 32; ++sb) {
+                left[sb] = (left[sb] >> 1) + (right[sb] >> 1);
+            }
+        }
+
+        enum mad_mode mode = madFrame_.header.mode;
+        madFrame_.header.mode = MAD_MODE_SINGLE_CHANNEL;
+        mad_synth_frame(&madSynth_, &madFrame_);
+        madFrame_.header.mode = mode;
+    }
+
+
+
     // Attempts to read an ID3 tag at the current location in stream and
     // consume it all.  Returns SOX_EOF if no tag is found.  Its up to
     // caller to recover.
@@ -404,45 +843,126 @@ namespace e3 {
             return 128;
         }
 
-        // ID3V2
-        if (length >= 10 &&
-            (data[0] == 'I' && data[1] == 'D' && data[2] == '3') &&
-            data[3] < 0xff && data[4] < 0xff &&
-            data[6] < 0x80 && data[7] < 0x80 && data[8] < 0x80 && data[9] < 0x80)
+        // ID3V2, padding is part of the tag size
+        if (length >= 10)
         {
-            unsigned char flags;
-            unsigned int size;
-            flags = data[5];
-            size = 10 + (data[6] << 21) + (data[7] << 14) + (data[8] << 7) + data[9];
-            if (flags & ID3_TAG_FLAG_FOOTERPRESENT)
-                size += 10;
-            for (; size < length && !data[size]; ++size);  // Consume padding 
-            return size;
+            return (int)getId3v2TagSize(data, 'I', 'D', '3');
         }
         return 0;
     }
 
 
 
-    unsigned long MadDecoder::xingFrames(struct mad_bitptr ptr, unsigned bitlen)
+    // Returns the size of an ID3v2 tag including header and footer from its
+    // 10 byte header ("ID3") or footer ("3DI"), or 0 if data is neither.
+    //
+    size_t MadDecoder::getId3v2TagSize(const unsigned char* data, char id0, char id1, char id2)
+    {
+        if (data[0] != id0 || data[1] != id1 || data[2] != id2 ||
+            data[3] == 0xff || data[4] == 0xff ||
+            data[6] >= 0x80 || data[7] >= 0x80 || data[8] >= 0x80 || data[9] >= 0x80)
+        {
+            return 0;
+        }
+
+        unsigned char flags = data[5];
+        size_t size = 10 + (data[6] << 21) + (data[7] << 14) + (data[8] << 7) + data[9];
+        if (flags & ID3_TAG_FLAG_FOOTERPRESENT)
+            size += 10;
+
+        return size;
+    }
+
+
+
+    uint32 MadDecoder::readLittleEndian32(const unsigned char* data)
+    {
+        return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32)data[3] << 24);
+    }
+
+
+
+    // Parses the Xing header, or the Info header written by LAME for CBR files.
+    // The LAME extension provides encoder delay and padding.
+    // Returns true if a header was found.
+    //
+    bool MadDecoder::parseXingHeader(struct mad_bitptr ptr, unsigned bitlen, XingHeader* xing)
     {
 #define XING_MAGIC ( ('X' << 24) | ('i' << 16) | ('n' << 8) | 'g' )
+#define INFO_MAGIC ( ('I' << 24) | ('n' << 16) | ('f' << 8) | 'o' )
+#define LAME_MAGIC ( ('L' << 24) | ('A' << 16) | ('M' << 8) | 'E' )
+        enum { XingFrames = 1, XingBytes = 2, XingToc = 4, XingQuality = 8 };
 
-        if (bitlen >= 96 && mad_bit_read(&ptr, 32) == XING_MAGIC && (mad_bit_read(&ptr, 32) & 1))  // XING_FRAMES
-            return mad_bit_read(&ptr, 32);
+        if (bitlen < 64)
+            return false;
 
-        return 0;
+        unsigned long magic = mad_bit_read(&ptr, 32);
+        if (magic != XING_MAGIC && magic != INFO_MAGIC)
+            return false;
+
+        unsigned long flags = mad_bit_read(&ptr, 32);
+        bitlen -= 64;
+
+        if (flags & XingFrames) {
+            if (bitlen < 32) return false;
+            xing->numFrames_ = mad_bit_read(&ptr, 32);
+            bitlen -= 32;
+        }
+        if (flags & XingBytes) {
+            if (bitlen < 32) return false;
+            xing->numBytes_ = mad_bit_read(&ptr, 32);
+            bitlen -= 32;
+        }
+        if (flags & XingToc) {
+            if (bitlen < 800) return false;
+            for (int i = 0; i < 100; ++i) {
+                xing->toc_[i] = (unsigned char)mad_bit_read(&ptr, 8);
+            }
+            xing->hasToc_ = true;
+            bitlen -= 800;
+        }
+        if (flags & XingQuality) {
+            if (bitlen < 32) return true;
+            mad_bit_skip(&ptr, 32);
+            bitlen -= 32;
+        }
+
+        // LAME extension: 9 bytes version string, 12 bytes of settings,
+        // then 12 bits encoder delay and 12 bits padding
+        if (bitlen >= 24 * 8 && mad_bit_read(&ptr, 32) == LAME_MAGIC)
+        {
+            mad_bit_skip(&ptr, 17 * 8);
+            xing->encoderDelay_ = (int)mad_bit_read(&ptr, 12);
+            xing->encoderPadding_ = (int)mad_bit_read(&ptr, 12);
+        }
+        return true;
     }
 
 
 
-    void MadDecoder::timerMultiply(mad_timer_t* t, double d)
+    // Parses the VBRI header written by the Fraunhofer encoder.
+    // It is located 32 bytes after the header of the first frame.
+    // Returns true if a header was found.
+    //
+    bool MadDecoder::parseVbriHeader(const unsigned char* frame, size_t length, XingHeader* xing)
     {
-        t->seconds = (signed long)(d *= (t->seconds + t->fraction * (1. / MAD_TIMER_RESOLUTION)));
-        t->fraction = (unsigned long)((d - t->seconds) * MAD_TIMER_RESOLUTION + .5);
+        const size_t vbriOffset = 4 + 32;
+        if (length < vbriOffset + 18)
+            return false;
+
+        const unsigned char* data = frame + vbriOffset;
+        if (data[0] != 'V' || data[1] != 'B' || data[2] != 'R' || data[3] != 'I')
+            return false;
+
+        xing->encoderDelay_ = (data[6] << 8) | data[7];
+        xing->numBytes_ = ((unsigned long)data[10] << 24) | (data[11] << 16) | (data[12] << 8) | data[13];
+        xing->numFrames_ = ((unsigned long)data[14] << 24) | (data[15] << 16) | (data[16] << 8) | data[17];
+
+        return true;
     }
 
 
+
     //-------------------------------------------------------------------------
     // static members
     //-------------------------------------------------------------------------
@@ -0,0 +1,104 @@
+//------------------------------------------------------------
+// MadDecoderPool.cpp
+// Pool of reusable MadDecoder instances
+//------------------------------------------------------------
+
+#include <e3_Exception.h>
+
+#include <MadDecoder.h>
+#include <MadDecoderPool.h>
+
+
+namespace e3 {
+
+    DEFINE_THREADSAFE_SINGLETON(MadDecoderPool)
+
+
+    MadDecoderPool::MadDecoderPool() :
+        maxSize_(8)
+    {}
+
+
+
+    MadDecoderPool::~MadDecoderPool()
+    {
+        clear();
+    }
+
+
+
+    MadDecoder* MadDecoderPool::acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (decoders_.empty() == false)
+            {
+                MadDecoder* decoder = decoders_.back();
+                decoders_.pop_back();
+                return decoder;
+            }
+        }
+        return new MadDecoder();
+    }
+
+
+
+    void MadDecoderPool::release(MadDecoder* decoder)
+    {
+        if (decoder == NULL)
+            return;
+
+        decoder->finish();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (decoders_.size() < maxSize_)
+            decoders_.push_back(decoder);
+        else
+            delete decoder;
+    }
+
+
+
+    void MadDecoderPool::setMaxSize(size_t maxSize)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        maxSize_ = maxSize;
+        while (decoders_.size() > maxSize_)
+        {
+            delete decoders_.back();
+            decoders_.pop_back();
+        }
+    }
+
+
+
+    size_t MadDecoderPool::getMaxSize() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return maxSize_;
+    }
+
+
+
+    size_t MadDecoderPool::getNumAvailable() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return decoders_.size();
+    }
+
+
+
+    void MadDecoderPool::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        for (DecoderVector::iterator it = decoders_.begin(); it != decoders_.end(); ++it) {
+            delete *it;
+        }
+        decoders_.clear();
+    }
+
+} // namespace e3
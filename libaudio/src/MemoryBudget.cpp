@@ -0,0 +1,326 @@
+//------------------------------------------------------------
+// MemoryBudget.cpp
+// Accounting of resident sample memory with spill-to-disk
+//------------------------------------------------------------
+
+#include <cstring>
+#include <cstdlib>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <e3_Exception.h>
+#include <e3_Trace.h>
+
+#include <AudioBuffer.h>
+#include <MemoryBudget.h>
+
+
+namespace e3 {
+
+    DEFINE_THREADSAFE_SINGLETON(MemoryBudget)
+    std::atomic<uint64> MemoryBudget::clock_s(0);
+
+
+    MemoryBudget::MemoryBudget() :
+        budget_(0)
+    {
+        boost::system::error_code error;
+        scratchDirectory_ = boost::filesystem::temp_directory_path(error);
+    }
+
+
+
+    void MemoryBudget::setBudget(int64 numBytes)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        budget_ = numBytes;
+        enforce(nullptr);
+    }
+
+
+
+    int64 MemoryBudget::getBudget() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        return budget_;
+    }
+
+
+
+    void MemoryBudget::setScratchDirectory(const boost::filesystem::path& directory)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        scratchDirectory_ = directory;
+    }
+
+
+
+    boost::filesystem::path MemoryBudget::getScratchDirectory() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        return scratchDirectory_;
+    }
+
+
+
+    MemoryBudget::Usage MemoryBudget::getUsage() const
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        Usage total;
+        for (int i = 0; i < MemoryCategoryCount; ++i)
+        {
+            total.numResidentBytes_ += usage_[i].numResidentBytes_;
+            total.numSpilledBytes_  += usage_[i].numSpilledBytes_;
+            total.numBuffers_       += usage_[i].numBuffers_;
+        }
+        return total;
+    }
+
+
+
+    MemoryBudget::Usage MemoryBudget::getUsage(MemoryCategory category) const
+    {
+        ASSERT(category >= 0 && category < MemoryCategoryCount);
+
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+        return usage_[category];
+    }
+
+
+
+    const char* MemoryBudget::getCategoryName(MemoryCategory category)
+    {
+        static const char* names[] = { "Samples", "Preview", "Processing" };
+
+        return (category >= 0 && category < MemoryCategoryCount) ? names[category] : "Unknown";
+    }
+
+
+
+    //--------------------------------------------------------------------
+    // AudioBuffer interface
+    //--------------------------------------------------------------------
+
+    void MemoryBudget::add(AudioBuffer* buffer)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        buffers_.insert(buffer);
+        usage_[buffer->category_].numBuffers_++;
+        update(buffer);
+    }
+
+
+
+    void MemoryBudget::remove(AudioBuffer* buffer)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (buffers_.erase(buffer) == 0)
+            return;
+
+        discard(buffer);
+
+        Usage& usage = usage_[buffer->category_];
+        usage.numResidentBytes_ -= buffer->numAccountedBytes_;
+        usage.numBuffers_--;
+        buffer->numAccountedBytes_ = 0;
+    }
+
+
+
+    void MemoryBudget::update(AudioBuffer* buffer)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (buffer->spilled_)           // spilled data is accounted by spill() and discard()
+            return;
+
+        int64 numBytes = calcNumBytes(buffer);
+        usage_[buffer->category_].numResidentBytes_ += numBytes - buffer->numAccountedBytes_;
+        buffer->numAccountedBytes_ = numBytes;
+        buffer->lastAccess_ = tick();
+
+        enforce(buffer);
+    }
+
+
+
+    void MemoryBudget::restore(AudioBuffer* buffer)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (buffer->spilled_ == false)  // restored by another thread meanwhile
+            return;
+
+        size_t numBytes = (size_t)buffer->numAccountedBytes_;
+        float* data = static_cast<float*>(malloc(numBytes));
+        if (data == nullptr)
+            THROW(std::exception, "Not enough memory to restore spilled buffer");
+
+        try {
+            boost::iostreams::mapped_file_source file(buffer->spillPath_);
+            memcpy(data, file.data(), numBytes);
+        }
+        catch (const std::exception& e)
+        {
+            ::free(data);
+            THROW(std::exception, "Spilled buffer can not be restored from %s: %s", buffer->spillPath_.c_str(), e.what());
+        }
+
+        boost::system::error_code error;
+        boost::filesystem::remove(buffer->spillPath_, error);
+        buffer->spillPath_.clear();
+        buffer->data_ = data;
+        buffer->spilled_ = false;
+
+        Usage& usage = usage_[buffer->category_];
+        usage.numSpilledBytes_  -= numBytes;
+        usage.numResidentBytes_ += numBytes;
+
+        enforce(buffer);
+    }
+
+
+
+    // Takes the lock enforce() holds while it spills, a buffer can not be
+    // spilled between the test of isPinned() and the write of its data.
+    //
+    void MemoryBudget::pin(AudioBuffer* buffer)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        ++buffer->numPins_;
+        buffer->lastAccess_ = tick();
+        if (buffer->spilled_)
+        {
+            try {
+                restore(buffer);
+            }
+            catch (const std::exception&)
+            {
+                --buffer->numPins_;
+                throw;
+            }
+        }
+    }
+
+
+
+    void MemoryBudget::setCategory(AudioBuffer* buffer, MemoryCategory category)
+    {
+        ASSERT(category >= 0 && category < MemoryCategoryCount);
+
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        Usage& from = usage_[buffer->category_];
+        Usage& to   = usage_[category];
+        int64& fromBytes = buffer->spilled_ ? from.numSpilledBytes_ : from.numResidentBytes_;
+        int64& toBytes   = buffer->spilled_ ? to.numSpilledBytes_ : to.numResidentBytes_;
+
+        fromBytes -= buffer->numAccountedBytes_;
+        toBytes   += buffer->numAccountedBytes_;
+        from.numBuffers_--;
+        to.numBuffers_++;
+
+        buffer->category_ = category;
+    }
+
+
+
+    //--------------------------------------------------------------------
+    // Spilling
+    //--------------------------------------------------------------------
+
+    void MemoryBudget::enforce(const AudioBuffer* exclude)
+    {
+        if (budget_ <= 0)
+            return;
+
+        int64 numResident = getUsage().numResidentBytes_;
+
+        while (numResident > budget_)
+        {
+            // find the least recently used buffer that can be spilled
+            AudioBuffer* candidate = nullptr;
+            for (BufferSet::iterator it = buffers_.begin(); it != buffers_.end(); ++it)
+            {
+                AudioBuffer* buffer = *it;
+                if (buffer == exclude || buffer->spilled_ || buffer->isPinned() || buffer->data_ == nullptr)
+                    continue;
+
+                if (candidate == nullptr || buffer->lastAccess_ < candidate->lastAccess_)
+                    candidate = buffer;
+            }
+            if (candidate == nullptr)
+                break;
+
+            try {
+                numResident -= candidate->numAccountedBytes_;
+                spill(candidate);
+            }
+            catch (const std::exception& e)
+            {
+                TRACE("MemoryBudget: spilling failed: %s\n", e.what());
+                break;
+            }
+        }
+    }
+
+
+
+    void MemoryBudget::spill(AudioBuffer* buffer)
+    {
+        ASSERT(buffer->spilled_ == false);
+
+        size_t numBytes = (size_t)buffer->numAccountedBytes_;
+        boost::filesystem::path path = scratchDirectory_ / boost::filesystem::unique_path("e3-%%%%-%%%%-%%%%-%%%%.spill");
+
+        boost::iostreams::mapped_file_params params(path.string());
+        params.flags         = boost::iostreams::mapped_file::readwrite;
+        params.new_file_size = numBytes;
+
+        boost::iostreams::mapped_file file(params);
+        memcpy(file.data(), buffer->data_, numBytes);
+        file.close();
+
+        ::free(buffer->data_);
+        buffer->data_ = nullptr;             // size_ and numFrames_ are kept
+        buffer->spillPath_ = path.string();
+        buffer->spilled_ = true;
+
+        Usage& usage = usage_[buffer->category_];
+        usage.numResidentBytes_ -= numBytes;
+        usage.numSpilledBytes_  += numBytes;
+    }
+
+
+
+    void MemoryBudget::discard(AudioBuffer* buffer)
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+        if (buffer->spilled_ == false)
+            return;
+
+        boost::system::error_code error;
+        boost::filesystem::remove(buffer->spillPath_, error);
+        buffer->spillPath_.clear();
+        buffer->size_ = 0;
+        buffer->spilled_ = false;
+
+        Usage& usage = usage_[buffer->category_];
+        usage.numSpilledBytes_ -= buffer->numAccountedBytes_;
+        buffer->numAccountedBytes_ = 0;
+    }
+
+
+
+    int64 MemoryBudget::calcNumBytes(const AudioBuffer* buffer) const
+    {
+        return buffer->data_ ? buffer->size_ * sizeof(float) : 0;
+    }
+
+} // namespace e3
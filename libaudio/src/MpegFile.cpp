@@ -3,18 +3,25 @@
 // AudioFormatManager.cpp
 //--------------------------------------------------------
 
+#include <cmath>
 #include <cstdio>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#include <boost/bind.hpp>
 
 #include <e3_Exception.h>
+#include <e3_Trace.h>
 
 #include <AudioBuffer.h>
 #include <AudioFormat.h>
 #include <FormatManager.h>
 #include <MadDecoder.h>
+#include <MadDecoderPool.h>
 #include <MpegFile.h>
 
 
@@ -22,7 +29,15 @@ namespace e3 {
 
     MpegFile::MpegFile() : AudioFile(),
         handle_(NULL),
-        decoder_(NULL)
+        decoder_(NULL),
+        fastSeeking_(false),
+        persistentIndex_(false),
+        numLoadThreads_(1),
+        numOutputChannels_(0),
+        targetSampleRate_(0),
+        memoryMapped_(false),
+        pendingPos_(0),
+        endOfInput_(false)
     {}
 
 
@@ -37,20 +52,45 @@ namespace e3 {
     {
         AudioFile::open(filename, mode);
 
-        switch (fileOpenMode_)
+        if (fileOpenMode_ != OpenRead)
+            THROW(std::exception, "Only read mode is suported for MPEG");
+
+        if (memoryMapped_)
         {
-        case OpenRead: handle_ = fopen(filename_.string().c_str(), "rb"); break;
-        default:       THROW(std::exception, "Only read mode is suported for MPEG");
+            try {
+                mappedFile_.open(filename_.string());
+            }
+            catch (const std::exception& e) {
+                THROW(std::exception, "%s: %s", e.what(), filename_.string().c_str());
+            }
+            decoder_ = MadDecoderPool::instance().acquire();
+            decoder_->setNumOutputChannels(numOutputChannels_);
+            numFrames_ = decoder_->start(getMappedData(), mappedFile_.size());
         }
+        else
+        {
+            handle_ = fopen(filename_.string().c_str(), "rb");
+            if (handle_ == NULL)
+                THROW(std::exception, "%s: %s", strerror(errno), filename_.string().c_str());
 
-        if (handle_ == NULL)
-            THROW(std::exception, "%s: %s", strerror(errno), filename_.string().c_str());
-
-        decoder_ = new MadDecoder();
-        numFrames_ = decoder_->start(handle_);   // estimated value (when mpeg is CBR) 
+            decoder_ = MadDecoderPool::instance().acquire();
+            decoder_->setNumOutputChannels(numOutputChannels_);
+            numFrames_ = decoder_->start(handle_);
+        }
 
-        sampleRate_ = decoder_->getSampleRate();
+        int sourceRate = decoder_->getSampleRate();
+        sampleRate_ = (targetSampleRate_ > 0) ? targetSampleRate_ : sourceRate;
         numChannels_ = decoder_->getNumChannels();
+        resampler_.init(numChannels_, sourceRate, sampleRate_);
+
+        // The length is exact if the file has a Xing, Info or VBRI header,
+        // otherwise it is taken from the frame index.
+        if (numFrames_ == 0) {
+            buildIndex();
+        }
+        else {
+            numFrames_ = toOutputFrames(numFrames_);
+        }
         format_ = FormatManager::getFormat(FORMAT_MPEG);
         codec_ = FormatManager::getCodec(decoder_->getCodecId());
     }
@@ -61,6 +101,21 @@ namespace e3 {
     {
         ASSERT(isReadable());
 
+        if (resampler_.isPassThrough() == false) {
+            loadResampled(buffer);
+            return;
+        }
+
+        size_t numThreads = (numLoadThreads_ > 0) ? numLoadThreads_ : std::max(1u, std::thread::hardware_concurrency());
+        if (numThreads > 1)
+        {
+            size_t numRanges = std::min(numThreads, getFrameIndex().size() / minFramesPerRange_s);
+            if (numRanges > 1) {
+                loadParallel(buffer, numRanges);
+                return;
+            }
+        }
+
         try {
             buffer->setSampleRate(sampleRate_);
             buffer->setNumChannels(numChannels_);
@@ -70,9 +125,27 @@ namespace e3 {
 
             if (buffer->size() == numSamples)
             {
-                int numProcessed = decoder_->decode(numSamples, buffer);
-                buffer->resize(numProcessed, false);
-                numFrames_ = buffer->getNumFrames();    // now we know the real size
+                ScopedPin pin(buffer);      // the decoder writes through the raw pointer
+                size_t blockSize = (size_t)(progressBlockSize_s * numChannels_);
+                size_t numProcessed = 0;
+                beginOverview();
+
+                while (numProcessed < numSamples)
+                {
+                    size_t numPending = std::min(blockSize, numSamples - numProcessed);
+                    size_t numDecoded = decoder_->decode(numPending, buffer->getHead() + numProcessed);
+
+                    addToOverview(buffer->getHead() + numProcessed, numDecoded / numChannels_);
+                    numProcessed += numDecoded;
+                    reportProgress(numProcessed / numChannels_);
+                    if (numDecoded < numPending)
+                        break;
+                }
+                if (numProcessed != numSamples) {           // damaged file or wrong header
+                    buffer->resize(numProcessed, false);
+                    numFrames_ = buffer->getNumFrames();
+                }
+                finishOverview();
             }
             else THROW(std::exception, "Out of memory");
         }
@@ -85,16 +158,284 @@ namespace e3 {
 
 
 
+    // Decoded blocks are converted as they come, so the samples are
+    // never held at the rate of the file.
+    //
+    void MpegFile::loadResampled(AudioBuffer* buffer)
+    {
+        try {
+            buffer->setSampleRate(sampleRate_);
+            buffer->setNumChannels(numChannels_);
+
+            size_t size = (size_t)((numFrames_ + 64) * numChannels_);
+            buffer->resize(size);
+            if (buffer->size() != size)
+                THROW(std::exception, "Out of memory");
+
+            ScopedPin pin(buffer);
+            int64_t numDone = 0;
+            beginOverview();
+            while (true)
+            {
+                int64_t numFrames = std::min<int64_t>(progressBlockSize_s, buffer->getNumFrames() - numDone);
+                if (numFrames == 0)                 // numFrames_ was too small
+                {
+                    size = (size_t)((numDone + progressBlockSize_s) * numChannels_);
+                    if (buffer->resize(size, false) == NULL || buffer->size() != size)
+                        THROW(std::exception, "Out of memory");
+                    continue;
+                }
+
+                int64_t numRead = readResampled(buffer->getHead() + numDone * numChannels_, numFrames);
+                addToOverview(buffer->getHead() + numDone * numChannels_, numRead);
+                numDone += numRead;
+                reportProgress(numDone);
+
+                if (numRead < numFrames)
+                    break;
+            }
+            buffer->resize((size_t)(numDone * numChannels_), false);
+            numFrames_ = numDone;
+            finishOverview();
+        }
+        catch (const std::exception& e)
+        {
+            buffer->resize(0);
+            throw e;
+        }
+    }
+
+
+
+    // Each range is decoded by its own decoder and file handle
+    // directly into its slice of the buffer.
+    //
+    void MpegFile::loadParallel(AudioBuffer* buffer, size_t numRanges)
+    {
+        numFrames_ = index_.getNumSamples();
+
+        std::vector<int64_t> rangeStarts(numRanges), rangeEnds(numRanges);
+        for (size_t i = 0; i < numRanges; ++i)
+        {
+            rangeStarts[i] = index_[i * index_.size() / numRanges].sample_;
+            rangeEnds[i] = (i + 1 < numRanges) ? index_[(i + 1) * index_.size() / numRanges].sample_ : numFrames_;
+        }
+
+        runParallelLoad(buffer, numRanges, boost::bind(&MpegFile::decodeRange, this, boost::cref(rangeStarts), boost::cref(rangeEnds), _1, _2, _3), rangeEnds);
+    }
+
+
+
+    // Returns the sample behind the last one decoded, less than
+    // the end of the range if the decoder ran out of data.
+    //
+    int64_t MpegFile::decodeRange(const std::vector<int64_t>& rangeStarts, const std::vector<int64_t>& rangeEnds, size_t range, float* output, ParallelLoad* load)
+    {
+        int64 sample = rangeStarts[range];
+        int64 endSample = rangeEnds[range];
+
+        FILE* handle = NULL;
+        MadDecoder* decoder = MadDecoderPool::instance().acquire();
+
+        try {
+            decoder->setNumOutputChannels(numOutputChannels_);
+            if (mappedFile_.is_open()) {        // all threads share the mapping
+                decoder->attach(getMappedData(), mappedFile_.size());
+            }
+            else {
+                handle = fopen(filename_.string().c_str(), "rb");
+                if (handle == NULL)
+                    THROW(std::exception, "%s: %s", strerror(errno), filename_.string().c_str());
+                decoder->attach(handle);
+            }
+            decoder->seek(index_, sample);
+            int64 blockSize = progressBlockSize_s;
+
+            while (sample < endSample && load->stop_ == false)
+            {
+                int64 numFrames = std::min(blockSize, endSample - sample);
+                int64 numRead = (int64)decoder->read(output + sample * numChannels_, (size_t)numFrames);
+
+                sample += numRead;
+                load->numDone_ += numRead;
+                if (numRead < numFrames)
+                    break;
+            }
+        }
+        catch (...)
+        {
+            MadDecoderPool::instance().release(decoder);
+            if (handle) {
+                fclose(handle);
+            }
+            throw;
+        }
+
+        MadDecoderPool::instance().release(decoder);
+        if (handle) {
+            fclose(handle);
+        }
+        return sample;
+    }
+
+
+
+    int64_t MpegFile::read(float* data, int64_t numFrames)
+    {
+        ASSERT(isReadable());
+
+        if (resampler_.isPassThrough() == false)
+            return readResampled(data, numFrames);
+
+        return decoder_->read(data, (size_t)numFrames);
+    }
+
+
+
+    int64_t MpegFile::getNumLeadingFrames() const
+    {
+        return decoder_ ? toOutputFrames(decoder_->getNumLeadingFrames()) : 0;
+    }
+
+
+
+    int64_t MpegFile::getNumTrailingFrames() const
+    {
+        return decoder_ ? toOutputFrames(decoder_->getNumTrailingFrames()) : 0;
+    }
+
+
+
+    // Decodes blocks at the rate of the file into pending_
+    // and converts them to the target rate.
+    //
+    int64_t MpegFile::readResampled(float* data, int64_t numFrames)
+    {
+        const int64 blockSize = 4096;
+        int64_t numDone = 0;
+
+        while (numDone < numFrames)
+        {
+            if (pendingPos_ == pending_.size() && endOfInput_ == false)
+            {
+                pending_.resize((size_t)(blockSize * numChannels_));
+                size_t numRead = decoder_->read(&pending_[0], (size_t)blockSize);
+
+                pending_.resize(numRead * numChannels_);
+                pendingPos_ = 0;
+                endOfInput_ = numRead < (size_t)blockSize;
+            }
+
+            int64 numAvailable = (pending_.size() - pendingPos_) / numChannels_;
+            int64 numUsed = 0;
+            int64 numGenerated = resampler_.process(pending_.data() + pendingPos_, numAvailable,
+                data + numDone * numChannels_, numFrames - numDone, numUsed, endOfInput_);
+
+            pendingPos_ += (size_t)(numUsed * numChannels_);
+            numDone += numGenerated;
+
+            if (endOfInput_ && numAvailable == 0 && numGenerated == 0)     // converter drained
+                break;
+        }
+        return numDone;
+    }
+
+
+
+    int64_t MpegFile::seek(int64_t frame)
+    {
+        ASSERT(isReadable());
+
+        if (resampler_.isPassThrough() == false)       // frames of the target rate
+        {
+            resampler_.reset();
+            pending_.clear();
+            pendingPos_ = 0;
+            endOfInput_ = false;
+
+            int64_t sourceFrame = (int64_t)(frame / resampler_.getRatio());
+            return (int64_t)(seekSource(sourceFrame) * resampler_.getRatio());
+        }
+        return seekSource(frame);
+    }
+
+
+
+    int64_t MpegFile::seekSource(int64_t frame)
+    {
+        if (index_.empty())
+        {
+            if (fastSeeking_ && decoder_->hasToc())
+                return decoder_->seekApproximate(frame, (int64)(numFrames_ / resampler_.getRatio()));
+            buildIndex();
+        }
+        return decoder_->seek(index_, frame);
+    }
+
+
+
+    const MpegFrameIndex& MpegFile::getFrameIndex()
+    {
+        ASSERT(isReadable());
+
+        if (index_.empty())
+            buildIndex();
+
+        return index_;
+    }
+
+
+
+    void MpegFile::buildIndex()
+    {
+        Path indexPath = MpegFrameIndex::getIndexPath(filename_);
+
+        if (MpegFrameIndex::lookup(filename_, &index_) == false)
+        {
+            if (index_.load(indexPath, filename_) == false)
+            {
+                decoder_->buildIndex(&index_);
+
+                if (persistentIndex_ && index_.store(indexPath, filename_) == false) {
+                    TRACE("MpegFile: index file %s can not be written\n", indexPath.string().c_str());
+                }
+            }
+            MpegFrameIndex::remember(filename_, index_);
+        }
+        if (index_.getNumSamples() > 0) {
+            numFrames_ = toOutputFrames(index_.getNumSamples());    // now we know the real size
+        }
+    }
+
+
+
     void MpegFile::close()
     {
         if (decoder_) {
-            delete decoder_;
+            MadDecoderPool::instance().release(decoder_);
             decoder_ = NULL;
         }
         if (handle_) {
             fclose(handle_);
             handle_ = NULL;
         }
+        if (mappedFile_.is_open()) {
+            mappedFile_.close();
+        }
+        index_.clear();
+        pending_.clear();
+        pendingPos_ = 0;
+        endOfInput_ = false;
+    }
+
+
+
+    int64_t MpegFile::toOutputFrames(int64_t numSourceFrames) const
+    {
+        if (resampler_.isPassThrough())
+            return numSourceFrames;
+
+        return (int64_t)ceil(numSourceFrames * resampler_.getRatio());
     }
 
 
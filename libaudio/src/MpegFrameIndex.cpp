@@ -0,0 +1,206 @@
+//------------------------------------------------------------
+// MpegFrameIndex.cpp
+// Byte offset and sample position of every MPEG frame
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <e3_Exception.h>
+#include <MpegFrameIndex.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        const uint32 indexMagic   = ('E' << 24) | ('3' << 16) | ('I' << 8) | 'X';
+        const uint32 indexVersion = 1;
+
+        struct IndexHeader
+        {
+            uint32 magic_;
+            uint32 version_;
+            int64 fileSize_;
+            int64 fileTime_;
+            int64 numSamples_;
+            int64 numEntries_;
+        };
+
+        bool compareSample(int64 sample, const MpegFrameIndex::Entry& entry)
+        {
+            return sample < entry.sample_;
+        }
+
+        // The cache evicts the least recently used entry. cacheOrder_s holds
+        // the paths, most recently used first.
+        //
+        typedef std::list<std::string> CacheOrder;
+
+        struct CacheEntry
+        {
+            int64 fileSize_;
+            int64 fileTime_;
+            MpegFrameIndex index_;
+            CacheOrder::iterator order_;
+        };
+        typedef std::map<std::string, CacheEntry> IndexCache;
+
+        const size_t maxCacheEntries = 64;
+        IndexCache cache_s;
+        CacheOrder cacheOrder_s;
+        std::mutex cacheMutex_s;
+
+    } // namespace
+
+
+
+    MpegFrameIndex::MpegFrameIndex() :
+        numSamples_(0)
+    {}
+
+
+
+    void MpegFrameIndex::clear()
+    {
+        entries_.clear();
+        numSamples_ = 0;
+    }
+
+
+
+    size_t MpegFrameIndex::findFrame(int64 sample) const
+    {
+        ASSERT(entries_.empty() == false);
+
+        EntryVector::const_iterator it = std::upper_bound(entries_.begin(), entries_.end(), sample, compareSample);
+        return (it == entries_.begin()) ? 0 : (it - entries_.begin()) - 1;
+    }
+
+
+
+    bool MpegFrameIndex::load(const Path& indexPath, const Path& audioPath)
+    {
+        IndexHeader header;
+        int64 fileSize, fileTime;
+        if (AudioFile::getFileStamp(audioPath, fileSize, fileTime) == false)
+            return false;
+
+        FILE* handle = fopen(indexPath.string().c_str(), "rb");
+        if (handle == NULL)
+            return false;
+
+        bool result = fread(&header, sizeof(header), 1, handle) == 1 &&
+            header.magic_ == indexMagic && header.version_ == indexVersion &&
+            header.fileSize_ == fileSize && header.fileTime_ == fileTime &&
+            header.numEntries_ > 0;
+
+        if (result)
+        {
+            entries_.resize((size_t)header.numEntries_);
+            result = fread(&entries_[0], sizeof(Entry), entries_.size(), handle) == entries_.size();
+            numSamples_ = header.numSamples_;
+        }
+        fclose(handle);
+
+        if (result == false) {
+            clear();
+        }
+        return result;
+    }
+
+
+
+    bool MpegFrameIndex::store(const Path& indexPath, const Path& audioPath) const
+    {
+        IndexHeader header;
+        header.magic_      = indexMagic;
+        header.version_    = indexVersion;
+        header.numSamples_ = numSamples_;
+        header.numEntries_ = entries_.size();
+        if (entries_.empty() || AudioFile::getFileStamp(audioPath, header.fileSize_, header.fileTime_) == false)
+            return false;
+
+        FILE* handle = fopen(indexPath.string().c_str(), "wb");
+        if (handle == NULL)
+            return false;
+
+        bool result = fwrite(&header, sizeof(header), 1, handle) == 1 &&
+            fwrite(&entries_[0], sizeof(Entry), entries_.size(), handle) == entries_.size();
+        result &= fclose(handle) == 0;
+
+        if (result == false) {
+            boost::system::error_code error;
+            boost::filesystem::remove(indexPath, error);
+        }
+        return result;
+    }
+
+
+
+    bool MpegFrameIndex::lookup(const Path& audioPath, MpegFrameIndex* index)
+    {
+        int64 fileSize, fileTime;
+        if (AudioFile::getFileStamp(audioPath, fileSize, fileTime) == false)
+            return false;
+
+        std::lock_guard<std::mutex> lock(cacheMutex_s);
+
+        IndexCache::iterator it = cache_s.find(audioPath.string());
+        if (it == cache_s.end())
+            return false;
+
+        if (it->second.fileSize_ != fileSize || it->second.fileTime_ != fileTime) {
+            cacheOrder_s.erase(it->second.order_);      // file has changed
+            cache_s.erase(it);
+            return false;
+        }
+        cacheOrder_s.splice(cacheOrder_s.begin(), cacheOrder_s, it->second.order_);
+        *index = it->second.index_;
+        return true;
+    }
+
+
+
+    void MpegFrameIndex::remember(const Path& audioPath, const MpegFrameIndex& index)
+    {
+        CacheEntry entry;
+        if (index.empty() || AudioFile::getFileStamp(audioPath, entry.fileSize_, entry.fileTime_) == false)
+            return;
+
+        std::lock_guard<std::mutex> lock(cacheMutex_s);
+
+        std::string key = audioPath.string();
+        IndexCache::iterator it = cache_s.find(key);
+        if (it != cache_s.end())
+        {
+            cacheOrder_s.splice(cacheOrder_s.begin(), cacheOrder_s, it->second.order_);
+            entry.order_ = it->second.order_;
+        }
+        else
+        {
+            if (cache_s.size() >= maxCacheEntries) {
+                cache_s.erase(cacheOrder_s.back());
+                cacheOrder_s.pop_back();
+            }
+            entry.order_ = cacheOrder_s.insert(cacheOrder_s.begin(), key);
+        }
+        entry.index_ = index;
+        cache_s[key] = entry;
+    }
+
+
+
+    Path MpegFrameIndex::getIndexPath(const Path& audioPath)
+    {
+        Path path = audioPath;
+        path += ".e3idx";
+
+        return path;
+    }
+
+} // namespace e3
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <sstream>
 #include <boost/assign/list_of.hpp>
 
@@ -6,6 +7,7 @@
 
 #include <AudioBuffer.h>
 #include <InstrumentChunk.h>
+#include <InstrumentChunkWriter.h>
 #include <MultiFormatAudioFile.h>
 #include <FormatManager.h>
 
@@ -56,12 +58,16 @@ namespace e3 {
 
         if (handle_ != NULL)
         {
-            format_ = FormatManager::getFormat(sfInfo.format & SF_FORMAT_TYPEMASK);
-            codec_ = FormatManager::getCodec(sfInfo.format & SF_FORMAT_SUBMASK);
+            format_ = FormatManager::getFormat(toFormatId(sfInfo.format));
+            codec_ = FormatManager::getCodec(toCodecId(sfInfo.format));
             sampleRate_ = sfInfo.samplerate;
             numFrames_ = sfInfo.frames;
             numChannels_ = sfInfo.channels;
             numSections_ = sfInfo.sections;
+
+            if (fileOpenMode_ != OpenWrite) {
+                loadInstrumentChunk();
+            }
         }
 
         if (sf_error(handle_) != SF_ERR_NO_ERROR)
@@ -89,8 +95,6 @@ namespace e3 {
         ASSERT(isReadable());
 
         try {
-            loadInstrumentChunk();
-
             buffer->setSampleRate(sampleRate_);
             buffer->setNumChannels(numChannels_);
 
@@ -99,8 +103,22 @@ namespace e3 {
 
             if (buffer->size() == numFloats)
             {
+                ScopedPin pin(buffer);
                 seek(0);
-                int64 numRead = readFloat(buffer->getHead(), numFloats);
+                beginOverview();
+                size_t blockSize = (size_t)(progressBlockSize_s * numChannels_);
+                size_t numRead = 0;
+
+                while (numRead < numFloats)
+                {
+                    int64 result = readFloat(buffer->getHead() + numRead, std::min(blockSize, numFloats - numRead));
+                    if (result <= 0)
+                        break;
+
+                    addToOverview(buffer->getHead() + numRead, result / numChannels_);
+                    numRead += (size_t)result;
+                    reportProgress(numRead / numChannels_);
+                }
 
                 if (sf_error(handle_) != SF_ERR_NO_ERROR) {
                     THROW(std::exception, sf_strerror(handle_));
@@ -108,6 +126,7 @@ namespace e3 {
                 if (numRead != numFloats) {
                     THROW(std::exception, "Error reading file");
                 }
+                finishOverview();
             }
             else THROW(std::exception, "Not enough memory to load file");
         }
@@ -133,6 +152,8 @@ namespace e3 {
             THROW(std::exception, "File not writeable");
 
         storeInstrumentChunk();
+
+        ScopedPin pin(buffer);
         int64 numWritten = writeFloat(buffer->getHead(), buffer->size());
 
         if (numWritten != buffer->size()) {
@@ -161,11 +182,16 @@ namespace e3 {
         SF_INSTRUMENT data;
         int result = sf_command(handle_, SFC_GET_INSTRUMENT, &data, sizeof(data));
 
-        if (result != SF_FALSE)
+        if (result == SF_FALSE)
+        {
+            delete instrumentChunk_;
+            instrumentChunk_ = NULL;
+        }
+        else
         {
-            if (instrumentChunk_ != NULL)
-                delete instrumentChunk_;
-            instrumentChunk_ = new InstrumentChunk();
+            if (instrumentChunk_ == NULL) {         // kept when the file is opened again
+                instrumentChunk_ = new InstrumentChunk();
+            }
 
             instrumentChunk_->setGain(data.gain);
             instrumentChunk_->setBaseNote(data.basenote);
@@ -235,6 +261,25 @@ namespace e3 {
 
 
 
+    void MultiFormatAudioFile::updateInstrumentChunk()
+    {
+        if (instrumentChunk_ == NULL)
+            THROW(std::exception, "No instrument chunk to update: %s", filename_.string().c_str());
+        if (fileOpenMode_ == OpenWrite && isOpened())
+            THROW(std::exception, "File is being written, the instrument chunk is stored with the samples: %s", filename_.string().c_str());
+
+        bool wasOpened = isOpened();
+        close();
+
+        InstrumentChunkWriter::write(filename_, *instrumentChunk_);
+
+        if (wasOpened) {
+            open(filename_, fileOpenMode_);
+        }
+    }
+
+
+
     //------------------------------------------------------------
     // MultiFormatAudioFile statics
     //------------------------------------------------------------
@@ -251,10 +296,13 @@ namespace e3 {
 
     bool MultiFormatAudioFile::isFormatSupported(const FormatInfo& format, const CodecInfo& codec, int sampleRate, int numChannels)
     {
+        if (isCodecAllowed(format.id_, codec.id_) == false)
+            return false;
+
         SF_INFO sfInfo;
         memset(&sfInfo, 0, sizeof(sfInfo));
 
-        sfInfo.format = (format.idPrivate_ & SF_FORMAT_TYPEMASK) | codec.idPrivate_;
+        sfInfo.format = toSfFormat(format.id_, codec.id_);
         sfInfo.channels = numChannels;
         sfInfo.samplerate = sampleRate;
 
@@ -265,6 +313,173 @@ namespace e3 {
 
 
 
+    //------------------------------------------------------------
+    // Mapping between FormatId/CodecId and SF_FORMAT_*
+    //------------------------------------------------------------
+
+    namespace {
+
+        struct FormatMapping
+        {
+            FormatId id_;
+            int sfFormat_;              // 0 if not handled by libsndfile
+            const char* name_;
+            const char* description_;
+            unsigned codecs_;           // bit mask of allowed CodecIds
+        };
+
+        struct CodecMapping
+        {
+            CodecId id_;
+            int sfFormat_;
+            const char* name_;
+            const char* description_;
+        };
+
+#define CODEC_BIT(codec) (1u << CODEC_##codec)
+
+        const unsigned pcmCodecs = CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S24) | CODEC_BIT(PCM_S32);
+        const unsigned lawCodecs = CODEC_BIT(ULAW) | CODEC_BIT(ALAW);
+        const unsigned fltCodecs = CODEC_BIT(PCM_FLOAT) | CODEC_BIT(PCM_DOUBLE);
+        const unsigned dwvwCodecs = CODEC_BIT(DWVW_12) | CODEC_BIT(DWVW_16) | CODEC_BIT(DWVW_24);
+
+        // Indexed by FormatId. The codec masks follow sf_format_check().
+        //
+        const FormatMapping formatMappings[] =
+        {
+            { FORMAT_UNKNOWN, 0,                "",      "",                                     0 },
+            { FORMAT_AIFF,    SF_FORMAT_AIFF,   "AIFF",  "Apple/SGI AIFF",                       CODEC_BIT(PCM_U8) | CODEC_BIT(PCM_S8) | pcmCodecs | lawCodecs | fltCodecs | CODEC_BIT(IMA_ADPCM) | CODEC_BIT(GSM610) | dwvwCodecs | CODEC_BIT(DWVW_N) },
+            { FORMAT_AU,      SF_FORMAT_AU,     "AU",    "Sun/NeXT AU",                          CODEC_BIT(PCM_S8) | pcmCodecs | lawCodecs | fltCodecs | CODEC_BIT(G721_32) | CODEC_BIT(G723_24) | CODEC_BIT(G723_40) },
+            { FORMAT_AVR,     SF_FORMAT_AVR,    "AVR",   "Audio Visual Research",                CODEC_BIT(PCM_U8) | CODEC_BIT(PCM_S8) | CODEC_BIT(PCM_S16) },
+            { FORMAT_CAF,     SF_FORMAT_CAF,    "CAF",   "Apple Core Audio File format",         CODEC_BIT(PCM_S8) | pcmCodecs | lawCodecs | fltCodecs },
+            { FORMAT_FLAC,    SF_FORMAT_FLAC,   "FLAC",  "FLAC lossless file format",            CODEC_BIT(PCM_S8) | CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S24) },
+            { FORMAT_HTK,     SF_FORMAT_HTK,    "HTK",   "HMM Tool Kit format",                  CODEC_BIT(PCM_S16) },
+            { FORMAT_IRCAM,   SF_FORMAT_IRCAM,  "IRCAM", "Berkeley/IRCAM/CARL",                  CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S32) | lawCodecs | CODEC_BIT(PCM_FLOAT) },
+            { FORMAT_MAT4,    SF_FORMAT_MAT4,   "MAT4",  "Matlab V4.2 / GNU Octave 2.0",         CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S32) | fltCodecs },
+            { FORMAT_MAT5,    SF_FORMAT_MAT5,   "MAT5",  "Matlab (tm) V5.0 / GNU Octave 2.1",    CODEC_BIT(PCM_U8) | CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S32) | fltCodecs },
+            { FORMAT_MPC2K,   SF_FORMAT_MPC2K,  "MPC2K", "Akai MPC 2000 sampler",                CODEC_BIT(PCM_S16) },
+            { FORMAT_MPEG,    0,                "MPEG",  "MPEG Layer I/II/III",                  CODEC_BIT(MP1) | CODEC_BIT(MP2) | CODEC_BIT(MP3) },
+            { FORMAT_NIST,    SF_FORMAT_NIST,   "NIST",  "Sphere NIST format",                   CODEC_BIT(PCM_S8) | pcmCodecs | lawCodecs },
+            { FORMAT_OGG,     SF_FORMAT_OGG,    "OGG",   "Xiph OGG container",                   CODEC_BIT(VORBIS) },
+            { FORMAT_PAF,     SF_FORMAT_PAF,    "PAF",   "Ensoniq PARIS file format",            CODEC_BIT(PCM_S8) | CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S24) },
+            { FORMAT_PVF,     SF_FORMAT_PVF,    "PVF",   "Portable Voice Format",                CODEC_BIT(PCM_S8) | CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S32) },
+            { FORMAT_RAW,     SF_FORMAT_RAW,    "RAW",   "RAW PCM data",                         CODEC_BIT(PCM_U8) | CODEC_BIT(PCM_S8) | pcmCodecs | lawCodecs | fltCodecs | CODEC_BIT(GSM610) | CODEC_BIT(VOX_ADPCM) | dwvwCodecs },
+            { FORMAT_RF64,    SF_FORMAT_RF64,   "RF64",  "RF64 WAV file",                        CODEC_BIT(PCM_U8) | pcmCodecs | lawCodecs | fltCodecs },
+            { FORMAT_SD2,     SF_FORMAT_SD2,    "SD2",   "Sound Designer 2",                     CODEC_BIT(PCM_S8) | pcmCodecs },
+            { FORMAT_SDS,     SF_FORMAT_SDS,    "SDS",   "Midi Sample Dump Standard",            CODEC_BIT(PCM_S8) | CODEC_BIT(PCM_S16) | CODEC_BIT(PCM_S24) },
+            { FORMAT_SVX,     SF_FORMAT_SVX,    "SVX",   "Amiga IFF/SVX8/SV16",                  CODEC_BIT(PCM_S8) | CODEC_BIT(PCM_S16) },
+            { FORMAT_VOC,     SF_FORMAT_VOC,    "VOC",   "VOC files",                            CODEC_BIT(PCM_U8) | CODEC_BIT(PCM_S16) | lawCodecs },
+            { FORMAT_W64,     SF_FORMAT_W64,    "W64",   "Sonic Foundry 64 bit RIFF/WAV",        CODEC_BIT(PCM_U8) | pcmCodecs | lawCodecs | fltCodecs | CODEC_BIT(IMA_ADPCM) | CODEC_BIT(MS_ADPCM) | CODEC_BIT(GSM610) },
+            { FORMAT_WAV,     SF_FORMAT_WAV,    "WAV",   "MICROSOFT WAV",                        CODEC_BIT(PCM_U8) | pcmCodecs | lawCodecs | fltCodecs | CODEC_BIT(IMA_ADPCM) | CODEC_BIT(MS_ADPCM) | CODEC_BIT(GSM610) | CODEC_BIT(G721_32) },
+            { FORMAT_WAVEX,   SF_FORMAT_WAVEX,  "WAVEX", "Microsoft WAVE with WAVEFORMATEX",     CODEC_BIT(PCM_U8) | pcmCodecs | lawCodecs | fltCodecs },
+            { FORMAT_WVE,     SF_FORMAT_WVE,    "WVE",   "Psion WVE format",                     CODEC_BIT(ALAW) },
+            { FORMAT_XI,      SF_FORMAT_XI,     "XI",    "Fasttracker 2 Extended Instrument",    CODEC_BIT(DPCM_8) | CODEC_BIT(DPCM_16) },
+        };
+
+#undef CODEC_BIT
+
+        // Indexed by CodecId.
+        //
+        const CodecMapping codecMappings[] =
+        {
+            { CODEC_UNKNOWN,    0,                   "",           "" },
+            { CODEC_PCM_S8,     SF_FORMAT_PCM_S8,    "PCM_S8",     "Signed 8 bit PCM" },
+            { CODEC_PCM_S16,    SF_FORMAT_PCM_16,    "PCM_S16",    "Signed 16 bit PCM" },
+            { CODEC_PCM_S24,    SF_FORMAT_PCM_24,    "PCM_S24",    "Signed 24 bit PCM" },
+            { CODEC_PCM_S32,    SF_FORMAT_PCM_32,    "PCM_S32",    "Signed 32 bit PCM" },
+            { CODEC_PCM_U8,     SF_FORMAT_PCM_U8,    "PCM_U8",     "Unsigned 8 bit PCM" },
+            { CODEC_PCM_FLOAT,  SF_FORMAT_FLOAT,     "PCM_FLOAT",  "32 bit float PCM" },
+            { CODEC_PCM_DOUBLE, SF_FORMAT_DOUBLE,    "PCM_DOUBLE", "64 bit float PCM" },
+            { CODEC_ULAW,       SF_FORMAT_ULAW,      "ULAW",       "U-Law encoded" },
+            { CODEC_ALAW,       SF_FORMAT_ALAW,      "ALAW",       "A-Law encoded" },
+            { CODEC_IMA_ADPCM,  SF_FORMAT_IMA_ADPCM, "IMA_ADPCM",  "IMA ADPCM" },
+            { CODEC_MS_ADPCM,   SF_FORMAT_MS_ADPCM,  "MS_ADPCM",   "Microsoft ADPCM" },
+            { CODEC_GSM610,     SF_FORMAT_GSM610,    "GSM610",     "GSM 6.10 encoding" },
+            { CODEC_VOX_ADPCM,  SF_FORMAT_VOX_ADPCM, "VOX_ADPCM",  "OKI/Dialogix ADPCM" },
+            { CODEC_G721_32,    SF_FORMAT_G721_32,   "G721_32",    "32kbs G721 ADPCM encoding" },
+            { CODEC_G723_24,    SF_FORMAT_G723_24,   "G723_24",    "24kbs G723 ADPCM encoding" },
+            { CODEC_G723_40,    SF_FORMAT_G723_40,   "G723_40",    "40kbs G723 ADPCM encoding" },
+            { CODEC_DWVW_12,    SF_FORMAT_DWVW_12,   "DWVW_12",    "12 bit Delta Width Variable Word encoding" },
+            { CODEC_DWVW_16,    SF_FORMAT_DWVW_16,   "DWVW_16",    "16 bit Delta Width Variable Word encoding" },
+            { CODEC_DWVW_24,    SF_FORMAT_DWVW_24,   "DWVW_24",    "24 bit Delta Width Variable Word encoding" },
+            { CODEC_DWVW_N,     SF_FORMAT_DWVW_N,    "DWVW_N",     "N bit Delta Width Variable Word encoding" },
+            { CODEC_DPCM_8,     SF_FORMAT_DPCM_8,    "DPCM_8",     "8 bit differential PCM" },
+            { CODEC_DPCM_16,    SF_FORMAT_DPCM_16,   "DPCM_16",    "16 bit differential PCM" },
+            { CODEC_VORBIS,     SF_FORMAT_VORBIS,    "VORBIS",     "Xiph Vorbis encoding" },
+            { CODEC_MP1,        0,                   "MP1",        "MPEG Layer I" },
+            { CODEC_MP2,        0,                   "MP2",        "MPEG Layer II" },
+            { CODEC_MP3,        0,                   "MP3",        "MPEG Layer III" },
+        };
+
+        static_assert(sizeof(formatMappings) / sizeof(formatMappings[0]) == FORMAT_COUNT, "formatMappings must have an entry for every FormatId");
+        static_assert(sizeof(codecMappings) / sizeof(codecMappings[0]) == CODEC_COUNT, "codecMappings must have an entry for every CodecId");
+        static_assert(CODEC_COUNT <= 32, "allowed codecs do not fit in the mask");
+
+        // Indexed by SF_FORMAT_* >> 16
+        //
+        const FormatId sfMajorFormats[] =
+        {
+            /* 0x00 */ FORMAT_UNKNOWN,  FORMAT_WAV,      FORMAT_AIFF,     FORMAT_AU,       FORMAT_RAW,      FORMAT_PAF,      FORMAT_SVX,      FORMAT_NIST,
+            /* 0x08 */ FORMAT_VOC,      FORMAT_UNKNOWN,  FORMAT_IRCAM,    FORMAT_W64,      FORMAT_MAT4,     FORMAT_MAT5,     FORMAT_PVF,      FORMAT_XI,
+            /* 0x10 */ FORMAT_HTK,      FORMAT_SDS,      FORMAT_AVR,      FORMAT_WAVEX,    FORMAT_UNKNOWN,  FORMAT_UNKNOWN,  FORMAT_SD2,      FORMAT_FLAC,
+            /* 0x18 */ FORMAT_CAF,      FORMAT_WVE,      FORMAT_UNKNOWN,  FORMAT_UNKNOWN,  FORMAT_UNKNOWN,  FORMAT_UNKNOWN,  FORMAT_UNKNOWN,  FORMAT_UNKNOWN,
+            /* 0x20 */ FORMAT_OGG,      FORMAT_MPC2K,    FORMAT_RF64,
+        };
+
+        // Indexed by the two nibbles of SF_FORMAT_* subtypes (0x00..0x67)
+        //
+        const CodecId sfSubtypes[7][8] =
+        {
+            { CODEC_UNKNOWN, CODEC_PCM_S8, CODEC_PCM_S16, CODEC_PCM_S24, CODEC_PCM_S32, CODEC_PCM_U8, CODEC_PCM_FLOAT, CODEC_PCM_DOUBLE },
+            { CODEC_ULAW, CODEC_ALAW, CODEC_IMA_ADPCM, CODEC_MS_ADPCM },
+            { CODEC_GSM610, CODEC_VOX_ADPCM },
+            { CODEC_G721_32, CODEC_G723_24, CODEC_G723_40 },
+            { CODEC_DWVW_12, CODEC_DWVW_16, CODEC_DWVW_24, CODEC_DWVW_N },
+            { CODEC_DPCM_8, CODEC_DPCM_16 },
+            { CODEC_VORBIS },
+        };
+
+    } // namespace
+
+
+
+    int MultiFormatAudioFile::toSfFormat(FormatId format, CodecId codec)
+    {
+        ASSERT(format >= 0 && format < FORMAT_COUNT);
+        ASSERT(codec >= 0 && codec < CODEC_COUNT);
+
+        return formatMappings[format].sfFormat_ | codecMappings[codec].sfFormat_;
+    }
+
+
+
+    FormatId MultiFormatAudioFile::toFormatId(int sfFormat)
+    {
+        size_t index = (size_t)(sfFormat & SF_FORMAT_TYPEMASK) >> 16;
+        return index < sizeof(sfMajorFormats) / sizeof(sfMajorFormats[0]) ? sfMajorFormats[index] : FORMAT_UNKNOWN;
+    }
+
+
+
+    CodecId MultiFormatAudioFile::toCodecId(int sfFormat)
+    {
+        size_t row = (size_t)(sfFormat & SF_FORMAT_SUBMASK) >> 4;
+        size_t col = (size_t)sfFormat & 0x0f;
+        return row < 7 && col < 8 ? sfSubtypes[row][col] : CODEC_UNKNOWN;
+    }
+
+
+
+    bool MultiFormatAudioFile::isCodecAllowed(FormatId format, CodecId codec)
+    {
+        ASSERT(format >= 0 && format < FORMAT_COUNT);
+        ASSERT(codec >= 0 && codec < CODEC_COUNT);
+
+        return (formatMappings[format].codecs_ & (1u << codec)) != 0;
+    }
+
+
+
     void MultiFormatAudioFile::initFormatInfos(FormatInfoVector& infos)
     {
         SF_FORMAT_INFO sfInfo;
@@ -276,61 +491,12 @@ namespace e3 {
             sfInfo.format = i;
             sf_command(NULL, SFC_GET_FORMAT_MAJOR, &sfInfo, sizeof(sfInfo));
 
-            switch (sfInfo.format)
-            {
-            case SF_FORMAT_WAV:
-                infos.push_back(FormatInfo(FORMAT_WAV, sfInfo.format, "WAV", sfInfo.extension, "MICROSOFT WAV")); break;
-            case SF_FORMAT_AIFF:
-                infos.push_back(FormatInfo(FORMAT_AIFF, sfInfo.format, "AIFF", sfInfo.extension, "Apple/SGI AIFF")); break;
-            case SF_FORMAT_AU:
-                infos.push_back(FormatInfo(FORMAT_AU, sfInfo.format, "AU", sfInfo.extension, "Sun/NeXT AU")); break;
-            case SF_FORMAT_RAW:
-                infos.push_back(FormatInfo(FORMAT_RAW, sfInfo.format, "RAW", sfInfo.extension, "RAW PCM data")); break;
-            case SF_FORMAT_PAF:
-                infos.push_back(FormatInfo(FORMAT_PAF, sfInfo.format, "PAF", sfInfo.extension, "Ensoniq PARIS file format")); break;
-            case SF_FORMAT_SVX:
-                infos.push_back(FormatInfo(FORMAT_SVX, sfInfo.format, "SVX", sfInfo.extension, "Amiga IFF/SVX8/SV16")); break;
-            case SF_FORMAT_NIST:
-                infos.push_back(FormatInfo(FORMAT_NIST, sfInfo.format, "NIST", sfInfo.extension, "Sphere NIST format")); break;
-            case SF_FORMAT_VOC:
-                infos.push_back(FormatInfo(FORMAT_VOC, sfInfo.format, "VOC", sfInfo.extension, "VOC files")); break;
-            case SF_FORMAT_IRCAM:
-                infos.push_back(FormatInfo(FORMAT_IRCAM, sfInfo.format, "IRCAM", sfInfo.extension, "Berkeley/IRCAM/CARL")); break;
-            case SF_FORMAT_W64:
-                infos.push_back(FormatInfo(FORMAT_W64, sfInfo.format, "W64", sfInfo.extension, "Sonic Foundry 64 bit RIFF/WAV")); break;
-            case SF_FORMAT_MAT4:
-                infos.push_back(FormatInfo(FORMAT_MAT4, sfInfo.format, "MAT4", sfInfo.extension, "Matlab V4.2 / GNU Octave 2.0")); break;
-            case SF_FORMAT_MAT5:
-                infos.push_back(FormatInfo(FORMAT_MAT5, sfInfo.format, "MAT5", sfInfo.extension, "Matlab (tm) V5.0 / GNU Octave 2.1")); break;
-            case SF_FORMAT_PVF:
-                infos.push_back(FormatInfo(FORMAT_PVF, sfInfo.format, "PVF", sfInfo.extension, "Portable Voice Format")); break;
-            case SF_FORMAT_XI:
-                infos.push_back(FormatInfo(FORMAT_XI, sfInfo.format, "XI", sfInfo.extension, "Fasttracker 2 Extended Instrument")); break;
-            case SF_FORMAT_HTK:
-                infos.push_back(FormatInfo(FORMAT_HTK, sfInfo.format, "HTK", sfInfo.extension, "HMM Tool Kit format")); break;
-            case SF_FORMAT_SDS:
-                infos.push_back(FormatInfo(FORMAT_SDS, sfInfo.format, "SDS", sfInfo.extension, "Midi Sample Dump Standard")); break;
-            case SF_FORMAT_AVR:
-                infos.push_back(FormatInfo(FORMAT_AVR, sfInfo.format, "AVR", sfInfo.extension, "Audio Visual Research")); break;
-            case SF_FORMAT_WAVEX:
-                infos.push_back(FormatInfo(FORMAT_WAVEX, sfInfo.format, "WAVEX", sfInfo.extension, "Microsoft WAVE with WAVEFORMATEX")); break;
-            case SF_FORMAT_SD2:
-                infos.push_back(FormatInfo(FORMAT_SD2, sfInfo.format, "SD2", sfInfo.extension, "Sound Designer 2")); break;
-            case SF_FORMAT_FLAC:
-                infos.push_back(FormatInfo(FORMAT_FLAC, sfInfo.format, "FLAC", sfInfo.extension, "FLAC lossless file format")); break;
-            case SF_FORMAT_CAF:
-                infos.push_back(FormatInfo(FORMAT_CAF, sfInfo.format, "CAF", sfInfo.extension, "Apple Core Audio File format")); break;
-            case SF_FORMAT_WVE:
-                infos.push_back(FormatInfo(FORMAT_WVE, sfInfo.format, "WVE", sfInfo.extension, "Psion WVE format")); break;
-            case SF_FORMAT_OGG:
-                infos.push_back(FormatInfo(FORMAT_OGG, sfInfo.format, "OGG", sfInfo.extension, "Xiph OGG container")); break;
-            case SF_FORMAT_MPC2K:
-                infos.push_back(FormatInfo(FORMAT_MPC2K, sfInfo.format, "MPC2K", sfInfo.extension, "Akai MPC 2000 sampler")); break;
-            case SF_FORMAT_RF64:
-                infos.push_back(FormatInfo(FORMAT_RF64, sfInfo.format, "RF64", sfInfo.extension, "RF64 WAV file")); break;
-
-            default: THROW(std::exception, "Illegal LibSndFile format %d", sfInfo.format);
-            } // switch sfInfo.format
+            FormatId id = toFormatId(sfInfo.format);
+            if (id == FORMAT_UNKNOWN)
+                THROW(std::exception, "Illegal LibSndFile format %d", sfInfo.format);
+
+            const FormatMapping& mapping = formatMappings[id];
+            infos.push_back(FormatInfo(id, sfInfo.format, mapping.name_, sfInfo.extension, mapping.description_));
         }
     }
 
@@ -347,58 +513,13 @@ namespace e3 {
             sfInfo.format = i;
             sf_command(NULL, SFC_GET_FORMAT_SUBTYPE, &sfInfo, sizeof(sfInfo));
 
-            switch (sfInfo.format)
-            {
-            case SF_FORMAT_PCM_S8:
-                infos.push_back(CodecInfo(CODEC_PCM_S8, sfInfo.format, "PCM_S8", "Signed 8 bit PCM")); break;
-            case SF_FORMAT_PCM_16:
-                infos.push_back(CodecInfo(CODEC_PCM_S16, sfInfo.format, "PCM_S16", "Signed 16 bit PCM")); break;
-            case SF_FORMAT_PCM_24:
-                infos.push_back(CodecInfo(CODEC_PCM_S24, sfInfo.format, "PCM_S24", "Signed 24 bit PCM")); break;
-            case SF_FORMAT_PCM_32:
-                infos.push_back(CodecInfo(CODEC_PCM_S32, sfInfo.format, "PCM_S32", "Signed 32 bit PCM")); break;
-            case SF_FORMAT_PCM_U8:
-                infos.push_back(CodecInfo(CODEC_PCM_U8, sfInfo.format, "PCM_U8", "Unsigned 8 bit PCM")); break;
-            case SF_FORMAT_FLOAT:
-                infos.push_back(CodecInfo(CODEC_PCM_FLOAT, sfInfo.format, "PCM_FLOAT", "32 bit float PCM")); break;
-            case SF_FORMAT_DOUBLE:
-                infos.push_back(CodecInfo(CODEC_PCM_DOUBLE, sfInfo.format, "PCM_DOUBLE", "64 bit float PCM")); break;
-            case SF_FORMAT_ULAW:
-                infos.push_back(CodecInfo(CODEC_ULAW, sfInfo.format, "ULAW", "U-Law encoded")); break;
-            case SF_FORMAT_ALAW:
-                infos.push_back(CodecInfo(CODEC_ALAW, sfInfo.format, "ALAW", "A-Law encoded")); break;
-            case SF_FORMAT_IMA_ADPCM:
-                infos.push_back(CodecInfo(CODEC_IMA_ADPCM, sfInfo.format, "IMA_ADPCM", "IMA ADPCM")); break;
-            case SF_FORMAT_MS_ADPCM:
-                infos.push_back(CodecInfo(CODEC_MS_ADPCM, sfInfo.format, "MS_ADPCM", "Microsoft ADPCM")); break;
-            case SF_FORMAT_GSM610:
-                infos.push_back(CodecInfo(CODEC_GSM610, sfInfo.format, "GSM610", "GSM 6.10 encoding")); break;
-            case SF_FORMAT_VOX_ADPCM:
-                infos.push_back(CodecInfo(CODEC_VOX_ADPCM, sfInfo.format, "VOX_ADPCM", "OKI/Dialogix ADPCM")); break;
-            case SF_FORMAT_G721_32:
-                infos.push_back(CodecInfo(CODEC_G721_32, sfInfo.format, "G721_32", "32kbs G721 ADPCM encoding")); break;
-            case SF_FORMAT_G723_24:
-                infos.push_back(CodecInfo(CODEC_G723_24, sfInfo.format, "G723_24", "24kbs G723 ADPCM encoding")); break;
-            case SF_FORMAT_G723_40:
-                infos.push_back(CodecInfo(CODEC_G723_40, sfInfo.format, "G723_40", "40kbs G723 ADPCM encoding")); break;
-            case SF_FORMAT_DWVW_12:
-                infos.push_back(CodecInfo(CODEC_DWVW_12, sfInfo.format, "DWVW_12", "12 bit Delta Width Variable Word encoding")); break;
-            case SF_FORMAT_DWVW_16:
-                infos.push_back(CodecInfo(CODEC_DWVW_16, sfInfo.format, "DWVW_16", "16 bit Delta Width Variable Word encoding")); break;
-            case SF_FORMAT_DWVW_24:
-                infos.push_back(CodecInfo(CODEC_DWVW_24, sfInfo.format, "DWVW_24", "24 bit Delta Width Variable Word encoding")); break;
-            case SF_FORMAT_DWVW_N:
-                infos.push_back(CodecInfo(CODEC_DWVW_N, sfInfo.format, "DWVW_N", "N bit Delta Width Variable Word encoding")); break;
-            case SF_FORMAT_DPCM_8:
-                infos.push_back(CodecInfo(CODEC_DPCM_8, sfInfo.format, "DPCM_8", "8 bit differential PCM")); break;
-            case SF_FORMAT_DPCM_16:
-                infos.push_back(CodecInfo(CODEC_DPCM_16, sfInfo.format, "DPCM_16", "16 bit differential PCM")); break;
-            case SF_FORMAT_VORBIS:
-                infos.push_back(CodecInfo(CODEC_VORBIS, sfInfo.format, "VORBIS", "Xiph Vorbis encoding")); break;
-
-            default: THROW(std::exception, "Illegal LibSndFile codec %d", sfInfo.format);
-            } // switch sfInfo.format
+            CodecId id = toCodecId(sfInfo.format);
+            if (id == CODEC_UNKNOWN)
+                THROW(std::exception, "Illegal LibSndFile codec %d", sfInfo.format);
+
+            const CodecMapping& mapping = codecMappings[id];
+            infos.push_back(CodecInfo(id, sfInfo.format, mapping.name_, mapping.description_));
         }
     }
 
-} // namespace e3
\ No newline at end of file
+} // namespace e3
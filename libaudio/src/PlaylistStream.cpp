@@ -0,0 +1,307 @@
+//------------------------------------------------------------
+// PlaylistStream.cpp
+// Gapless playback of a sequence of audio files
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cstring>
+
+#include <e3_Exception.h>
+#include <e3_Trace.h>
+
+#include <FormatManager.h>
+#include <PlaylistStream.h>
+
+
+namespace e3 {
+
+    PlaylistStream::Entry::Entry(const Path& filename) :
+        filename_(filename),
+        readPos_(0),
+        filePos_(0),
+        signalStart_(0),
+        signalEnd_(-1),
+        endOfFile_(false)
+    {}
+
+
+
+    PlaylistStream::PlaylistStream(int sampleRate, int numChannels, size_t numPrefetch, int64 prefetchFrames) :
+        sampleRate_(sampleRate),
+        numChannels_(numChannels),
+        numPrefetch_(numPrefetch),
+        prefetchFrames_(prefetchFrames),
+        chunkFrames_(4096),
+        current_(0),
+        position_(0),
+        running_(false)
+    {
+        ASSERT(sampleRate_ > 0 && numChannels_ > 0);
+    }
+
+
+    PlaylistStream::~PlaylistStream()
+    {
+        stop();
+    }
+
+
+
+    void PlaylistStream::add(const Path& filename)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        entries_.push_back(EntryPtr(new Entry(filename)));
+        workerCondition_.notify_one();
+    }
+
+
+
+    void PlaylistStream::start()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_)
+            return;
+
+        running_ = true;
+        worker_ = std::thread(&PlaylistStream::run, this);
+    }
+
+
+
+    void PlaylistStream::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+            workerCondition_.notify_all();
+            readerCondition_.notify_all();
+        }
+        if (worker_.joinable()) {
+            worker_.join();
+        }
+    }
+
+
+
+    int64 PlaylistStream::read(float* data, int64 numFrames)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        int64 numDone = 0;
+
+        while (numDone < numFrames && current_ < entries_.size())
+        {
+            Entry& entry = *entries_[current_];
+            size_t numAvailable = entry.decoded_.size() - entry.readPos_;
+
+            if (numAvailable == 0)
+            {
+                if (entry.endOfFile_)     // continue with the first sample of the next entry
+                {
+                    std::vector<float>().swap(entry.decoded_);
+                    entry.readPos_ = 0;
+                    current_++;
+                    workerCondition_.notify_one();
+                    continue;
+                }
+                if (running_ == false)
+                    break;
+
+                workerCondition_.notify_one();  // underrun, wait for the worker
+                readerCondition_.wait(lock);
+                continue;
+            }
+
+            size_t numSamples = std::min(numAvailable, (size_t)((numFrames - numDone) * numChannels_));
+            memcpy(data + numDone * numChannels_, &entry.decoded_[entry.readPos_], numSamples * sizeof(float));
+
+            entry.readPos_ += numSamples;
+            numDone += numSamples / numChannels_;
+
+            if (entry.readPos_ * 2 >= entry.decoded_.size())     // drop consumed data
+            {
+                entry.decoded_.erase(entry.decoded_.begin(), entry.decoded_.begin() + entry.readPos_);
+                entry.readPos_ = 0;
+            }
+            workerCondition_.notify_one();
+        }
+
+        position_ += numDone;
+        return numDone;
+    }
+
+
+
+    size_t PlaylistStream::getNumEntries() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+
+    size_t PlaylistStream::getCurrentEntry() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return current_;
+    }
+
+
+    int64 PlaylistStream::getPosition() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return position_;
+    }
+
+
+    bool PlaylistStream::isFinished() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return current_ >= entries_.size();
+    }
+
+
+
+    // Worker thread.
+    // Keeps the current entry and the next numPrefetch_ entries
+    // filled with at least prefetchFrames_ decoded frames.
+    //
+    void PlaylistStream::run()
+    {
+        std::vector<float> chunk;
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (running_)
+        {
+            EntryPtr entry = findPending();
+            if (!entry) {
+                workerCondition_.wait(lock);
+                continue;
+            }
+
+            // The file and the resampler of an entry are only accessed by the worker,
+            // so decoding can run without holding the lock.
+            //
+            lock.unlock();
+            chunk.clear();
+            bool endOfFile = decodeChunk(*entry, chunk);
+            lock.lock();
+
+            entry->decoded_.insert(entry->decoded_.end(), chunk.begin(), chunk.end());
+            entry->endOfFile_ = endOfFile;
+            readerCondition_.notify_all();
+        }
+    }
+
+
+
+    PlaylistStream::EntryPtr PlaylistStream::findPending() const
+    {
+        size_t last = std::min(entries_.size(), current_ + numPrefetch_ + 1);
+
+        for (size_t i = current_; i < last; ++i)
+        {
+            const EntryPtr& entry = entries_[i];
+            int64 numBuffered = (entry->decoded_.size() - entry->readPos_) / numChannels_;
+
+            if (entry->endOfFile_ == false && numBuffered < prefetchFrames_)
+                return entry;
+        }
+        return EntryPtr();
+    }
+
+
+
+    // Decodes the next chunk of the entry, opens the file if needed.
+    // Returns true if the end of the file is reached.
+    // An entry that can not be decoded is skipped.
+    //
+    bool PlaylistStream::decodeChunk(Entry& entry, std::vector<float>& output)
+    {
+        try {
+            if (!entry.file_)
+            {
+                entry.file_ = FormatManager::createFile(entry.filename_);
+                entry.file_->open(entry.filename_, AudioFile::OpenRead);
+                entry.resampler_.init(entry.file_->getNumChannels(), entry.file_->getSampleRate(), sampleRate_);
+
+                int64 numTrailing = entry.file_->getNumTrailingFrames();
+                entry.signalStart_ = entry.file_->getNumLeadingFrames();
+                entry.signalEnd_ = (numTrailing > 0) ? entry.file_->getNumFrames() - numTrailing : -1;
+            }
+
+            int numFileChannels = entry.file_->getNumChannels();
+            inputBuffer_.resize((size_t)(chunkFrames_ * numFileChannels));
+
+            int64 numRead = entry.file_->read(&inputBuffer_[0], chunkFrames_);
+            bool endOfFile = numRead < chunkFrames_;
+
+            // Only the frames of the signal are passed on, so the
+            // last frame of the signal is followed by the first of the next entry
+            int64 last = numRead;
+            if (entry.signalEnd_ >= 0 && entry.filePos_ + numRead >= entry.signalEnd_)
+            {
+                last = std::max<int64>(entry.signalEnd_ - entry.filePos_, 0);
+                endOfFile = true;
+            }
+            int64 first = std::min(std::max<int64>(entry.signalStart_ - entry.filePos_, 0), last);
+            entry.filePos_ += numRead;
+
+            resampleBuffer_.clear();
+            entry.resampler_.process(inputBuffer_.data() + first * numFileChannels, last - first, resampleBuffer_, endOfFile);
+            convertChannels(resampleBuffer_.data(), numFileChannels, resampleBuffer_.size() / numFileChannels, output);
+
+            if (endOfFile) {
+                entry.file_->close();
+            }
+            return endOfFile;
+        }
+        catch (const std::exception& e)
+        {
+            TRACE("PlaylistStream: skipping %s: %s\n", entry.filename_.string().c_str(), e.what());
+            return true;
+        }
+    }
+
+
+
+    void PlaylistStream::convertChannels(const float* input, int numInputChannels, int64 numFrames, std::vector<float>& output) const
+    {
+        size_t offset = output.size();
+        output.resize(offset + (size_t)(numFrames * numChannels_), 0.f);
+        float* out = output.data() + offset;
+
+        if (numInputChannels == numChannels_) {
+            memcpy(out, input, (size_t)(numFrames * numChannels_) * sizeof(float));
+        }
+        else if (numInputChannels == 1)         // duplicate mono to all channels
+        {
+            for (int64 i = 0; i < numFrames; ++i) {
+                for (int c = 0; c < numChannels_; ++c) {
+                    *out++ = input[i];
+                }
+            }
+        }
+        else if (numChannels_ == 1)             // mix down to mono
+        {
+            float gain = 1.f / numInputChannels;
+            for (int64 i = 0; i < numFrames; ++i, input += numInputChannels)
+            {
+                float sum = 0;
+                for (int c = 0; c < numInputChannels; ++c) {
+                    sum += input[c];
+                }
+                *out++ = sum * gain;
+            }
+        }
+        else                                    // copy the common channels, leave the others silent
+        {
+            int numCommon = std::min(numInputChannels, numChannels_);
+            for (int64 i = 0; i < numFrames; ++i, input += numInputChannels, out += numChannels_) {
+                for (int c = 0; c < numCommon; ++c) {
+                    out[c] = input[c];
+                }
+            }
+        }
+    }
+
+} // namespace e3
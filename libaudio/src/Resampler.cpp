@@ -0,0 +1,120 @@
+//------------------------------------------------------------
+// Resampler.cpp
+// Streaming sample rate converter, wrapper for libsamplerate
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <samplerate.h> // libsamplerate
+
+#include <e3_Exception.h>
+#include <Resampler.h>
+
+
+namespace e3 {
+
+    Resampler::Resampler() :
+        state_(NULL),
+        numChannels_(0),
+        ratio_(1.0)
+    {}
+
+
+    Resampler::~Resampler()
+    {
+        if (state_) {
+            src_delete(state_);
+            state_ = NULL;
+        }
+    }
+
+
+
+    void Resampler::init(int numChannels, int sourceRate, int targetRate, Quality quality)
+    {
+        ASSERT(numChannels > 0 && sourceRate > 0 && targetRate > 0);
+
+        if (state_) {
+            src_delete(state_);
+            state_ = NULL;
+        }
+        numChannels_ = numChannels;
+        ratio_ = (1.0 * targetRate) / sourceRate;
+
+        if (sourceRate == targetRate)       // nothing to convert
+            return;
+
+        if (src_is_valid_ratio(ratio_) == 0) {
+            THROW(std::exception, "Samplerate can not be converted from %d to %d", sourceRate, targetRate);
+        }
+
+        int error = 0;
+        state_ = src_new((int)quality, numChannels, &error);
+        if (state_ == NULL) {
+            THROW(std::exception, src_strerror(error));
+        }
+    }
+
+
+
+    void Resampler::reset()
+    {
+        if (state_) {
+            src_reset(state_);
+        }
+    }
+
+
+
+    int64 Resampler::process(const float* input, int64 numInput, float* output, int64 maxOutput, int64& numUsed, bool endOfInput)
+    {
+        if (state_ == NULL)
+        {
+            int64 numFrames = std::min(numInput, maxOutput);
+            memcpy(output, input, (size_t)(numFrames * numChannels_ * sizeof(float)));
+            numUsed = numFrames;
+            return numFrames;
+        }
+
+        SRC_DATA srcData;
+        srcData.data_in = input;
+        srcData.input_frames = (long)numInput;
+        srcData.data_out = output;
+        srcData.output_frames = (long)maxOutput;
+        srcData.src_ratio = ratio_;
+        srcData.end_of_input = endOfInput ? 1 : 0;
+
+        int error = src_process(state_, &srcData);
+        if (error != 0) {
+            THROW(std::exception, src_strerror(error));
+        }
+
+        numUsed = srcData.input_frames_used;
+        return srcData.output_frames_gen;
+    }
+
+
+
+    void Resampler::process(const float* input, int64 numInput, std::vector<float>& output, bool endOfInput)
+    {
+        int64 chunkSize = (int64)ceil(numInput * ratio_) + 64;
+
+        do {
+            size_t offset = output.size();
+            output.resize(offset + (size_t)(chunkSize * numChannels_));
+
+            int64 numUsed = 0;
+            int64 numGenerated = process(input, numInput, &output[offset], chunkSize, numUsed, endOfInput);
+            output.resize(offset + (size_t)(numGenerated * numChannels_));
+
+            input += numUsed * numChannels_;
+            numInput -= numUsed;
+
+            if (numGenerated == 0 && numUsed == 0)      // converter drained
+                break;
+        } while (numInput > 0 || (endOfInput && state_ != NULL));
+    }
+
+} // namespace e3
@@ -0,0 +1,293 @@
+//------------------------------------------------------------
+// SampleConversion.cpp
+// Conversion kernels between sample formats
+//------------------------------------------------------------
+
+#include <cstring>
+
+// The AVX and F16C kernels are compiled on every x86 target and selected
+// at run time, the project does not require a CPU newer than SSE2.
+//
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #define E3_USE_AVX
+    #define E3_TARGET_AVX
+    #define E3_TARGET_F16C
+    #include <intrin.h>
+    #include <immintrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define E3_USE_AVX
+    #define E3_TARGET_AVX __attribute__((target("avx")))
+    #define E3_TARGET_F16C __attribute__((target("avx,f16c")))
+    #include <cpuid.h>
+    #include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define E3_USE_SSE2
+    #include <emmintrin.h>
+#endif
+
+#include <SampleConversion.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        inline uint32 floatBits(float f)    { uint32 u; memcpy(&u, &f, sizeof(u)); return u; }
+        inline float bitsFloat(uint32 u)    { float f; memcpy(&f, &u, sizeof(f)); return f; }
+
+        // Conversion is done in float, the result is the same as clipping
+        // the fixed point value first.
+        //
+        inline float fixedToFloat(int32 sample, float scale)
+        {
+            float f = (float)sample * scale;
+            return (f < -1.f) ? -1.f : ((f > 1.f) ? 1.f : f);
+        }
+
+#ifdef E3_USE_AVX
+        const unsigned int cpuidAvx  = 1u << 28;           // CPUID 1, ecx
+        const unsigned int cpuidF16C = 1u << 29;
+
+        // Returns the CPUID features in ecx, 0 if the OS does not save the ymm registers.
+        //
+        unsigned int detectAvxFeatures()
+        {
+            unsigned int info[4] = { 0, 0, 0, 0 };
+    #ifdef _MSC_VER
+            __cpuid(reinterpret_cast<int*>(info), 1);
+    #else
+            if (__get_cpuid(1, &info[0], &info[1], &info[2], &info[3]) == 0)
+                return 0;
+    #endif
+            const unsigned int osxsave = 1u << 27;
+            if ((info[2] & (osxsave | cpuidAvx)) != (osxsave | cpuidAvx))
+                return 0;
+
+    #ifdef _MSC_VER
+            unsigned long long xcr0 = _xgetbv(0);
+    #else
+            unsigned int eax, edx;
+            __asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+            unsigned long long xcr0 = ((unsigned long long)edx << 32) | eax;
+    #endif
+            return ((xcr0 & 6) == 6) ? info[2] : 0;         // xmm and ymm state saved
+        }
+
+        const unsigned int avxFeatures_s = detectAvxFeatures();
+        const bool hasAvx_s  = (avxFeatures_s & cpuidAvx) != 0;
+        const bool hasF16C_s = (avxFeatures_s & cpuidF16C) != 0;
+
+        // The kernels return the number of values done, the caller converts the rest.
+        // They end with vzeroupper, the surrounding code may not be compiled for AVX.
+        //
+        E3_TARGET_F16C size_t convertFloatToHalfF16C(const float* input, uint16* output, size_t num)
+        {
+            size_t i = 0;
+            for (; i + 8 <= num; i += 8)
+            {
+                __m256 v = _mm256_loadu_ps(input + i);
+                __m128i h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), h);
+            }
+            _mm256_zeroupper();
+            return i;
+        }
+
+        E3_TARGET_F16C size_t convertHalfToFloatF16C(const uint16* input, float* output, size_t num)
+        {
+            size_t i = 0;
+            for (; i + 8 <= num; i += 8)
+            {
+                __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+                _mm256_storeu_ps(output + i, _mm256_cvtph_ps(h));
+            }
+            _mm256_zeroupper();
+            return i;
+        }
+
+        E3_TARGET_AVX inline __m256 fixedToFloat8(const int32* input, __m256 scale)
+        {
+            __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input))), scale);
+            return _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-1.f)), _mm256_set1_ps(1.f));
+        }
+
+        E3_TARGET_AVX size_t convertFixedMonoAvx(const int32* input, float scale, float* output, size_t numFrames)
+        {
+            __m256 scale8 = _mm256_set1_ps(scale);
+            size_t i = 0;
+            for (; i + 8 <= numFrames; i += 8) {
+                _mm256_storeu_ps(output + i, fixedToFloat8(input + i, scale8));
+            }
+            _mm256_zeroupper();
+            return i;
+        }
+
+        E3_TARGET_AVX size_t convertFixedStereoAvx(const int32* left, const int32* right, float scale, float* output, size_t numFrames)
+        {
+            __m256 scale8 = _mm256_set1_ps(scale);
+            size_t i = 0;
+            for (; i + 8 <= numFrames; i += 8)
+            {
+                __m256 l = fixedToFloat8(left + i, scale8);
+                __m256 r = fixedToFloat8(right + i, scale8);
+                __m256 lo = _mm256_unpacklo_ps(l, r);       // l0 r0 l1 r1 | l4 r4 l5 r5
+                __m256 hi = _mm256_unpackhi_ps(l, r);       // l2 r2 l3 r3 | l6 r6 l7 r7
+                _mm256_storeu_ps(output + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+                _mm256_storeu_ps(output + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+            }
+            _mm256_zeroupper();
+            return i;
+        }
+#endif
+
+#ifdef E3_USE_SSE2
+        inline __m128 fixedToFloat4(const int32* input, __m128 scale)
+        {
+            __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(input))), scale);
+            return _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.f)), _mm_set1_ps(1.f));
+        }
+#endif
+
+    } // namespace
+
+
+
+    uint16 floatToHalf(float value)
+    {
+        const uint32 infinity32 = 255u << 23;
+        const uint32 max16 = (127u + 16) << 23;             // smallest value that overflows to infinity
+        const uint32 denormMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+        uint32 x = floatBits(value);
+        uint32 sign = x & 0x80000000u;
+        uint16 result;
+        x ^= sign;
+
+        if (x >= max16) {                                   // infinity or NaN
+            result = (x > infinity32) ? 0x7e00 : 0x7c00;
+        }
+        else if (x < (113u << 23)) {                        // result is a denormal, let the FPU round
+            float f = bitsFloat(x) + bitsFloat(denormMagic);
+            result = (uint16)(floatBits(f) - denormMagic);
+        }
+        else {
+            uint32 mantissaOdd = (x >> 13) & 1;
+            x -= 112u << 23;                                // rebias exponent
+            x += 0xfff + mantissaOdd;                       // round to nearest even
+            result = (uint16)(x >> 13);
+        }
+        return result | (uint16)(sign >> 16);
+    }
+
+
+
+    float halfToFloat(uint16 value)
+    {
+        const uint32 exponentMask = 0x7c00u << 13;
+
+        uint32 x = (value & 0x7fffu) << 13;
+        uint32 exponent = x & exponentMask;
+        x += (127u - 15) << 23;                             // rebias exponent
+
+        if (exponent == exponentMask) {                     // infinity or NaN
+            x += (128u - 16) << 23;
+        }
+        else if (exponent == 0) {                           // zero or denormal, renormalize
+            x += 1u << 23;
+            x = floatBits(bitsFloat(x) - bitsFloat(113u << 23));
+        }
+        return bitsFloat(x | ((uint32)(value & 0x8000u) << 16));
+    }
+
+
+
+    void convertFloatToHalf(const float* input, uint16* output, size_t num)
+    {
+        size_t i = 0;
+#ifdef E3_USE_AVX
+        if (hasF16C_s) {
+            i = convertFloatToHalfF16C(input, output, num);
+        }
+#endif
+        for (; i < num; ++i) {
+            output[i] = floatToHalf(input[i]);
+        }
+    }
+
+
+
+    void convertHalfToFloat(const uint16* input, float* output, size_t num)
+    {
+        size_t i = 0;
+#ifdef E3_USE_AVX
+        if (hasF16C_s) {
+            i = convertHalfToFloatF16C(input, output, num);
+        }
+#endif
+        for (; i < num; ++i) {
+            output[i] = halfToFloat(input[i]);
+        }
+    }
+
+
+
+    void convertFixedToFloat(const int32* const* input, int numChannels, int fracBits, float* output, size_t numFrames)
+    {
+        const float scale = 1.f / (float)(1L << fracBits);
+        size_t i = 0;
+
+        if (numChannels == 1)
+        {
+            const int32* mono = input[0];
+#ifdef E3_USE_AVX
+            if (hasAvx_s) {
+                i = convertFixedMonoAvx(mono, scale, output, numFrames);
+            }
+#endif
+#ifdef E3_USE_SSE2
+            __m128 scale4 = _mm_set1_ps(scale);
+            for (; i + 4 <= numFrames; i += 4) {
+                _mm_storeu_ps(output + i, fixedToFloat4(mono + i, scale4));
+            }
+#endif
+            for (; i < numFrames; ++i) {
+                output[i] = fixedToFloat(mono[i], scale);
+            }
+        }
+        else if (numChannels == 2)
+        {
+            const int32* left = input[0];
+            const int32* right = input[1];
+#ifdef E3_USE_AVX
+            if (hasAvx_s) {
+                i = convertFixedStereoAvx(left, right, scale, output, numFrames);
+            }
+#endif
+#ifdef E3_USE_SSE2
+            __m128 scale4 = _mm_set1_ps(scale);
+            for (; i + 4 <= numFrames; i += 4)
+            {
+                __m128 l = fixedToFloat4(left + i, scale4);
+                __m128 r = fixedToFloat4(right + i, scale4);
+                _mm_storeu_ps(output + 2 * i, _mm_unpacklo_ps(l, r));
+                _mm_storeu_ps(output + 2 * i + 4, _mm_unpackhi_ps(l, r));
+            }
+#endif
+            for (; i < numFrames; ++i) {
+                output[2 * i] = fixedToFloat(left[i], scale);
+                output[2 * i + 1] = fixedToFloat(right[i], scale);
+            }
+        }
+        else
+        {
+            for (; i < numFrames; ++i) {
+                for (int channel = 0; channel < numChannels; ++channel) {
+                    *output++ = fixedToFloat(input[channel][i], scale);
+                }
+            }
+        }
+    }
+
+} // namespace e3
@@ -0,0 +1,205 @@
+//------------------------------------------------------------
+// SampleStore.cpp
+// Content addressed store that shares identical sample data
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <e3_Exception.h>
+#include <FormatManager.h>
+#include <SampleStore.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        const uint64 hashMultiplier = 0xc6a4a7935bd1e995ULL;      // MurmurHash64A
+        const int hashShift = 47;
+
+        inline uint64 mixWord(uint64 hash, uint64 word)
+        {
+            word *= hashMultiplier;
+            word ^= word >> hashShift;
+            word *= hashMultiplier;
+
+            hash ^= word;
+            return hash * hashMultiplier;
+        }
+
+        const size_t minSweepSize = 64;
+
+    } // namespace
+
+
+
+    SampleStore::SampleStore() :
+        sweepSize_(minSweepSize)
+    {}
+
+
+
+    ConstAudioBufferPtr SampleStore::load(const Path& filename)
+    {
+        AudioFilePtr file = FormatManager::createFile(filename);
+        file->open(filename, AudioFile::OpenRead);
+
+        ConstAudioBufferPtr result = load(file.get());
+        file->close();
+        return result;
+    }
+
+
+
+    ConstAudioBufferPtr SampleStore::load(AudioFile* file)
+    {
+        ASSERT(file != nullptr && file->isReadable());
+
+        AudioBufferPtr buffer(new AudioBuffer(file->getNumChannels()));
+        file->load(buffer.get());
+
+        return insert(std::move(buffer));
+    }
+
+
+
+    // A buffer the caller still refers to is copied, so that it can not
+    // be modified once it is shared.
+    //
+    ConstAudioBufferPtr SampleStore::insert(AudioBufferPtr buffer)
+    {
+        ASSERT(buffer != nullptr);
+
+        uint64 hash = calcHash(*buffer);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        statistics_.numRequests_++;
+
+        bool isCollision = false;
+        std::pair<EntryMap::iterator, EntryMap::iterator> range = entries_.equal_range(hash);
+        for (EntryMap::iterator it = range.first; it != range.second; )
+        {
+            ConstAudioBufferPtr held = it->second.lock();
+            if (held == nullptr) {
+                it = entries_.erase(it);
+                continue;
+            }
+            if (isEqual(*held, *buffer))
+            {
+                statistics_.numHits_++;
+                statistics_.numBytesSaved_ += buffer->calcNumBytes();
+                return held;
+            }
+            isCollision = true;
+            ++it;
+        }
+
+        if (isCollision) {
+            statistics_.numCollisions_++;
+        }
+
+        ConstAudioBufferPtr result = buffer.unique() ? buffer : ConstAudioBufferPtr(new AudioBuffer(*buffer));
+        entries_.insert(EntryMap::value_type(hash, result));
+        if (entries_.size() >= sweepSize_) {
+            removeExpired();
+        }
+        return result;
+    }
+
+
+
+    // Entries expire when their buffer is released, but insert() only
+    // removes them when their hash comes up again. All entries are swept
+    // whenever the map has doubled since the last sweep.
+    //
+    void SampleStore::removeExpired()
+    {
+        for (EntryMap::iterator it = entries_.begin(); it != entries_.end(); )
+        {
+            if (it->second.expired())
+                it = entries_.erase(it);
+            else
+                ++it;
+        }
+        sweepSize_ = std::max(minSweepSize, 2 * entries_.size());
+    }
+
+
+
+    void SampleStore::clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        entries_.clear();
+        statistics_ = Statistics();
+        sweepSize_ = minSweepSize;
+    }
+
+
+
+    SampleStore::Statistics SampleStore::getStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        Statistics result = statistics_;
+        for (EntryMap::const_iterator it = entries_.begin(); it != entries_.end(); ++it)
+        {
+            ConstAudioBufferPtr held = it->second.lock();
+            if (held != nullptr) {
+                result.numBuffers_++;
+                result.numBytesHeld_ += held->calcNumBytes();
+            }
+        }
+        return result;
+    }
+
+
+
+    uint64 SampleStore::calcHash(const AudioBuffer& buffer)
+    {
+        ScopedPin pin(&buffer);
+
+        const size_t numBytes = (size_t)buffer.calcNumBytes();
+        const uint8* data = (const uint8*)buffer.getHead();
+
+        uint64 hash = (uint64)buffer.getSampleRate() ^ ((uint64)buffer.getNumChannels() << 32) ^ (numBytes * hashMultiplier);
+
+        size_t pos = 0;
+        for (; pos + 8 <= numBytes; pos += 8)
+        {
+            uint64 word;
+            memcpy(&word, data + pos, 8);
+            hash = mixWord(hash, word);
+        }
+        if (pos < numBytes)
+        {
+            uint64 word = 0;
+            memcpy(&word, data + pos, numBytes - pos);
+            hash = mixWord(hash, word);
+        }
+
+        hash ^= hash >> hashShift;
+        hash *= hashMultiplier;
+        hash ^= hash >> hashShift;
+        return hash;
+    }
+
+
+
+    bool SampleStore::isEqual(const AudioBuffer& a, const AudioBuffer& b)
+    {
+        if (a.getSampleRate() != b.getSampleRate() ||
+            a.getNumChannels() != b.getNumChannels() ||
+            a.calcNumBytes() != b.calcNumBytes())
+            return false;
+        if (a.calcNumBytes() == 0)
+            return true;
+
+        ScopedPin pinA(&a);
+        ScopedPin pinB(&b);
+        return memcmp(a.getHead(), b.getHead(), (size_t)a.calcNumBytes()) == 0;
+    }
+
+} // namespace e3
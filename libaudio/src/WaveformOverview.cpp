@@ -0,0 +1,378 @@
+//------------------------------------------------------------
+// WaveformOverview.cpp
+// Min/max/RMS pyramid for drawing waveforms at any zoom level
+//------------------------------------------------------------
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define E3_USE_SSE2
+    #include <emmintrin.h>
+#endif
+
+#include <e3_Exception.h>
+
+#include <AudioBuffer.h>
+#include <WaveformOverview.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        const uint32 overviewMagic   = ('E' << 24) | ('3' << 16) | ('O' << 8) | 'V';
+        const uint32 overviewVersion = 1;
+
+        struct OverviewHeader
+        {
+            uint32 magic_;
+            uint32 version_;
+            int32 numChannels_;
+            int32 blockSize_;
+            int64 numFrames_;
+            int64 fileSize_;
+            int64 fileTime_;
+            int64 numBuckets_;
+        };
+
+        // Merges min, max and sum of squares of interleaved frames into
+        // the per channel accumulators.
+        // With 1, 2 or 4 channels every SSE lane always holds the same channel,
+        // so the whole block is reduced in vectors and the lanes are folded at the end.
+        //
+        void reduceFrames(const float* data, size_t numFrames, int numChannels, float* mins, float* maxs, float* sums)
+        {
+            size_t num = numFrames * numChannels;
+            size_t i = 0;
+
+#ifdef E3_USE_SSE2
+            if (num >= 4 && (numChannels == 1 || numChannels == 2 || numChannels == 4))
+            {
+                __m128 vmin = _mm_loadu_ps(data);
+                __m128 vmax = vmin;
+                __m128 vsum = _mm_setzero_ps();
+
+                for (; i + 4 <= num; i += 4)
+                {
+                    __m128 v = _mm_loadu_ps(data + i);
+                    vmin = _mm_min_ps(vmin, v);
+                    vmax = _mm_max_ps(vmax, v);
+                    vsum = _mm_add_ps(vsum, _mm_mul_ps(v, v));
+                }
+
+                float laneMin[4], laneMax[4], laneSum[4];
+                _mm_storeu_ps(laneMin, vmin);
+                _mm_storeu_ps(laneMax, vmax);
+                _mm_storeu_ps(laneSum, vsum);
+
+                for (int lane = 0; lane < 4; ++lane)
+                {
+                    int c = lane % numChannels;
+                    mins[c] = std::min(mins[c], laneMin[lane]);
+                    maxs[c] = std::max(maxs[c], laneMax[lane]);
+                    sums[c] += laneSum[lane];
+                }
+            }
+#endif
+            for (; i < num; ++i)
+            {
+                int c = (int)(i % numChannels);
+                float v = data[i];
+                mins[c] = std::min(mins[c], v);
+                maxs[c] = std::max(maxs[c], v);
+                sums[c] += v * v;
+            }
+        }
+
+    } // namespace
+
+
+
+    WaveformOverview::WaveformOverview(int blockSize) :
+        numPending_(0),
+        blockSize_(blockSize),
+        numChannels_(0),
+        numFrames_(0),
+        complete_(false)
+    {
+        ASSERT(blockSize > 0);
+    }
+
+
+
+    void WaveformOverview::init(int numChannels)
+    {
+        ASSERT(numChannels > 0);
+
+        numChannels_ = numChannels;
+        numFrames_ = 0;
+        numPending_ = 0;
+        complete_ = false;
+
+        levels_.assign(1, BucketVector());
+        pendingMin_.assign(numChannels, FLT_MAX);
+        pendingMax_.assign(numChannels, -FLT_MAX);
+        pendingSum_.assign(numChannels, 0.f);
+    }
+
+
+
+    void WaveformOverview::add(const float* data, int64 numFrames)
+    {
+        ASSERT(numChannels_ > 0 && complete_ == false);
+
+        while (numFrames > 0)
+        {
+            int64 num = std::min(numFrames, blockSize_ - numPending_);
+            reduceFrames(data, (size_t)num, numChannels_, &pendingMin_[0], &pendingMax_[0], &pendingSum_[0]);
+
+            data += num * numChannels_;
+            numFrames -= num;
+            numFrames_ += num;
+            numPending_ += num;
+
+            if (numPending_ == blockSize_) {
+                flushPending();
+            }
+        }
+    }
+
+
+
+    void WaveformOverview::finish()
+    {
+        ASSERT(numChannels_ > 0);
+
+        flushPending();
+        buildLevels();
+        complete_ = true;
+    }
+
+
+
+    void WaveformOverview::build(const AudioBuffer& buffer)
+    {
+        ScopedPin pin(&buffer);
+        init(buffer.getNumChannels());
+        add(buffer.getHead(), buffer.getNumFrames());
+        finish();
+    }
+
+
+
+    void WaveformOverview::flushPending()
+    {
+        if (numPending_ == 0)
+            return;
+
+        BucketVector& level = levels_[0];
+        for (int c = 0; c < numChannels_; ++c)
+        {
+            Bucket bucket;
+            bucket.min_ = pendingMin_[c];
+            bucket.max_ = pendingMax_[c];
+            bucket.power_ = pendingSum_[c] / numPending_;
+            level.push_back(bucket);
+
+            pendingMin_[c] = FLT_MAX;
+            pendingMax_[c] = -FLT_MAX;
+            pendingSum_[c] = 0.f;
+        }
+        numPending_ = 0;
+    }
+
+
+
+    void WaveformOverview::buildLevels()
+    {
+        levels_.resize(1);
+
+        while (levels_.back().size() > (size_t)numChannels_)
+        {
+            size_t level = levels_.size() - 1;
+            const BucketVector& below = levels_[level];
+            int64 numBlocks = below.size() / numChannels_;
+            BucketVector upper((size_t)((numBlocks + 1) / 2 * numChannels_));
+
+            for (int64 j = 0; j < (numBlocks + 1) / 2; ++j)
+            {
+                int64 a = 2 * j;
+                int64 b = std::min(a + 1, numBlocks - 1);
+                float weightA = (float)getNumFrames(level, a);
+                float weightB = (b != a) ? (float)getNumFrames(level, b) : 0.f;
+
+                for (int c = 0; c < numChannels_; ++c)
+                {
+                    const Bucket& first = below[(size_t)(a * numChannels_ + c)];
+                    const Bucket& second = below[(size_t)(b * numChannels_ + c)];
+                    Bucket& bucket = upper[(size_t)(j * numChannels_ + c)];
+
+                    bucket.min_ = std::min(first.min_, second.min_);
+                    bucket.max_ = std::max(first.max_, second.max_);
+                    bucket.power_ = (first.power_ * weightA + second.power_ * weightB) / (weightA + weightB);
+                }
+            }
+            levels_.push_back(upper);
+        }
+    }
+
+
+
+    int64 WaveformOverview::getNumFrames(size_t level, int64 block) const
+    {
+        int64 blockSize = (int64)blockSize_ << level;
+        return std::min(blockSize, numFrames_ - block * blockSize);
+    }
+
+
+
+    void WaveformOverview::getPeaks(int channel, int64 start, int64 end, Peak* output, size_t numPixels) const
+    {
+        ASSERT(complete_);
+        ASSERT(channel >= 0 && channel < numChannels_);
+
+        if (numPixels == 0)
+            return;
+
+        end = std::min(end, numFrames_);
+        if (start >= end || levels_[0].empty())
+        {
+            Peak empty = { 0.f, 0.f, 0.f };
+            std::fill(output, output + numPixels, empty);
+            return;
+        }
+
+        double framesPerPixel = (double)(end - start) / numPixels;
+        size_t level = 0;
+        while (level + 1 < levels_.size() && (double)((int64)blockSize_ << (level + 1)) <= framesPerPixel) {
+            level++;
+        }
+
+        const BucketVector& buckets = levels_[level];
+        int64 blockSize = (int64)blockSize_ << level;
+        int64 lastBlock = buckets.size() / numChannels_ - 1;
+
+        for (size_t p = 0; p < numPixels; ++p)
+        {
+            int64 first = start + (int64)(p * framesPerPixel);
+            int64 last = std::max(first, start + (int64)((p + 1) * framesPerPixel) - 1);
+            int64 firstBlock = std::min(first / blockSize, lastBlock);
+            int64 endBlock = std::min(last / blockSize, lastBlock) + 1;
+
+            Peak& peak = output[p];
+            float power = 0.f;
+            float weight = 0.f;
+            peak.min_ = FLT_MAX;
+            peak.max_ = -FLT_MAX;
+
+            for (int64 b = firstBlock; b < endBlock; ++b)
+            {
+                const Bucket& bucket = buckets[(size_t)(b * numChannels_ + channel)];
+                float numFrames = (float)getNumFrames(level, b);
+                peak.min_ = std::min(peak.min_, bucket.min_);
+                peak.max_ = std::max(peak.max_, bucket.max_);
+                power += bucket.power_ * numFrames;
+                weight += numFrames;
+            }
+            peak.rms_ = sqrtf(power / weight);
+        }
+    }
+
+
+
+    //--------------------------------------------------------------------
+    // Sidecar file
+    //--------------------------------------------------------------------
+
+    // The overview is empty and incomplete when the sidecar can not be used.
+    //
+    bool WaveformOverview::load(const Path& overviewPath, const Path& audioPath)
+    {
+        levels_.clear();
+        numChannels_ = 0;
+        numFrames_ = 0;
+        complete_ = false;
+
+        OverviewHeader header;
+        int64 fileSize, fileTime;
+        if (AudioFile::getFileStamp(audioPath, fileSize, fileTime) == false)
+            return false;
+
+        FILE* handle = fopen(overviewPath.string().c_str(), "rb");
+        if (handle == NULL)
+            return false;
+
+        bool result = fread(&header, sizeof(header), 1, handle) == 1 &&
+            header.magic_ == overviewMagic && header.version_ == overviewVersion &&
+            header.fileSize_ == fileSize && header.fileTime_ == fileTime &&
+            header.numChannels_ > 0 && header.blockSize_ > 0 && header.numFrames_ > 0 &&
+            header.numBuckets_ == (header.numFrames_ + header.blockSize_ - 1) / header.blockSize_ * header.numChannels_;
+
+        if (result)
+        {
+            blockSize_ = header.blockSize_;
+            init(header.numChannels_);
+
+            BucketVector& level = levels_[0];
+            level.resize((size_t)header.numBuckets_);
+            result = fread(&level[0], sizeof(Bucket), level.size(), handle) == level.size();
+        }
+        fclose(handle);
+
+        if (result == false) {
+            levels_.clear();
+            numChannels_ = 0;
+            return false;
+        }
+
+        numFrames_ = header.numFrames_;
+        buildLevels();
+        complete_ = true;
+        return true;
+    }
+
+
+
+    bool WaveformOverview::store(const Path& overviewPath, const Path& audioPath) const
+    {
+        ASSERT(complete_);
+
+        OverviewHeader header;
+        header.magic_       = overviewMagic;
+        header.version_     = overviewVersion;
+        header.numChannels_ = numChannels_;
+        header.blockSize_   = blockSize_;
+        header.numFrames_   = numFrames_;
+        header.numBuckets_  = levels_[0].size();
+        if (levels_[0].empty() || AudioFile::getFileStamp(audioPath, header.fileSize_, header.fileTime_) == false)
+            return false;
+
+        FILE* handle = fopen(overviewPath.string().c_str(), "wb");
+        if (handle == NULL)
+            return false;
+
+        bool result = fwrite(&header, sizeof(header), 1, handle) == 1 &&
+            fwrite(&levels_[0][0], sizeof(Bucket), levels_[0].size(), handle) == levels_[0].size();
+        result &= fclose(handle) == 0;
+
+        if (result == false) {
+            boost::system::error_code error;
+            boost::filesystem::remove(overviewPath, error);
+        }
+        return result;
+    }
+
+
+
+    Path WaveformOverview::getOverviewPath(const Path& audioPath)
+    {
+        Path path = audioPath;
+        path += ".e3ovw";
+
+        return path;
+    }
+
+} // namespace e3
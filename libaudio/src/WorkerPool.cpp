@@ -0,0 +1,136 @@
+//------------------------------------------------------------
+// WorkerPool.cpp
+// Shared threads for background jobs
+//------------------------------------------------------------
+
+#include <algorithm>
+
+#include <e3_Exception.h>
+#include <e3_Trace.h>
+
+#include <WorkerPool.h>
+
+
+namespace e3 {
+
+    DEFINE_THREADSAFE_SINGLETON(WorkerPool)
+
+
+    WorkerPool::WorkerPool() :
+        numThreads_(0),
+        generation_(0),
+        running_(false)
+    {}
+
+
+
+    WorkerPool::~WorkerPool()
+    {
+        stop();
+    }
+
+
+
+    void WorkerPool::post(const Job& job)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        jobs_.push_back(job);
+        if (running_ == false) {
+            start();
+        }
+        condition_.notify_one();
+    }
+
+
+
+    void WorkerPool::stop()
+    {
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+            threads.swap(threads_);
+            condition_.notify_all();
+        }
+        for (size_t i = 0; i < threads.size(); ++i) {
+            threads[i].join();
+        }
+    }
+
+
+
+    void WorkerPool::setNumThreads(size_t numThreads)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        numThreads_ = numThreads;
+    }
+
+
+
+    size_t WorkerPool::getNumThreads() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return (numThreads_ > 0) ? numThreads_ : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+
+
+    size_t WorkerPool::getNumPending() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return jobs_.size();
+    }
+
+
+
+    // Called with mutex_ locked
+    //
+    void WorkerPool::start()
+    {
+        ASSERT(threads_.empty());
+
+        size_t numThreads = (numThreads_ > 0) ? numThreads_ : std::max(1u, std::thread::hardware_concurrency());
+        running_ = true;
+        generation_++;
+
+        for (size_t i = 0; i < numThreads; ++i) {
+            threads_.push_back(std::thread(&WorkerPool::run, this, generation_));
+        }
+    }
+
+
+
+    // Threads of an earlier generation end, also if the pool was
+    // started again before they could be joined by stop.
+    //
+    void WorkerPool::run(size_t generation)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (true)
+        {
+            while (running_ && generation_ == generation && jobs_.empty()) {
+                condition_.wait(lock);
+            }
+            if (running_ == false || generation_ != generation)
+                break;
+
+            Job job = jobs_.front();
+            jobs_.pop_front();
+            lock.unlock();
+
+            try {
+                job();
+            }
+            catch (const std::exception& e) {
+                TRACE("WorkerPool: job failed: %s\n", e.what());
+            }
+            catch (...) {
+                TRACE("WorkerPool: job failed\n");
+            }
+            lock.lock();
+        }
+    }
+
+} // namespace e3
@@ -0,0 +1,129 @@
+//------------------------------------------------------------
+// ZoneIndex.cpp
+// Key and velocity zones of many instrument chunks
+//------------------------------------------------------------
+
+#include <algorithm>
+
+#include <e3_Exception.h>
+
+#include <ZoneIndex.h>
+
+
+namespace e3 {
+
+    namespace {
+
+        int clampNote(int value)
+        {
+            return std::min(127, std::max(0, value));
+        }
+
+    } // namespace
+
+
+
+    ZoneIndex::ZoneIndex() :
+        loopStart_(1, 0),
+        numIndexed_(0)
+    {}
+
+
+
+    void ZoneIndex::clear()
+    {
+        keyLow_.clear();
+        keyHigh_.clear();
+        velocityLow_.clear();
+        velocityHigh_.clear();
+        baseNote_.clear();
+        detune_.clear();
+        gain_.clear();
+
+        loopStart_.assign(1, 0);
+        loops_.clear();
+
+        for (int key = 0; key < numNotes_s; ++key) {
+            keyZones_[key].clear();
+        }
+        numIndexed_ = 0;
+    }
+
+
+
+    void ZoneIndex::reserve(size_t numZones)
+    {
+        keyLow_.reserve(numZones);
+        keyHigh_.reserve(numZones);
+        velocityLow_.reserve(numZones);
+        velocityHigh_.reserve(numZones);
+        baseNote_.reserve(numZones);
+        detune_.reserve(numZones);
+        gain_.reserve(numZones);
+        loopStart_.reserve(numZones + 1);
+    }
+
+
+
+    ZoneIndex::ZoneId ZoneIndex::add(const InstrumentChunk& chunk)
+    {
+        ZoneId zone = (ZoneId)size();
+
+        keyLow_.push_back((uint8)clampNote(chunk.getKeyLow()));
+        keyHigh_.push_back((uint8)clampNote(chunk.getKeyHigh()));
+        velocityLow_.push_back((uint8)clampNote(chunk.getVelocityLow()));
+        velocityHigh_.push_back((uint8)clampNote(chunk.getVelocityHigh()));
+        baseNote_.push_back((uint8)clampNote(chunk.getBaseNote()));
+        detune_.push_back((int16)chunk.getDetune());
+        gain_.push_back((int16)chunk.getGain());
+
+        const InstrumentChunk::LoopVector& loops = chunk.getLoops();
+        loops_.insert(loops_.end(), loops.begin(), loops.end());
+        loopStart_.push_back((uint32)loops_.size());
+
+        return zone;
+    }
+
+
+
+    // Zone ids grow, so appending keeps every key list in the order
+    // the zones were added.
+    //
+    void ZoneIndex::update()
+    {
+        for (size_t zone = numIndexed_; zone < size(); ++zone)
+        {
+            KeyZone keyZone;
+            keyZone.velocityLow_ = velocityLow_[zone];
+            keyZone.velocityHigh_ = velocityHigh_[zone];
+            keyZone.zone_ = (ZoneId)zone;
+
+            for (int key = keyLow_[zone]; key <= keyHigh_[zone]; ++key) {
+                keyZones_[key].push_back(keyZone);
+            }
+        }
+        numIndexed_ = size();
+    }
+
+
+
+    size_t ZoneIndex::find(int note, int velocity, ZoneIdVector& result) const
+    {
+        ASSERT(note >= 0 && note < numNotes_s);
+        ASSERT(velocity >= 0 && velocity < numNotes_s);
+
+        const KeyZoneVector& keyZones = keyZones_[note];
+        size_t numFound = 0;
+
+        for (size_t i = 0; i < keyZones.size(); ++i)
+        {
+            const KeyZone& keyZone = keyZones[i];
+            if (velocity >= keyZone.velocityLow_ && velocity <= keyZone.velocityHigh_) {
+                result.push_back(keyZone.zone_);
+                numFound++;
+            }
+        }
+        return numFound;
+    }
+
+} // namespace e3
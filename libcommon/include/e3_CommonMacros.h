@@ -63,6 +63,32 @@ public:                                 \
         TClass( const TClass& );
 
 
+// Declares a class as singleton whose instance may first be requested
+// by several threads at once. The instance is created under call_once,
+// function local statics are not initialized thread safe by VS2013.
+// Needs <mutex> and DEFINE_THREADSAFE_SINGLETON in the source file.
+//
+#define DECLARE_THREADSAFE_SINGLETON( TClass )                      \
+public:                                                             \
+    static TClass& instance()                                       \
+    {                                                               \
+        std::call_once(instanceFlag_s, &TClass::createInstance);    \
+        return createInstance();                                    \
+    }                                                               \
+    private:                                                        \
+        static TClass& createInstance()                             \
+        {                                                           \
+            static TClass _instance;                                \
+            return _instance;                                       \
+        }                                                           \
+        static std::once_flag instanceFlag_s;                       \
+        TClass();                                                   \
+        TClass( const TClass& );
+
+#define DEFINE_THREADSAFE_SINGLETON( TClass )                       \
+    std::once_flag TClass::instanceFlag_s;
+
+
 #if _MSC_VER
 #define FORCE_SEMICOLON(x) \
    __pragma(warning(push)) \